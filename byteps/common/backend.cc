@@ -0,0 +1,154 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <cstring>
+
+#include "backend.h"
+#include "global.h"
+#include "logging.h"
+
+namespace byteps {
+namespace common {
+
+BytePSBackendPSLite::BytePSBackendPSLite() {
+    BPS_CHECK(getenv("DMLC_NUM_SERVER")) << "error: env DMLC_NUM_SERVER not set";
+    _ps = new ps::KVWorker<char>(0, 0);
+    ps::StartAsync(0, "byteps\0");
+    if (!ps::Postoffice::Get()->is_recovery()) {
+        ps::Postoffice::Get()->Barrier(
+            0, ps::kWorkerGroup + ps::kServerGroup + ps::kScheduler);
+    }
+}
+
+BytePSBackendPSLite::~BytePSBackendPSLite() {
+    ps::Finalize(0, false);
+    delete _ps;
+}
+
+void BytePSBackendPSLite::Init(uint64_t key, char* data, int len, int dtype) {
+    // encode the key for pskv scattering
+    auto& pskv = BytePSGlobal::EncodeDefaultKey(key, len);
+    // false means not to delete data when SArray is deleted
+    ps::SArray<char> vals(data, len, false);
+    int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
+    // blocking push, also as a global barrirer
+    _ps->Wait(_ps->ZPush(pskv.keys, vals, pskv.lens, cmd));
+}
+
+void BytePSBackendPSLite::Push(uint64_t key, char* data, int len, int dtype,
+                               std::function<void()> cb) {
+    auto& pskv = BytePSGlobal::EncodeDefaultKey(key, len);
+    ps::SArray<char> vals(data, len, false);
+    int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
+    _ps->ZPush(pskv.keys, vals, pskv.lens, cmd, cb);
+}
+
+void BytePSBackendPSLite::Pull(uint64_t key, char* data, int len, int dtype,
+                               std::function<void()> cb) {
+    auto& pskv = BytePSGlobal::EncodeDefaultKey(key, len);
+    auto vals = new ps::SArray<char>(data, len, false);
+    int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
+    _ps->ZPull(pskv.keys, vals, &pskv.lens, cmd,
+               [vals, cb]() {
+                   delete vals;
+                   cb();
+               });
+}
+
+BytePSBackendLoopback::BytePSBackendLoopback(int num_worker) : _num_worker(num_worker) {
+    BPS_CHECK_GE(num_worker, 1);
+    // summing on its own, not as a peer of the cross-PCIe-switch reducers
+    _reducer.reset(new CpuReducer(nullptr));
+    _thread = std::thread(&BytePSBackendLoopback::ServeLoop, this);
+    BPS_LOG(DEBUG) << "Using loopback PS backend, simulating " << num_worker << " workers";
+}
+
+BytePSBackendLoopback::~BytePSBackendLoopback() {
+    {
+        std::lock_guard<std::mutex> lock(_mu);
+        _stop = true;
+    }
+    _cv.notify_one();
+    _thread.join();
+}
+
+void BytePSBackendLoopback::Init(uint64_t key, char* data, int len, int dtype) {
+    // the only worker is at the barrier already
+    std::lock_guard<std::mutex> lock(_mu);
+    _store[key].assign(data, data + len);
+}
+
+void BytePSBackendLoopback::Push(uint64_t key, char* data, int len, int dtype,
+                                 std::function<void()> cb) {
+    Enqueue({ true, key, data, len, dtype, cb });
+}
+
+void BytePSBackendLoopback::Pull(uint64_t key, char* data, int len, int dtype,
+                                 std::function<void()> cb) {
+    Enqueue({ false, key, data, len, dtype, cb });
+}
+
+void BytePSBackendLoopback::Enqueue(Request req) {
+    {
+        std::lock_guard<std::mutex> lock(_mu);
+        _requests.push_back(std::move(req));
+    }
+    _cv.notify_one();
+}
+
+void BytePSBackendLoopback::ServeLoop() {
+    while (true) {
+        Request req;
+        std::vector<char>* stored;
+        {
+            std::unique_lock<std::mutex> lock(_mu);
+            _cv.wait(lock, [this] { return _stop || !_requests.empty(); });
+            if (_requests.empty()) {
+                return;
+            }
+            req = std::move(_requests.front());
+            _requests.pop_front();
+            auto it = _store.find(req.key);
+            BPS_CHECK(it != _store.end()) << "key " << req.key << " is not initialized";
+            stored = &it->second;
+        }
+        BPS_CHECK_EQ(stored->size(), (size_t) req.len) << "The value size cannot be changed "
+                                                       << req.len << ". Key is " << req.key;
+
+        if (req.push) {
+            // A pull follows its push, so one buffer per key is enough. The
+            // pushes of all workers are summed in one pass over their data.
+            std::vector<void*> srcs(_num_worker, req.data);
+            _reducer->reduce_n(stored->data(), srcs.data(), _num_worker, req.len,
+                               (DataType) req.dtype, BYTEPS_OP_SUM);
+        }
+        else {
+            memcpy(req.data, stored->data(), req.len);
+        }
+        req.cb();
+    }
+}
+
+std::shared_ptr<BytePSBackend> CreateBackend() {
+    std::string backend = getenv("BYTEPS_PS_BACKEND") ? getenv("BYTEPS_PS_BACKEND") : "ps-lite";
+    if (backend == "loopback") {
+        return std::make_shared<BytePSBackendLoopback>(BytePSGlobal::GetNumWorker());
+    }
+    BPS_CHECK(backend == "ps-lite") << "unknown BYTEPS_PS_BACKEND " << backend;
+    return std::make_shared<BytePSBackendPSLite>();
+}
+
+} // namespace common
+} // namespace byteps
@@ -0,0 +1,109 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_BACKEND_H
+#define BYTEPS_BACKEND_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "common.h"
+#include "cpu_reducer.h"
+#include "ps/ps.h"
+
+namespace byteps {
+namespace common {
+
+// The parameter servers as seen from the root device of a worker.
+// Push and Pull return at once and call back from a backend thread.
+class BytePSBackend {
+
+public:
+    virtual ~BytePSBackend() {}
+
+    // Blocking, sets the initial value of key, also a barrier of all workers
+    virtual void Init(uint64_t key, char* data, int len, int dtype) = 0;
+    virtual void Push(uint64_t key, char* data, int len, int dtype,
+                      std::function<void()> cb) = 0;
+    virtual void Pull(uint64_t key, char* data, int len, int dtype,
+                      std::function<void()> cb) = 0;
+};
+
+// ps-lite, talking to the scheduler and the servers
+class BytePSBackendPSLite : public BytePSBackend {
+
+public:
+    BytePSBackendPSLite();
+    ~BytePSBackendPSLite();
+
+    void Init(uint64_t key, char* data, int len, int dtype);
+    void Push(uint64_t key, char* data, int len, int dtype, std::function<void()> cb);
+    void Pull(uint64_t key, char* data, int len, int dtype, std::function<void()> cb);
+
+private:
+    ps::KVWorker<char>* _ps;
+};
+
+// Serves the pushes and pulls in process, so that the whole pipeline runs
+// on one host without scheduler, servers or network. The other workers are
+// simulated to push the same data, i.e. every push is summed num_worker
+// times into the stored value like a server would do.
+class BytePSBackendLoopback : public BytePSBackend {
+
+public:
+    BytePSBackendLoopback(int num_worker);
+    ~BytePSBackendLoopback();
+
+    void Init(uint64_t key, char* data, int len, int dtype);
+    void Push(uint64_t key, char* data, int len, int dtype, std::function<void()> cb);
+    void Pull(uint64_t key, char* data, int len, int dtype, std::function<void()> cb);
+
+private:
+    struct Request {
+        bool push;
+        uint64_t key;
+        char* data;
+        int len;
+        int dtype;
+        std::function<void()> cb;
+    };
+
+    void Enqueue(Request req);
+    void ServeLoop();
+
+    int _num_worker;
+    std::unique_ptr<CpuReducer> _reducer;
+
+    // the stored values never move, as unordered_map does not move its nodes
+    std::unordered_map<uint64_t, std::vector<char>> _store;
+    std::deque<Request> _requests;
+    std::mutex _mu;
+    std::condition_variable _cv;
+    bool _stop = false;
+    std::thread _thread;
+};
+
+// Selected by BYTEPS_PS_BACKEND, ps-lite by default
+std::shared_ptr<BytePSBackend> CreateBackend();
+
+} // namespace common
+} // namespace byteps
+
+#endif // BYTEPS_BACKEND_H
@@ -16,6 +16,7 @@
 
 #include <sstream>
 #include <cassert>
+#include <cmath>
 
 #include "common.h"
 #include "logging.h"
@@ -116,6 +117,14 @@ int GetCommandType(RequestType requestType, int d) {
   return (((m + d) * (m + d + 1)) / 2) + d;
 }
 
+void DecodeCommandType(int cmd, RequestType* requestType, int* d) {
+  // cmd is the Cantor pairing of (m, d), w = m + d
+  int w = static_cast<int>((std::sqrt(8.0 * cmd + 1) - 1) / 2);
+  *d = cmd - (w * (w + 1)) / 2;
+  *requestType = static_cast<RequestType>(w - *d);
+}
+
+#ifndef BYTEPS_CPU_ONLY
 ncclDataType_t getNcclDataType(DataType dtype) {
   switch (dtype) {
     case BYTEPS_FLOAT32:
@@ -132,18 +141,44 @@ ncclDataType_t getNcclDataType(DataType dtype) {
       return ncclInt8;
     case BYTEPS_INT64:
       return ncclUint64;
+    case BYTEPS_BFLOAT16:
+#if defined(NCCL_VERSION_CODE) && NCCL_VERSION_CODE >= 21000
+      return ncclBfloat16;
+#else
+      BPS_CHECK(0) << "BYTEPS_BFLOAT16 requires NCCL >= 2.10";
+      break;
+#endif
     default:
       BPS_CHECK(0) << "Unsupported data type: " << dtype;
   }
   return ncclFloat32;
 }
 
+ncclRedOp_t getNcclRedOp(ReduceOp op) {
+  switch (op) {
+    case BYTEPS_OP_SUM:
+    case BYTEPS_OP_AVERAGE: // the division is part of the task's scale
+      return ncclSum;
+    case BYTEPS_OP_MAX:
+      return ncclMax;
+    case BYTEPS_OP_MIN:
+      return ncclMin;
+    case BYTEPS_OP_PRODUCT:
+      return ncclProd;
+    default:
+      BPS_CHECK(0) << "Unsupported reduce op: " << op;
+  }
+  return ncclSum;
+}
+#endif
+
 int getDataTypeLength(int dtype) {
   switch (dtype) {
     case BYTEPS_INT8:
     case BYTEPS_UINT8:
       return 1;
     case BYTEPS_FLOAT16:
+    case BYTEPS_BFLOAT16:
       return 2;
     case BYTEPS_INT32:
     case BYTEPS_FLOAT32:
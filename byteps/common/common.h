@@ -24,8 +24,10 @@
 #include <atomic>
 #include <vector>
 #include <mutex>
+#ifndef BYTEPS_CPU_ONLY
 #include <nccl.h>
 #include <cuda_runtime.h>
+#endif
 
 namespace byteps {
 namespace common {
@@ -34,6 +36,16 @@ namespace common {
 #define CPU_DEVICE_ID (-1)
 #define UNDECIDED_DEVICE_ID (-2)
 
+// A PS key is the declared key of the tensor in the upper bits and the index
+// of the partition in the lower ones. Each server owns 2^64 / num_servers
+// keys, so for up to 2^16 servers the keys stay below 2^48.
+#define BYTEPS_KEY_PARTITION_BITS 20
+#define BYTEPS_KEY_DECLARED_BITS 28
+// The MXNet server does not handle keys beyond 2^32, so for it the keys are
+// split 16/16 instead, see BytePSGlobal::GetKeyPartitionBits()
+#define BYTEPS_KEY_MXNET_PARTITION_BITS 16
+#define BYTEPS_KEY_MXNET_DECLARED_BITS 16
+
 // Keep the order consistent with DMLC/mshadow
 // https://github.com/dmlc/mshadow/blob/master/mshadow/base.h
 enum DataType {
@@ -44,6 +56,7 @@ enum DataType {
   BYTEPS_INT32 = 4,
   BYTEPS_INT8 = 5,
   BYTEPS_INT64 = 6,
+  BYTEPS_BFLOAT16 = 12, // kBfloat16, 7-11 are other integer types in mshadow
   // below are not in mshadow, should avoid using these
   // BYTEPS_UINT16 = 7,
   // BYTEPS_INT16 = 8,
@@ -51,6 +64,16 @@ enum DataType {
   // BYTEPS_BYTE = 10,
 };
 
+// Reduction applied across all workers. AVERAGE reduces as SUM with the
+// scale factor of each task divided by the number of workers.
+enum ReduceOp {
+  BYTEPS_OP_SUM = 0,
+  BYTEPS_OP_AVERAGE = 1,
+  BYTEPS_OP_MAX = 2,
+  BYTEPS_OP_MIN = 3,
+  BYTEPS_OP_PRODUCT = 4,
+};
+
 // List of supported frameworks.
 enum Framework { TENSORFLOW, PYTORCH, MXNET };
 
@@ -119,6 +142,9 @@ public:
   virtual ~ReadyEvent() = default;
 };
 
+struct BytePSFusionGroup;
+struct TensorTableEntry;
+
 typedef struct BytePSContext {
     bool initialized;
     std::mutex init_mutex;
@@ -134,7 +160,28 @@ typedef struct BytePSContext {
     void* gpu_ptr;
     // CPU buffer for cross-PCIe-switch merging
     std::vector<void*> pcie_cpubuff;
+    // CPU-only builds: input copy of each local rank, all in shared memory
+    std::vector<void*> rank_cpubuff;
     size_t buff_len;
+    // size of all partitions but the last, see partition.h
+    size_t partition_bytes;
+    // reduction op and data type, fixed at init
+    ReduceOp op = BYTEPS_OP_SUM;
+    DataType dtype = BYTEPS_FLOAT32;
+    // whether the tensor may share a fusion buffer, see fusion.h
+    bool fusible = false;
+    // how often EnqueueTensor() has seen the tensor before the fusion plan
+    int enqueues = 0;
+    // the fusion group and the offset of the tensor in its buffer, if fused
+    BytePSFusionGroup* fusion = nullptr;
+    size_t fusion_offset = 0;
+    int fusion_index = 0;
+    // entries of the tensor with their partitions, reused across iterations,
+    // see GetTensorEntry()
+    std::mutex entry_mutex;
+    std::vector<std::shared_ptr<TensorTableEntry>> entries;
+    // the push and pull queues by device, see GetPushPullQueueList()
+    std::unordered_map<int, std::shared_ptr<std::vector<QueueType>>> queue_lists;
 } BPSContext;
 
 class Tensor {
@@ -180,16 +227,30 @@ struct TensorTableEntry {
   void* gpu_ptr;
   // CPU buffer for cross-PCIe-switch merging
   std::vector<void*> pcie_cpubuff;
-  // The (deep copy of) queue list of this task
-  std::vector<QueueType> queue_list;
+  // CPU-only builds: input copy of each local rank, all in shared memory
+  std::vector<void*> rank_cpubuff;
+  // The queue list of this task, shared by all partitions
+  std::shared_ptr<std::vector<QueueType>> queue_list;
+  // The index of the current queue in queue_list
+  size_t stage = 0;
   // The offset of this partition
-  unsigned int offset = 0;
+  size_t offset = 0;
   // The length of this partition
-  unsigned int len = 0;
-  // Atomic counter
-  std::shared_ptr<std::atomic_int> counter_ptr;
+  size_t len = 0;
+  // The entry of the whole tensor if this is a partition
+  TensorTableEntry* parent = nullptr;
+  // The partitions if this is the entry of the whole tensor
+  std::vector<std::shared_ptr<TensorTableEntry>> partitions;
+  // How many partitions are finished
+  std::atomic_int counter{0};
   // How many partitions
   unsigned int total_partnum = 0;
+  // Reduction op of the context
+  ReduceOp op = BYTEPS_OP_SUM;
+  // Factor the reduced result is multiplied by, see BytePSGlobal::GetScaleStage()
+  double scale = 1.0;
+  // The entries of the member tensors if this is a fusion buffer
+  std::vector<std::shared_ptr<TensorTableEntry>> fused;
 };
 using TensorTable = std::unordered_map<std::string, TensorTableEntry>;
 
@@ -198,9 +259,15 @@ enum class RequestType {
 };
 
 int GetCommandType(RequestType requestType, int d);
+// The inverse of GetCommandType(), for the server
+void DecodeCommandType(int cmd, RequestType* requestType, int* d);
 
+#ifndef BYTEPS_CPU_ONLY
 ncclDataType_t getNcclDataType(DataType dtype);
 
+ncclRedOp_t getNcclRedOp(ReduceOp op);
+#endif
+
 int getDataTypeLength(int dtype);
 
 } // namespace common
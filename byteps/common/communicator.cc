@@ -18,10 +18,82 @@
 #include "global.h"
 #include <cerrno>
 #include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 namespace byteps {
 namespace common {
 
 
+void BytePSComm::initFromEnv(int* rank, int* size, int* local_rank, int* local_size,
+                             int* worker_id, BytePSRole* my_role) {
+    // We should init rank, size, etc. using getenv
+    // do env check
+    BPS_CHECK(getenv("BYTEPS_LOCAL_RANK")) << "error: env BYTEPS_LOCAL_RANK not set";
+    BPS_CHECK(getenv("BYTEPS_LOCAL_SIZE")) << "error: env BYTEPS_LOCAL_SIZE not set";
+    BPS_CHECK(getenv("DMLC_WORKER_ID")) << "error: env DMLC_WORKER_ID not set";
+    BPS_CHECK(getenv("DMLC_NUM_WORKER")) << "error: env DMLC_NUM_WORKER not set";
+
+    *local_rank = atoi(getenv("BYTEPS_LOCAL_RANK"));
+    *local_size = atoi(getenv("BYTEPS_LOCAL_SIZE"));
+    *worker_id = atoi(getenv("DMLC_WORKER_ID"));
+    auto num_worker = atoi(getenv("DMLC_NUM_WORKER"));
+
+    // we assume _local_size (i.e., # GPU) is consistent on all workers
+    *rank = (*local_rank) + (*worker_id) * (*local_size);
+    *size = num_worker * (*local_size);
+
+    _rank = *rank;
+    _size = *size;
+    _local_rank = *local_rank;
+    _local_size = *local_size;
+    _worker_id = *worker_id;
+
+    for (int i = 0; i < _local_size; i++) {
+        _members.push_back(i);
+    }
+    _root = _members.back();
+
+    *my_role = (_local_rank == _root) ? LOCAL_ROOT : LOCAL_WORKER;
+}
+
+void BytePSComm::initFromComm(std::shared_ptr<BytePSComm> comm, const std::vector<int> &members) {
+    _rank = comm->getRank();
+    _size = comm->getSize();
+    _local_rank = comm->getLocalRank();
+    _local_size = comm->getLocalSize();
+    _worker_id = comm->getWorkerID();
+    _members = (members.size() > 0) ? members : comm->getMembers();
+    _root = _members.back();
+}
+
+void BytePSComm::handleSignalAtRoot(const BytePSCommMsg &message) {
+    switch (message.signal) {
+        case REDUCE_READY:
+            BytePSGlobal::GetReduceTable()->AddReadyCount(message.key);
+            break;
+        case PCIE_REDUCE_READY:
+            BytePSGlobal::GetPcieReduceTable()->AddReadyCount(message.key);
+            break;
+        case BCAST_READY:
+            BytePSGlobal::GetBroadcastTable()->AddReadyCount(message.key);
+            break;
+        case PUSH_READY:
+            BytePSGlobal::GetPushTable()->AddReadyCount(message.key);
+            break;
+        default:
+            BPS_CHECK(0) << "unsupported signal: " << message.signal;
+    }
+
+    BPS_LOG(TRACE) << "root recved: src=" << message.src
+                   << ", signal=" << message.signal
+                   << ", key=" << message.key
+                   << ", myrank=" << _local_rank;
+}
+
 // Copy constructor that provides the option to reconfigure members.
 // The ranks in members always use local_rank, regardless that the members 
 // may be a subset of all local ranks.
@@ -29,20 +101,12 @@ BytePSCommSocket::BytePSCommSocket(std::shared_ptr<BytePSComm> comm,
                                    const std::string &path_suffix,
                                    const std::vector<int> &members) {
     std::shared_ptr<BytePSCommSocket> sock_comm = std::static_pointer_cast<BytePSCommSocket>(comm);
-    // TODO: use private members directly
-    _rank = sock_comm->getRank();
-    _size = sock_comm->getSize();
-    _local_rank = sock_comm->getLocalRank();
-    _local_size = sock_comm->getLocalSize();
-    _worker_id = sock_comm->getWorkerID();
+    initFromComm(comm, members);
     _send_path = sock_comm->getSendPath() + path_suffix;
     _recv_path = sock_comm->getRecvPath() + path_suffix;
     _send_fd = initSocket(_local_rank, _send_path);
     _recv_fd = initSocket(_local_rank, _recv_path);
 
-    _members = (members.size() > 0) ? members : sock_comm->getMembers();
-    _root = _members.back();
-
     auto my_role = (_local_rank == _root) ? LOCAL_ROOT : LOCAL_WORKER;
     bool is_root = (my_role == LOCAL_ROOT) ? true : false;
     // init socket comm
@@ -60,34 +124,7 @@ void BytePSCommSocket::init(int* rank, int* size, int* local_rank, int* local_si
 
     BPS_LOG(DEBUG) << "Using Communicator=Socket";
 
-    // We should init rank, size, etc. using getenv
-    // do env check
-    BPS_CHECK(getenv("BYTEPS_LOCAL_RANK")) << "error: env BYTEPS_LOCAL_RANK not set";
-    BPS_CHECK(getenv("BYTEPS_LOCAL_SIZE")) << "error: env BYTEPS_LOCAL_SIZE not set";
-    BPS_CHECK(getenv("DMLC_WORKER_ID")) << "error: env DMLC_WORKER_ID not set";
-    BPS_CHECK(getenv("DMLC_NUM_WORKER")) << "error: env DMLC_NUM_WORKER not set";
-
-    *local_rank = atoi(getenv("BYTEPS_LOCAL_RANK"));
-    *local_size = atoi(getenv("BYTEPS_LOCAL_SIZE"));
-    *worker_id = atoi(getenv("DMLC_WORKER_ID"));
-    auto num_worker = atoi(getenv("DMLC_NUM_WORKER"));
-
-    // we assume _local_size (i.e., # GPU) is consistent on all workers
-    *rank = (*local_rank) + (*worker_id) * (*local_size);
-    *size = num_worker * (*local_size);
-
-    _rank = *rank;
-    _size = *size;
-    _local_rank = *local_rank;
-    _local_size = *local_size;
-    _worker_id = *worker_id;
-
-    for (int i = 0; i < _local_size; i++) {
-        _members.push_back(i);
-    }
-    _root = _members.back();
-
-    *my_role = (_local_rank == _root) ? LOCAL_ROOT : LOCAL_WORKER;
+    initFromEnv(rank, size, local_rank, local_size, worker_id, my_role);
     bool is_root = (*my_role == LOCAL_ROOT) ? true : false;
 
     _send_path = std::string(BASE_SOCKET_PATH_SEND);
@@ -149,28 +186,7 @@ void BytePSCommSocket::startListenThread() { // only root starts this in backgro
         BPS_CHECK_GE(rc, 0) << std::strerror(errno) << ", rank=" << _local_rank;
 
         auto message = *(BytePSCommMsg*) buffer;
-
-        switch (message.signal) {
-            case REDUCE_READY:
-                BytePSGlobal::GetReduceTable()->AddReadyCount(message.key);
-                break;
-            case PCIE_REDUCE_READY:
-                BytePSGlobal::GetPcieReduceTable()->AddReadyCount(message.key);
-                break;
-            case BCAST_READY:
-                BytePSGlobal::GetBroadcastTable()->AddReadyCount(message.key);
-                break;
-            case PUSH_READY:
-                BytePSGlobal::GetPushTable()->AddReadyCount(message.key);
-                break;
-            default:
-                BPS_CHECK(0) << "unsupported signal: " << message.signal;
-        }
-
-        BPS_LOG(TRACE) << "root socket recved: src=" << message.src
-                       << ", signal=" << message.signal
-                       << ", key=" << message.key
-                       << ", myrank=" << _local_rank;
+        handleSignalAtRoot(message);
     }
 }
 
@@ -232,5 +248,302 @@ int BytePSCommSocket::broadcastSignal(void* data, int len) {
     return 0;
 }
 
+std::shared_ptr<BytePSComm> CreateComm() {
+    auto use_shm = getenv("BYTEPS_USE_SHM_COMM");
+    if (use_shm && atoi(use_shm)) {
+        return std::make_shared<BytePSCommShm>();
+    }
+    return std::make_shared<BytePSCommSocket>();
+}
+
+std::shared_ptr<BytePSComm> CreateComm(std::shared_ptr<BytePSComm> comm,
+                                       const std::string &suffix,
+                                       const std::vector<int> &members) {
+    if (std::dynamic_pointer_cast<BytePSCommShm>(comm)) {
+        return std::make_shared<BytePSCommShm>(comm, suffix, members);
+    }
+    return std::make_shared<BytePSCommSocket>(comm, suffix, members);
+}
+
+namespace {
+
+const uint32_t kShmRingWrap = 0xFFFFFFFF;
+
+inline uint64_t ShmRecordSize(int len) {
+    return (sizeof(uint32_t) + len + 7) & ~7ULL;
+}
+
+inline int FutexWait(std::atomic<uint32_t>* addr, uint32_t val) {
+    // not FUTEX_PRIVATE: the doorbell is shared across processes
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT,
+                   val, nullptr, nullptr, 0);
+}
+
+inline int FutexWake(std::atomic<uint32_t>* addr) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE,
+                   INT32_MAX, nullptr, nullptr, 0);
+}
+
+// Start time of a process in clock ticks since boot, 0 if it does not exist.
+// Unlike the pid, it tells a restarted job from the one that left an inbox.
+uint64_t ProcessStartTime(int pid) {
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line)) return 0;
+    // the command name may contain spaces, the fields after it do not
+    auto pos = line.rfind(')');
+    if (pos == std::string::npos) return 0;
+    std::istringstream fields(line.substr(pos + 1));
+    // starttime is field 22, the 20th after the command name
+    std::string field;
+    for (int i = 0; i < 20; ++i) {
+        if (!(fields >> field)) return 0;
+    }
+    return strtoull(field.c_str(), nullptr, 10);
+}
+
+} // namespace
+
+BytePSCommShm::BytePSCommShm(std::shared_ptr<BytePSComm> comm,
+                             const std::string &name_suffix,
+                             const std::vector<int> &members) {
+    std::shared_ptr<BytePSCommShm> shm_comm = std::static_pointer_cast<BytePSCommShm>(comm);
+    initFromComm(comm, members);
+    _name = shm_comm->getName() + name_suffix;
+    _inbox = openInbox(_local_rank, true);
+
+    bool is_root = (_local_rank == _root);
+    if (is_root) {
+        _listen_thread = new std::thread(&BytePSCommShm::startListenThread, this);
+    }
+
+    BPS_LOG(DEBUG) << "This is " << name_suffix << (is_root ? " ROOT" : " WORKER")
+                   << " device, rank=" << _local_rank
+                   << ", shm inbox created successfully";
+}
+
+void BytePSCommShm::init(int* rank, int* size, int* local_rank, int* local_size,
+                         int* worker_id, BytePSRole* my_role) {
+
+    BPS_LOG(DEBUG) << "Using Communicator=Shm";
+
+    initFromEnv(rank, size, local_rank, local_size, worker_id, my_role);
+    bool is_root = (*my_role == LOCAL_ROOT) ? true : false;
+
+    _name = std::string(BASE_SHM_COMM_NAME);
+    _inbox = openInbox(_local_rank, true);
+
+    if (is_root) {
+        _listen_thread = new std::thread(&BytePSCommShm::startListenThread, this);
+    }
+
+    BPS_LOG(DEBUG) << "This is " << (is_root ? "ROOT" : "WORKER")
+                   << " device, rank=" << _local_rank
+                   << ", shm inbox created successfully";
+}
+
+BytePSCommShm::~BytePSCommShm() {
+    _should_stop = true;
+    if (_inbox) {
+        _inbox->doorbell.fetch_add(1);
+        FutexWake(&_inbox->doorbell);
+    }
+    if (_listen_thread) {
+        if (_listen_thread->joinable()) _listen_thread->join();
+        delete _listen_thread;
+    }
+    for (auto &it : _peer_inbox) {
+        munmap(it.second, inboxSize());
+    }
+    if (_inbox) {
+        munmap(_inbox, inboxSize());
+        shm_unlink(("/" + _name + std::to_string(_local_rank)).c_str());
+    }
+
+    BPS_LOG(DEBUG) << "Clear BytePSCommShm";
+}
+
+BytePSShmInbox* BytePSCommShm::openInbox(int rank, bool create) {
+    std::string shm_name = "/" + _name + std::to_string(rank);
+    size_t size = inboxSize();
+    int fd;
+
+    if (create) {
+        // before create, clear any stale segment left by a previous run
+        shm_unlink(shm_name.c_str());
+        fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+        BPS_CHECK_GE(fd, 0) << "shm_open failed for " << shm_name << ": " << strerror(errno);
+        BPS_CHECK_EQ(ftruncate(fd, size), 0) << strerror(errno);
+        void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        BPS_CHECK_NE(ptr, MAP_FAILED) << "mmap failed for " << shm_name << ": " << strerror(errno);
+        close(fd);
+
+        // ftruncate zero-fills, so rings start empty
+        auto inbox = reinterpret_cast<BytePSShmInbox*>(ptr);
+        inbox->owner_pid = getpid();
+        inbox->owner_start_time = ProcessStartTime(getpid());
+        BPS_CHECK(inbox->owner_start_time) << "cannot read the start time of this process";
+        inbox->ready.store(1, std::memory_order_release);
+        BPS_LOG(DEBUG) << "Init shm inbox at " << shm_name;
+        return inbox;
+    }
+
+    // the receiver may not have created its inbox yet, keep retrying
+    while (true) {
+        fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+        if (fd >= 0) {
+            struct stat st;
+            if (fstat(fd, &st) == 0 && (size_t) st.st_size >= size) {
+                void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                BPS_CHECK_NE(ptr, MAP_FAILED) << "mmap failed for " << shm_name << ": " << strerror(errno);
+                close(fd);
+                auto inbox = reinterpret_cast<BytePSShmInbox*>(ptr);
+                if (inbox->ready.load(std::memory_order_acquire)) {
+                    // an inbox whose owner is gone is stale, the receiver
+                    // replaces it once it starts
+                    if (ProcessStartTime(inbox->owner_pid) == inbox->owner_start_time) {
+                        return inbox;
+                    }
+                    BPS_LOG(DEBUG) << "Skip stale shm inbox " << shm_name
+                                   << " of pid " << inbox->owner_pid << ", rank=" << _local_rank;
+                }
+                munmap(ptr, size);
+            } else {
+                close(fd);
+            }
+        }
+        BPS_LOG(DEBUG) << "Waiting for shm inbox " << shm_name << ", rank=" << _local_rank;
+        std::this_thread::sleep_for(std::chrono::microseconds(1000));
+    }
+}
+
+BytePSShmInbox* BytePSCommShm::getPeerInbox(int rank) {
+    auto it = _peer_inbox.find(rank);
+    if (it != _peer_inbox.end()) return it->second;
+    auto inbox = openInbox(rank, false);
+    _peer_inbox[rank] = inbox;
+    return inbox;
+}
+
+void BytePSCommShm::startListenThread() { // only root starts this in background thread
+    BPS_LOG(DEBUG) << "Listening on shm inbox " << _local_rank;
+    char buffer[MAX_LINE];
+    while (!_should_stop) {
+        int src;
+        int rc = recvSignal(&src, buffer, sizeof(buffer));
+        if (rc <= 0) continue;
+
+        auto message = *(BytePSCommMsg*) buffer;
+        handleSignalAtRoot(message);
+    }
+}
+
+int BytePSCommShm::sendSignal(int destination, void* data, int len) {
+    std::lock_guard<std::mutex> lock(_send_mu);
+    auto inbox = getPeerInbox(destination);
+    // each sender owns the ring indexed by its local rank, and _send_mu
+    // makes this process its only producer
+    auto ring = &inbox->rings[_local_rank];
+
+    uint64_t need = ShmRecordSize(len);
+    BPS_CHECK_LE(need, (uint64_t) SHM_COMM_RING_BYTES) << "signal too large: " << len;
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t off = head % SHM_COMM_RING_BYTES;
+    uint64_t skip = (SHM_COMM_RING_BYTES - off < need) ? (SHM_COMM_RING_BYTES - off) : 0;
+
+    // wait for the receiver to drain enough space
+    while (head + skip + need - ring->tail.load(std::memory_order_acquire) > SHM_COMM_RING_BYTES) {
+        std::this_thread::yield();
+    }
+
+    if (skip) {
+        memcpy(ring->data + off, &kShmRingWrap, sizeof(uint32_t));
+        head += skip;
+        off = 0;
+    }
+    uint32_t l = len;
+    memcpy(ring->data + off, &l, sizeof(uint32_t));
+    memcpy(ring->data + off + sizeof(uint32_t), data, len);
+    ring->head.store(head + need, std::memory_order_release);
+
+    inbox->doorbell.fetch_add(1);
+    if (inbox->sleeping.load()) {
+        FutexWake(&inbox->doorbell);
+    }
+    return len;
+}
+
+int BytePSCommShm::sendSignalToRoot(void* data, int len) {
+    return sendSignal(_root, data, len);
+}
+
+bool BytePSCommShm::tryRecv(int source, void* data, int max_len, int* len) {
+    auto ring = &_inbox->rings[source];
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    while (true) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        if (head == tail) return false;
+
+        uint64_t off = tail % SHM_COMM_RING_BYTES;
+        uint32_t l;
+        memcpy(&l, ring->data + off, sizeof(uint32_t));
+        if (l == kShmRingWrap) {
+            tail += SHM_COMM_RING_BYTES - off;
+            continue;
+        }
+        BPS_CHECK_LE((int) l, max_len) << "recv_len=" << l << ", but given max_len=" << max_len;
+        memcpy(data, ring->data + off + sizeof(uint32_t), l);
+        ring->tail.store(tail + ShmRecordSize(l), std::memory_order_release);
+        *len = l;
+        return true;
+    }
+}
+
+int BytePSCommShm::recvSignal(int* source, void* data, int max_len) {
+    std::lock_guard<std::mutex> lock(_recv_mu);
+    while (true) {
+        // read the doorbell before scanning, so a signal arriving after the
+        // scan changes it and the futex wait below returns immediately
+        uint32_t bell = _inbox->doorbell.load();
+        for (int i = 0; i < _local_size; i++) {
+            int src = (_next_source + i) % _local_size;
+            if (src == _local_rank) continue;
+            int len;
+            if (tryRecv(src, data, max_len, &len)) {
+                _next_source = (src + 1) % _local_size;
+                *source = src;
+
+                auto message = *(BytePSCommMsg*) data;
+                BPS_LOG(TRACE) << "non-root shm recved: src=" << message.src
+                               << ", signal=" << message.signal
+                               << ", key=" << message.key
+                               << ", myrank=" << _local_rank;
+                return len;
+            }
+        }
+        if (_should_stop) return 0;
+
+        _inbox->sleeping.fetch_add(1);
+        FutexWait(&_inbox->doorbell, bell);
+        _inbox->sleeping.fetch_sub(1);
+    }
+}
+
+int BytePSCommShm::recvSignalFromRoot(void* data, int max_len) {
+    int src;
+    int rc = recvSignal(&src, data, max_len);
+    BPS_CHECK_EQ(src, _root) << "Non-root received signal from another non-root";
+    return rc;
+}
+
+int BytePSCommShm::broadcastSignal(void* data, int len) {
+    for (int i : _members) {
+        if (i == _local_rank) continue;
+        sendSignal(i, (void *)data, len);
+    }
+    return 0;
+}
+
 }
 }
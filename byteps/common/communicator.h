@@ -26,13 +26,20 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#ifndef BYTEPS_CPU_ONLY
 #include <nccl.h>
+#endif
+#include <atomic>
+#include <memory>
 #include <thread>
 #include <mutex>
+#include <unordered_map>
 #include "logging.h"
 
 #define BASE_SOCKET_PATH_RECV   "/usr/local/socket_recv_"
 #define BASE_SOCKET_PATH_SEND   "/usr/local/socket_send_"
+#define BASE_SHM_COMM_NAME      "BytePS_ShmComm_"
+#define SHM_COMM_RING_BYTES     65536
 #define MAX_LINE 8000
 
 namespace byteps {
@@ -70,6 +77,13 @@ public:
     virtual int getRoot() { return _root; }
 
 protected:
+    // read rank, size, etc. from env, and make all local ranks members
+    void initFromEnv(int* rank, int* size, int* local_rank, int* local_size,
+                     int* worker_id, BytePSRole* my_role);
+    // copy the ranks from another communicator, optionally with fewer members
+    void initFromComm(std::shared_ptr<BytePSComm> comm, const std::vector<int> &members);
+    // root only: account a coordination signal from a non-root device
+    void handleSignalAtRoot(const BytePSCommMsg &message);
 
     int _rank;
     int _size;
@@ -132,6 +146,79 @@ protected:
 
 };
 
+// Single-producer single-consumer ring in POSIX shared memory.
+// head and tail count bytes ever written/read, messages are [len][payload]
+// padded to 8 bytes, and a len of kShmRingWrap means "continue at offset 0".
+struct BytePSShmRing {
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) char data[SHM_COMM_RING_BYTES];
+};
+
+// The shared memory segment receiving messages for one local rank:
+// a futex doorbell followed by one ring per (local rank) sender.
+// The owner process is identified by its pid and start time, so that peers
+// can tell a live inbox from one left behind by a crashed job.
+struct BytePSShmInbox {
+    alignas(64) std::atomic<uint32_t> doorbell;
+    std::atomic<uint32_t> sleeping;
+    std::atomic<uint32_t> ready;
+    int32_t owner_pid;
+    uint64_t owner_start_time;
+    alignas(64) BytePSShmRing rings[1];
+};
+
+class BytePSCommShm : public BytePSComm {
+
+public:
+
+    BytePSCommShm() {}
+    BytePSCommShm(std::shared_ptr<BytePSComm> comm,
+                  const std::string &name_suffix,
+                  const std::vector<int> &members);
+
+    ~BytePSCommShm();
+
+    void init(int* rank, int* size, int* local_rank, int* local_size,
+              int* worker_id, BytePSRole* my_role);
+    int sendSignal(int destination, void* data, int len);
+    int sendSignalToRoot(void* data, int len);
+    int recvSignal(int* source, void* data, int max_len);
+    int recvSignalFromRoot(void* data, int max_len);
+    int broadcastSignal(void* data, int len);
+
+    std::string getName() { return _name; }
+
+protected:
+
+    void startListenThread();
+    BytePSShmInbox* openInbox(int rank, bool create);
+    BytePSShmInbox* getPeerInbox(int rank);
+    bool tryRecv(int source, void* data, int max_len, int* len);
+    size_t inboxSize() { return sizeof(BytePSShmInbox) + (_local_size - 1) * sizeof(BytePSShmRing); }
+
+    std::thread* _listen_thread = nullptr;
+    std::atomic<bool> _should_stop{false};
+
+    std::string _name;
+    BytePSShmInbox* _inbox = nullptr;
+    std::unordered_map<int, BytePSShmInbox*> _peer_inbox;
+
+    std::mutex _send_mu;
+    std::mutex _recv_mu;
+    int _next_source = 0;
+
+};
+
+// Create the basic communicator, BytePSCommShm if BYTEPS_USE_SHM_COMM is set
+// and BytePSCommSocket otherwise
+std::shared_ptr<BytePSComm> CreateComm();
+
+// Create a communicator of the same type as comm among (a subset of) its members
+std::shared_ptr<BytePSComm> CreateComm(std::shared_ptr<BytePSComm> comm,
+                                       const std::string &suffix,
+                                       const std::vector<int> &members);
+
 } // namespace common
 } // namespace byteps
 
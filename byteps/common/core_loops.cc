@@ -15,20 +15,41 @@
 
 #include <memory>
 #include <chrono>
+#include <cstring>
+#ifndef BYTEPS_CPU_ONLY
 #include <cuda_runtime.h>
+#endif
 
 #include "logging.h"
 #include "core_loops.h"
 #include "common.h"
 #include "global.h"
+#include "fusion.h"
 
 namespace byteps {
 namespace common {
 
+// Calls back the tensor of the entry, or the tensors fused into it, and drops
+// their data of this iteration. The entries themselves are reused.
+void FinishEntry(TensorTableEntry* entry, const Status &status) {
+    for (auto &member : entry->fused) {
+        FinishEntry(member.get(), status);
+    }
+    entry->fused.clear();
+    if (entry->callback) {
+        entry->callback(status);
+    }
+    entry->callback = nullptr;
+    entry->tensor.reset();
+    entry->output.reset();
+    entry->ready_event.reset();
+    entry->queue_list.reset();
+}
+
 void FinishOrProceed(std::shared_ptr<TensorTableEntry> task) {
-    auto &queue_list = task->queue_list;
-    BPS_CHECK_GE(queue_list.size(), 1);
-    auto this_op = queue_list[0];
+    auto &queue_list = *task->queue_list;
+    BPS_CHECK_LT(task->stage, queue_list.size());
+    auto this_op = queue_list[task->stage];
     auto q = BytePSGlobal::GetScheduledQueue(this_op);
     q->reportFinish(task->len);
     if (BytePSGlobal::IsTensorSampled(task->key)) {
@@ -45,6 +66,7 @@ void FinishOrProceed(std::shared_ptr<TensorTableEntry> task) {
                         << "\toutput[-1]=" << *((float*)(task->output->data()) + j)
                         << "\t after stage: " << LogStrings[this_op];
         }
+#ifndef BYTEPS_CPU_ONLY
         else {
             float i0, i1, o0, o1;
             cudaMemcpy(&i0, (float*)(task->tensor->data()) + i, 4, cudaMemcpyDeviceToHost);
@@ -59,25 +81,31 @@ void FinishOrProceed(std::shared_ptr<TensorTableEntry> task) {
                         << "\toutput[-1]=" << o1
                         << "\t after stage: " << LogStrings[this_op];
         }
+#endif
     }
-    queue_list.erase(queue_list.begin());
-    if (queue_list.size() > 0) {
+    ++task->stage;
+    if (task->stage < queue_list.size()) {
         BPS_CHECK(task->tensor_name != "");
         BPS_LOG(TRACE) << "Rank=" << BytePSGlobal::GetRank()
                        << " finishes " << LogStrings[this_op]
                        << ", tensor: " << task->tensor_name
                        << ", key=" << task->key
                        << "; Passing to the next queue.";
-        BytePSGlobal::GetScheduledQueue(queue_list[0])->addTask(task);
+        BytePSGlobal::GetScheduledQueue(queue_list[task->stage])->addTask(task);
     } else {
-        BPS_CHECK(task->counter_ptr) << task->tensor_name << " counter_ptr is null";
-        int v = task->counter_ptr.get()->fetch_add(1);
-        if (v == (int)(task->total_partnum-1)) {
-            BPS_CHECK(task->tensor_name != "");
+        auto entry = task->parent;
+        BPS_CHECK(entry) << task->tensor_name << " is not a partition";
+        task->tensor.reset();
+        task->output.reset();
+        task->ready_event.reset();
+        task->queue_list.reset();
+        int v = entry->counter.fetch_add(1);
+        if (v == (int)(entry->total_partnum-1)) {
+            BPS_CHECK(entry->tensor_name != "");
             BPS_LOG(TRACE) << "Rank=" << BytePSGlobal::GetRank()
                            << " finish processing tensor: "
-                           << task->tensor_name;
-            task->callback(Status::OK());
+                           << entry->tensor_name;
+            FinishEntry(entry, Status::OK());
         }
     }
     return;
@@ -100,12 +128,12 @@ bool RunCoordinateLoopOnce(QueueType this_op) {
         switch (this_op) {
             case COORDINATE_REDUCE: {
                 sig = REDUCE_READY;
-                comm = BytePSGlobal::GetNccl()->GetSignalComm();
+                comm = BytePSGlobal::GetSignalComm();
                 break;
             }
             case COORDINATE_BROADCAST: {
                 sig = BCAST_READY;
-                comm = BytePSGlobal::GetNccl()->GetSignalComm();
+                comm = BytePSGlobal::GetSignalComm();
                 break;
             }
             case COORDINATE_PUSH: {
@@ -130,11 +158,12 @@ bool RunCoordinateLoopOnce(QueueType this_op) {
                        << ", key="  << key;
 
     } else {
-        std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+        q->wait();
     }
     return true;
 }
 
+#ifndef BYTEPS_CPU_ONLY
 inline void PostNcclCalls(std::shared_ptr<byteps::common::TensorTableEntry> task, QueueType this_op) {
 
     BPS_CHECK(this_op == REDUCE || this_op == BROADCAST) << "Only REDUCE and BROADCAST use NCCL.";
@@ -173,6 +202,12 @@ inline void PostNcclCalls(std::shared_ptr<byteps::common::TensorTableEntry> task
                     << ", device=" << task->device;
 
     if (this_op == REDUCE) {
+        // Scaling the inputs is free with PreMulSum
+        auto nccl_op = getNcclRedOp(task->op);
+        if (task->scale != 1.0 && BytePSGlobal::GetScaleStage(tensor->dtype()) == REDUCE) {
+            nccl_op = nccl->GetPreMulSumOp(nccl_comm, tensor->dtype(), task->scale);
+        }
+
         // We reduce to task->output except that it is a CPU tensor
         auto out_p = (char*)(task->output->data()) + offset;
         if (task->device == CPU_DEVICE_ID && task->tensor == task->output) {
@@ -184,7 +219,7 @@ inline void PostNcclCalls(std::shared_ptr<byteps::common::TensorTableEntry> task
                                     (void*) (out_p + nccl_rank * num_elem_per_gpu * unit_len),
                                     (size_t) num_elem_per_gpu,
                                     (ncclDataType_t) nccl_dtype,
-                                    (ncclRedOp_t) ncclSum,
+                                    (ncclRedOp_t) nccl_op,
                                     (ncclComm_t) nccl_comm,
                                     (cudaStream_t) nccl_stream));
         }
@@ -193,7 +228,7 @@ inline void PostNcclCalls(std::shared_ptr<byteps::common::TensorTableEntry> task
                                     (void*) (out_p + len - left_elem * unit_len),
                                     (size_t) left_elem,
                                     (ncclDataType_t) nccl_dtype,
-                                    (ncclRedOp_t) ncclSum,
+                                    (ncclRedOp_t) nccl_op,
                                     (int) nccl_root,
                                     (ncclComm_t) nccl_comm,
                                     (cudaStream_t) nccl_stream));
@@ -221,6 +256,39 @@ inline void PostNcclCalls(std::shared_ptr<byteps::common::TensorTableEntry> task
     }
 }
 
+// A fused task packs the inputs of its members into the fusion buffer ahead
+// of its REDUCE, and copies the result back to them after its BROADCAST.
+// Both go to the NCCL stream of the task, which orders them with the NCCL
+// calls. As NCCL only launches a group at ncclGroupEnd(), post the copies
+// of REDUCE before and those of BROADCAST after it.
+void PostFusionCopies(std::shared_ptr<byteps::common::TensorTableEntry> task, QueueType this_op) {
+    if (task->parent->fused.empty()) {
+        return;
+    }
+    auto stream = BytePSGlobal::GetNccl()->GetStream(task->key, this_op);
+    auto buffer = (char*)(task->output->data());
+    BytePSFusion::ForEachMember(task, [this_op, stream, buffer](
+            TensorTableEntry* member, size_t member_offset, size_t offset, size_t len) {
+        if (this_op == REDUCE) {
+            CUDA_CALL(cudaMemcpyAsync((void*) (buffer + offset),
+                                      (const void*) ((const char*)(member->tensor->data()) + member_offset),
+                                      len, cudaMemcpyDeviceToDevice, (cudaStream_t) stream));
+        }
+        else {
+            CUDA_CALL(cudaMemcpyAsync((void*) ((char*)(member->output->data()) + member_offset),
+                                      (const void*) (buffer + offset),
+                                      len, cudaMemcpyDeviceToDevice, (cudaStream_t) stream));
+        }
+    });
+}
+
+void PostFusionBroadcastCopies(std::shared_ptr<NcclGroupEntry> nccl_entry) {
+    for (size_t i = 0; i < nccl_entry->tasks.size(); i++) {
+        if (nccl_entry->queues[i]->getQueueType() == BROADCAST) {
+            PostFusionCopies(nccl_entry->tasks[i], BROADCAST);
+        }
+    }
+}
 
 bool RunRootNcclLoopOnce() {
     auto signal_comm = BytePSGlobal::GetNccl()->GetSignalComm();
@@ -235,6 +303,11 @@ bool RunRootNcclLoopOnce() {
     auto &tasks = nccl_entry->tasks;
     auto &queues = nccl_entry->queues;
 
+    // All signals of a group go to each non-root device in one message,
+    // flushed early only if the group does not fit into MAX_LINE
+    const size_t max_batch = MAX_LINE / sizeof(BytePSCommMsg);
+    std::vector<BytePSCommMsg> batch;
+
     NCCLCHECK(ncclGroupStart());
     for (auto this_op : nccl_ops) {
         auto q = BytePSGlobal::GetScheduledQueue(this_op);
@@ -244,28 +317,38 @@ bool RunRootNcclLoopOnce() {
             tasks.push_back(task);
             queues.push_back(q);
 
+            if (this_op == REDUCE) {
+                PostFusionCopies(task, REDUCE);
+            }
             if (nccl_size > 1) {
                 // notify non-root devices
                 struct BytePSCommMsg msg = { rank,
                                              (this_op == REDUCE) ? DO_REDUCE : DO_BROADCAST,
                                              task->key };
-                signal_comm->broadcastSignal(&msg,
-                                                sizeof(BytePSCommMsg));
+                batch.push_back(msg);
+                if (batch.size() == max_batch) {
+                    signal_comm->broadcastSignal(batch.data(),
+                                                 batch.size() * sizeof(BytePSCommMsg));
+                    batch.clear();
+                }
                 PostNcclCalls(task, this_op);
             }
         }
     }
     if (tasks.size()) {
         struct BytePSCommMsg msg = { rank, DO_GROUP, 0 };
-        signal_comm->broadcastSignal(&msg, sizeof(BytePSCommMsg));
+        batch.push_back(msg);
+        signal_comm->broadcastSignal(batch.data(), batch.size() * sizeof(BytePSCommMsg));
         NCCLCHECK(ncclGroupEnd());
+        PostFusionBroadcastCopies(nccl_entry);
         nccl_entry->RecordEvents();
         BPS_LOG(TRACE) << "NCCL Group size=" << tasks.size() << " rank=" << rank;
         BytePSGlobal::GetNccl()->EnqueueGroup(nccl_entry);
     }
     else {
         NCCLCHECK(ncclGroupEnd());
-        std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+        // REDUCE and BROADCAST share one notifier, see BytePSGlobal::Init()
+        BytePSGlobal::GetScheduledQueue(REDUCE)->wait();
     }
 
     return true;
@@ -280,33 +363,46 @@ bool RunNonRootNcclLoopOnce() {
     auto nccl_entry = std::make_shared<NcclGroupEntry>(); 
     auto &tasks = nccl_entry->tasks;
     auto &queues = nccl_entry->queues;
-    struct BytePSCommMsg msg = {};
+    char buffer[MAX_LINE];
+    bool group_end = false;
 
     NCCLCHECK(ncclGroupStart());
-    while (1) {
-        signal_comm->recvSignalFromRoot(&msg, sizeof(BytePSCommMsg));
-        if (msg.signal == DO_GROUP) { break; }
-        QueueType this_op = REDUCE;
-        if (msg.signal == DO_BROADCAST) {
-            this_op = BROADCAST;
-        }
-        else {
-            BPS_CHECK_EQ(msg.signal, DO_REDUCE) << msg.signal << ", " << DO_REDUCE;
-        }
-
-        auto key = msg.key;
+    while (!group_end) {
+        // one message carries a batch of signals, see RunRootNcclLoopOnce()
+        int rc = signal_comm->recvSignalFromRoot(buffer, sizeof(buffer));
+        BPS_CHECK_EQ(rc % sizeof(BytePSCommMsg), 0) << "bad signal batch length " << rc;
+        auto msgs = (BytePSCommMsg*) buffer;
+        for (size_t i = 0; i < rc / sizeof(BytePSCommMsg); i++) {
+            auto &msg = msgs[i];
+            if (msg.signal == DO_GROUP) {
+                group_end = true;
+                break;
+            }
+            QueueType this_op = REDUCE;
+            if (msg.signal == DO_BROADCAST) {
+                this_op = BROADCAST;
+            }
+            else {
+                BPS_CHECK_EQ(msg.signal, DO_REDUCE) << msg.signal << ", " << DO_REDUCE;
+            }
 
-        auto q = BytePSGlobal::GetScheduledQueue(this_op);
-        auto task = q->getTask(key);
-        BPS_CHECK(task);
+            auto key = msg.key;
 
-        tasks.push_back(task);
-        queues.push_back(q);
+            auto q = BytePSGlobal::GetScheduledQueue(this_op);
+            auto task = q->getTask(key);
+            BPS_CHECK(task);
 
-        PostNcclCalls(task, this_op);
+            tasks.push_back(task);
+            queues.push_back(q);
 
+            if (this_op == REDUCE) {
+                PostFusionCopies(task, REDUCE);
+            }
+            PostNcclCalls(task, this_op);
+        }
     }
     NCCLCHECK(ncclGroupEnd());
+    PostFusionBroadcastCopies(nccl_entry);
 
     nccl_entry->RecordEvents();
     BytePSGlobal::GetNccl()->EnqueueGroup(nccl_entry);
@@ -325,73 +421,179 @@ bool RunSyncNcclOnce() {
                        << " rank=" << BytePSGlobal::GetLocalRank();
     }
     else {
-        std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+        BytePSGlobal::GetNccl()->WaitGroup();
     }
     return true;
 }
 
-bool RunCopyDevice2HostLoopOnce() {
-    QueueType this_op = COPYD2H;
-    auto q = BytePSGlobal::GetScheduledQueue(this_op);
-    auto task = q->getTask();
+void CopyDevice2Host(std::shared_ptr<byteps::common::TensorTableEntry> task) {
+    auto copy_d2h_Stream =  BytePSGlobal::GetCopyDevice2HostStream();
+    // If we ran NCCL reduce, we should copy from task->output
+    auto tensor = (BytePSGlobal::GetNccl()->GetSize() > 1) ?
+                  task->output : task->tensor;
+    BPS_CHECK(tensor);
+    auto key  = task->key;
 
-    if (task) {
-        auto copy_d2h_Stream =  BytePSGlobal::GetCopyDevice2HostStream();
-        // If we ran NCCL reduce, we should copy from task->output
-        auto tensor = (BytePSGlobal::GetNccl()->GetSize() > 1) ?
-                      task->output : task->tensor;
-        BPS_CHECK(tensor);
-        auto key  = task->key;
+    auto nccl = BytePSGlobal::GetNccl();
+    auto nccl_root = nccl->GetRoot(key, REDUCE);
+    auto nccl_size = nccl->GetSize();
+    auto nccl_rank = nccl->GetRank(key, REDUCE);
 
-        auto nccl = BytePSGlobal::GetNccl();
-        auto nccl_root = nccl->GetRoot(key, REDUCE);
-        auto nccl_size = nccl->GetSize();
-        auto nccl_rank = nccl->GetRank(key, REDUCE);
+    auto len = task->len;
+    auto offset = task->offset;
+    auto p = (char*)(tensor->data()) + offset;
+    if (task->device == CPU_DEVICE_ID) {
+        p = (char*)(task->gpu_ptr) + offset;
+    }
+    auto unit_len = tensor->size() / tensor->shape().num_elements();
+    char* cpubuff;
+    if (BytePSGlobal::IsCrossPcieSwitch()) {
+        BPS_CHECK(task->pcie_cpubuff.size());
+        cpubuff = (char*)(task->pcie_cpubuff[BytePSGlobal::GetPcieSwitchIndex()]) + offset;
+    }
+    else {
+        cpubuff = (char*)(task->cpubuff) + offset;
+    }
 
-        auto len = task->len;
-        auto offset = task->offset;
-        auto p = (char*)(tensor->data()) + offset;
-        if (task->device == CPU_DEVICE_ID) {
-            p = (char*)(task->gpu_ptr) + offset;
-        }
-        auto unit_len = tensor->size() / tensor->shape().num_elements();
-        char* cpubuff;
-        if (BytePSGlobal::IsCrossPcieSwitch()) {
-            BPS_CHECK(task->pcie_cpubuff.size());
-            cpubuff = (char*)(task->pcie_cpubuff[BytePSGlobal::GetPcieSwitchIndex()]) + offset;
-        }
-        else {
-            cpubuff = (char*)(task->cpubuff) + offset;
-        }
+    BPS_CHECK(cpubuff) << task->tensor_name
+                        << ": CPU buffer not initialized, size=" << len;
 
-        BPS_CHECK(cpubuff) << task->tensor_name
-                            << ": CPU buffer not initialized, size=" << len;
+    auto num_elem_per_gpu = len / nccl_size / unit_len;
+    auto left_elem = (len / unit_len) - (num_elem_per_gpu * nccl_size);
 
-        auto num_elem_per_gpu = len / nccl_size / unit_len;
-        auto left_elem = (len / unit_len) - (num_elem_per_gpu * nccl_size);
+    auto copy_len = num_elem_per_gpu * unit_len;
+    if (left_elem && (nccl_root == nccl_rank)) {
+        copy_len += left_elem * unit_len;
+    }
 
-        auto copy_len = num_elem_per_gpu * unit_len;
-        if (left_elem && (nccl_root == nccl_rank)) {
-            copy_len += left_elem * unit_len;
+    if (copy_len) {
+        CUDA_CALL(cudaMemcpyAsync((void *) (cpubuff + nccl_rank * num_elem_per_gpu * unit_len),
+                                  (const void *) (p + nccl_rank * num_elem_per_gpu * unit_len),
+                                  (size_t) copy_len,
+                                  (cudaMemcpyKind) cudaMemcpyDeviceToHost,
+                                  (cudaStream_t) *copy_d2h_Stream));
+        CUDA_CALL(cudaStreamSynchronize(*copy_d2h_Stream));
+    }
+
+    return;
+}
+#else
+// Reduce-scatter over shared memory: every local rank reduces its slice of
+// the partition across the input copies of all ranks into task->cpubuff.
+// The slices follow PostNcclCalls(), so the root takes the leftover elements.
+void ReduceShmSlice(std::shared_ptr<byteps::common::TensorTableEntry> task) {
+    auto tensor = task->tensor;
+    BPS_CHECK(tensor);
+    auto root = BytePSGlobal::GetSignalComm()->getRoot();
+    auto size = BytePSGlobal::GetLocalSize();
+    auto rank = BytePSGlobal::GetLocalRank();
+    BPS_CHECK_EQ(task->rank_cpubuff.size(), (size_t) size);
+    BPS_CHECK_LE(size, BYTEPS_CPU_REDUCER_MAX_SOURCES);
+    BPS_CHECK_EQ(root, size - 1) << "the leftover elements must follow the slice of the root";
+
+    auto len = task->len;
+    auto unit_len = tensor->size() / tensor->shape().num_elements();
+    auto num_elem_per_rank = len / size / unit_len;
+    auto left_elem = (len / unit_len) - (num_elem_per_rank * size);
+
+    auto copy_len = num_elem_per_rank * unit_len;
+    if (left_elem && (root == rank)) {
+        copy_len += left_elem * unit_len;
+    }
+
+    if (copy_len) {
+        auto total_offset = task->offset + rank * num_elem_per_rank * unit_len;
+        void* srcs[BYTEPS_CPU_REDUCER_MAX_SOURCES];
+        for (int i = 0; i < size; ++i) {
+            srcs[i] = (char*) task->rank_cpubuff[i] + total_offset;
         }
+        // integers in distributed jobs scale at COPYH2D instead,
+        // see BytePSGlobal::GetScaleStage()
+        auto scale = (BytePSGlobal::GetScaleStage(tensor->dtype()) == REDUCE) ?
+                     task->scale : 1.0;
+        BytePSGlobal::GetCpuReducer()->reduce_n((void*)((char*)(task->cpubuff) + total_offset),
+                                                srcs, size, copy_len,
+                                                tensor->dtype(), task->op, scale);
+    }
+    return;
+}
 
-        if (copy_len) {
-            CUDA_CALL(cudaMemcpyAsync((void *) (cpubuff + nccl_rank * num_elem_per_gpu * unit_len),
-                                      (const void *) (p + nccl_rank * num_elem_per_gpu * unit_len),
-                                      (size_t) copy_len,
-                                      (cudaMemcpyKind) cudaMemcpyDeviceToHost,
-                                      (cudaStream_t) *copy_d2h_Stream));
-            CUDA_CALL(cudaStreamSynchronize(*copy_d2h_Stream));
+bool RunRootShmReduceLoopOnce() {
+    auto signal_comm = BytePSGlobal::GetSignalComm();
+    int rank = BytePSGlobal::GetLocalRank();
+    BPS_CHECK_EQ(rank, signal_comm->getRoot());
+
+    auto q = BytePSGlobal::GetScheduledQueue(REDUCE);
+    auto task = q->getTask();
+    if (task) {
+        if (BytePSGlobal::GetLocalSize() > 1) {
+            // every rank has staged its input, see the REDUCE ReadyTable
+            struct BytePSCommMsg msg = { rank, DO_REDUCE, task->key };
+            signal_comm->broadcastSignal(&msg, sizeof(BytePSCommMsg));
         }
+        ReduceShmSlice(task);
+        FinishOrProceed(task);
+    }
+    else {
+        q->wait();
+    }
+    return true;
+}
+
+bool RunNonRootShmReduceLoopOnce() {
+    auto signal_comm = BytePSGlobal::GetSignalComm();
+    int rank = BytePSGlobal::GetLocalRank();
+    BPS_CHECK_NE(rank, signal_comm->getRoot());
+
+    struct BytePSCommMsg msg = {};
+    signal_comm->recvSignalFromRoot(&msg, sizeof(BytePSCommMsg));
+    BPS_CHECK_EQ(msg.signal, DO_REDUCE) << msg.signal;
 
+    auto task = BytePSGlobal::GetScheduledQueue(REDUCE)->getTask(msg.key);
+    BPS_CHECK(task);
+    ReduceShmSlice(task);
+    FinishOrProceed(task);
+    return true;
+}
+
+// Stage the whole input of this rank where the others can read it
+void CopyDevice2Host(std::shared_ptr<byteps::common::TensorTableEntry> task) {
+    auto tensor = task->tensor;
+    BPS_CHECK(tensor);
+    auto rank = BytePSGlobal::GetLocalRank();
+    BPS_CHECK_GT(task->rank_cpubuff.size(), (size_t) rank) << task->tensor_name
+            << ": CPU buffer not initialized, size=" << task->len;
+    if (task->parent->fused.size()) {
+        // pack the members, the fused tensor only exists in shared memory
+        auto dst = (char*)(task->rank_cpubuff[rank]);
+        BytePSFusion::ForEachMember(task, [dst](TensorTableEntry* member,
+                                                size_t member_offset, size_t offset, size_t len) {
+            memcpy(dst + offset, (const char*)(member->tensor->data()) + member_offset, len);
+        });
+        return;
+    }
+    memcpy((char*)(task->rank_cpubuff[rank]) + task->offset,
+           (const char*)(tensor->data()) + task->offset, task->len);
+    return;
+}
+#endif
+
+bool RunCopyDevice2HostLoopOnce() {
+    QueueType this_op = COPYD2H;
+    auto q = BytePSGlobal::GetScheduledQueue(this_op);
+    auto task = q->getTask();
+
+    if (task) {
+        CopyDevice2Host(task);
         FinishOrProceed(task);
     }
     else {
-        std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+        q->wait();
     }
     return true;
 }
 
+#ifndef BYTEPS_CPU_ONLY
 bool RunPcieReduceLoopOnce() {
     BPS_CHECK(BytePSGlobal::IsCrossPcieSwitch());
     QueueType this_op = PCIE_REDUCE;
@@ -431,21 +633,31 @@ bool RunPcieReduceLoopOnce() {
             if (copy_len) {
                 auto total_offset = offset + nccl_rank * num_elem_per_gpu * unit_len;
 
-                // Below we assume there are only two PCIe switch
-                // and we run reducer in the context of the second switch
-                reducer->sum((void*)((char*)(task->cpubuff) + total_offset),
-                             (void*)((char*)(task->pcie_cpubuff[0]) + total_offset),
-                             copy_len, tensor->dtype());
+                // We run reducer in the context of the last switch, whose
+                // buffer is task->cpubuff, and add up all switches in one pass
+                int num_switch = task->pcie_cpubuff.size();
+                BPS_CHECK_LE(num_switch, BYTEPS_CPU_REDUCER_MAX_SOURCES);
+                void* srcs[BYTEPS_CPU_REDUCER_MAX_SOURCES];
+                for (int i = 0; i < num_switch; ++i) {
+                    srcs[i] = (char*) task->pcie_cpubuff[i] + total_offset;
+                }
+                // scaling is fused into the final stores
+                auto scale = (BytePSGlobal::GetScaleStage(tensor->dtype()) == PCIE_REDUCE) ?
+                             task->scale : 1.0;
+                reducer->reduce_n((void*)((char*)(task->cpubuff) + total_offset),
+                                  srcs, num_switch, copy_len, tensor->dtype(),
+                                  task->op, scale);
             }
         }
 
         FinishOrProceed(task);
     }
     else {
-        std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+        q->wait();
     }
     return true;
 }
+#endif
 
 bool RunPushLoopOnce() {
     QueueType this_op = PUSH;
@@ -465,26 +677,24 @@ bool RunPushLoopOnce() {
             // get metadata
             const int dtype = task->tensor->dtype();
 
-            // false means not to delete data when SArray is deleted
-            ps::SArray<char> vals(data, len, false);
-
-            int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
-            auto& pskv = BytePSGlobal::EncodeDefaultKey(task->key, len);
-            BytePSGlobal::GetPS()->ZPush(
-                pskv.keys, vals, pskv.lens, cmd,
+            BytePSGlobal::GetBackend()->Push(
+                task->key, data, len, dtype,
                 [task, q]() {
                     FinishOrProceed(task);
                 }
             );
         }
         else {
-            // This is a dummy barrier for IsCrossPcieSwitch()
+            // This is a dummy barrier for IsCrossPcieSwitch(), or for
+            // reading the shm reduce result in CPU-only builds
+#ifndef BYTEPS_CPU_ONLY
             BPS_CHECK(BytePSGlobal::IsCrossPcieSwitch());
+#endif
             FinishOrProceed(task);
         }
     }
     else {
-        std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+        q->wait();
     }
     return true;
 }
@@ -507,25 +717,40 @@ bool RunPullLoopOnce() {
         // get metadata
         const int dtype = task->output->dtype();
 
-        // false means not to delete data when SArray is deleted
-        auto vals = new ps::SArray<char>(data, len, false);
-
-        int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
-        auto& pskv = BytePSGlobal::EncodeDefaultKey(task->key, len);
         // issue pull
-        BytePSGlobal::GetPS()->ZPull(
-            pskv.keys, vals, &pskv.lens, cmd,
-            [vals, task, q]() {
-                delete vals;
+        BytePSGlobal::GetBackend()->Pull(
+            task->key, data, len, dtype,
+            [task, q]() {
                 FinishOrProceed(task);
             });
     }
     else {
-        std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+        q->wait();
     }
     return true;
 }
 
+#ifdef BYTEPS_CPU_ONLY
+// Every rank copies the whole result, the all-gather of the shm reduce
+void CopyHost2Device(std::shared_ptr<byteps::common::TensorTableEntry> task) {
+    auto tensor = task->output;
+    BPS_CHECK(tensor);
+    BPS_CHECK(task->cpubuff) << task->tensor_name
+            << ": CPU buffer not initialized, size=" << task->len;
+    if (task->parent->fused.size()) {
+        // unpack to the members
+        auto src = (const char*)(task->cpubuff);
+        BytePSFusion::ForEachMember(task, [src](TensorTableEntry* member,
+                                                size_t member_offset, size_t offset, size_t len) {
+            memcpy((char*)(member->output->data()) + member_offset, src + offset, len);
+        });
+        return;
+    }
+    memcpy((char*)(tensor->data()) + task->offset,
+           (const char*)(task->cpubuff) + task->offset, task->len);
+    return;
+}
+#else
 void CopyHost2Device(std::shared_ptr<byteps::common::TensorTableEntry> task) {
     auto copy_h2d_stream = BytePSGlobal::GetCopyHost2DeviceStream();    
     auto tensor = task->output;
@@ -565,6 +790,7 @@ void CopyHost2Device(std::shared_ptr<byteps::common::TensorTableEntry> task) {
 
     return;
 }
+#endif
 
 bool RunRootCopyHost2DeviceLoopOnce() {
     QueueType this_op = COPYH2D;
@@ -576,6 +802,14 @@ bool RunRootCopyHost2DeviceLoopOnce() {
         int local_rank = BytePSGlobal::GetLocalRank();
         int local_size = BytePSGlobal::GetLocalSize();
 
+        auto dtype = task->output->dtype();
+        if (task->scale != 1.0 && BytePSGlobal::GetScaleStage(dtype) == COPYH2D) {
+            // The pulled sum is complete in the shared cpubuff, scale it
+            // once before any device copies it back
+            auto data = (char*)(task->cpubuff) + task->offset;
+            BytePSGlobal::GetCpuReducer()->scale(data, data, task->len, dtype, task->scale);
+        }
+
         if (local_size > 1) {
             // notify non-root devices
             struct BytePSCommMsg msg = { local_rank,
@@ -589,7 +823,7 @@ bool RunRootCopyHost2DeviceLoopOnce() {
         FinishOrProceed(task);
     }
     else {
-        std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+        q->wait();
     }
     return true;
 }
@@ -623,45 +857,67 @@ bool RunNonRootCopyHost2DeviceLoopOnce() {
         CopyHost2Device(task);
         FinishOrProceed(task);
     } else {
-        std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+        q->wait();
     }
     return true;
 }
 
+bool RunCoordinateReduceLoopOnce() {
+    return RunCoordinateLoopOnce(COORDINATE_REDUCE);
+}
+
+bool RunCoordinateBroadcastLoopOnce() {
+    return RunCoordinateLoopOnce(COORDINATE_BROADCAST);
+}
+
+bool RunCoordinatePushLoopOnce() {
+    return RunCoordinateLoopOnce(COORDINATE_PUSH);
+}
+
 void CoordinateReduceLoop() {
-    while (RunCoordinateLoopOnce(COORDINATE_REDUCE) && !BytePSGlobal::ShouldShutdown()) {}
+    while (RunCoordinateReduceLoopOnce() && !BytePSGlobal::ShouldShutdown()) {}
 }
 
 void CoordinateBroadcastLoop() {
-    while (RunCoordinateLoopOnce(COORDINATE_BROADCAST) && !BytePSGlobal::ShouldShutdown()) {}
+    while (RunCoordinateBroadcastLoopOnce() && !BytePSGlobal::ShouldShutdown()) {}
 }
 
 void CoordinatePushLoop() {
-    while (RunCoordinateLoopOnce(COORDINATE_PUSH) && !BytePSGlobal::ShouldShutdown()) {}
+    while (RunCoordinatePushLoopOnce() && !BytePSGlobal::ShouldShutdown()) {}
 }
 
+#ifndef BYTEPS_CPU_ONLY
 void PcieReduceLoop() {
-    CUDA_CALL(cudaSetDevice(BytePSGlobal::GetLocalRank()));
+    BytePSGlobal::SetDevice();
     while (RunPcieReduceLoopOnce() && !BytePSGlobal::ShouldShutdown()) {}
 }
 
 void RootNcclLoop() {
-    CUDA_CALL(cudaSetDevice(BytePSGlobal::GetLocalRank()));
+    BytePSGlobal::SetDevice();
     while (RunRootNcclLoopOnce() && !BytePSGlobal::ShouldShutdown()) {}
 }
 
 void NonRootNcclLoop() {
-    CUDA_CALL(cudaSetDevice(BytePSGlobal::GetLocalRank()));
+    BytePSGlobal::SetDevice();
     while (RunNonRootNcclLoopOnce() && !BytePSGlobal::ShouldShutdown()) {}
 }
 
 void SyncNcclLoop() {
-    CUDA_CALL(cudaSetDevice(BytePSGlobal::GetLocalRank()));
+    BytePSGlobal::SetDevice();
     while (RunSyncNcclOnce() && !BytePSGlobal::ShouldShutdown()) {}
 }
+#else
+void RootShmReduceLoop() {
+    while (RunRootShmReduceLoopOnce() && !BytePSGlobal::ShouldShutdown()) {}
+}
+
+void NonRootShmReduceLoop() {
+    while (RunNonRootShmReduceLoopOnce() && !BytePSGlobal::ShouldShutdown()) {}
+}
+#endif
 
 void CopyDevice2HostLoop() {
-    CUDA_CALL(cudaSetDevice(BytePSGlobal::GetLocalRank()));
+    BytePSGlobal::SetDevice();
     while (RunCopyDevice2HostLoopOnce() && !BytePSGlobal::ShouldShutdown()) {}
 }
 
@@ -674,17 +930,17 @@ void PullLoop() {
 }
 
 void RootCopyHost2DeviceLoop() {
-    CUDA_CALL(cudaSetDevice(BytePSGlobal::GetLocalRank()));
+    BytePSGlobal::SetDevice();
     while (RunRootCopyHost2DeviceLoopOnce() && !BytePSGlobal::ShouldShutdown()) {}
 }
 
 void NonRootCopyListenLoop() {
-    CUDA_CALL(cudaSetDevice(BytePSGlobal::GetLocalRank()));
+    BytePSGlobal::SetDevice();
     while (RunNonRootCopyListenLoopOnce() && !BytePSGlobal::ShouldShutdown()) {}
 }
 
 void NonRootCopyHost2DeviceLoop() {
-    CUDA_CALL(cudaSetDevice(BytePSGlobal::GetLocalRank()));
+    BytePSGlobal::SetDevice();
     while (RunNonRootCopyHost2DeviceLoopOnce() && !BytePSGlobal::ShouldShutdown()) {}
 }
 
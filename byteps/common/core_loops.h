@@ -25,6 +25,7 @@ void CoordinateBroadcastLoop();
 
 void CoordinatePushLoop();
 
+#ifndef BYTEPS_CPU_ONLY
 void PcieReduceLoop();
 
 void RootNcclLoop();
@@ -32,6 +33,11 @@ void RootNcclLoop();
 void NonRootNcclLoop();
 
 void SyncNcclLoop();
+#else
+void RootShmReduceLoop();
+
+void NonRootShmReduceLoop();
+#endif
 
 void CopyDevice2HostLoop();
 
@@ -45,6 +51,31 @@ void NonRootCopyListenLoop();
 
 void NonRootCopyHost2DeviceLoop();
 
+// Single iterations of the non-blocking loops above, for BytePSExecutor
+bool RunCoordinateReduceLoopOnce();
+
+bool RunCoordinateBroadcastLoopOnce();
+
+bool RunCoordinatePushLoopOnce();
+
+#ifndef BYTEPS_CPU_ONLY
+bool RunPcieReduceLoopOnce();
+
+bool RunRootNcclLoopOnce();
+#else
+bool RunRootShmReduceLoopOnce();
+#endif
+
+bool RunCopyDevice2HostLoopOnce();
+
+bool RunPushLoopOnce();
+
+bool RunPullLoopOnce();
+
+bool RunRootCopyHost2DeviceLoopOnce();
+
+bool RunNonRootCopyHost2DeviceLoopOnce();
+
 } // namespace common
 } // namespace byteps
 
@@ -14,240 +14,108 @@
 // =============================================================================
 
 #include "cpu_reducer.h"
+#ifndef BYTEPS_BUILDING_SERVER
 #include "global.h"
+#endif
 
 namespace byteps {
 namespace common {
 
 CpuReducer::CpuReducer(std::shared_ptr<BytePSComm> comm) {
-    std::vector<int> peers;
-    auto pcie_size = BytePSGlobal::GetPcieSwitchSize();
-    for (int i = BytePSGlobal::GetLocalRank() % pcie_size;
-         i < BytePSGlobal::GetLocalSize();
-         i += pcie_size) {
-        peers.push_back(i);
-    }
-    _comm = std::make_shared<BytePSCommSocket>(comm, std::string("cpu"), peers);
-    _num_threads = BYTEPS_CPU_REDUCER_THREADS;
+    // without a communicator (e.g. in tests/bench_core.cc or the server) the reducer
+    // works on its own and does not touch BytePSGlobal
+#ifndef BYTEPS_BUILDING_SERVER
+    if (comm) {
+        std::vector<int> peers;
+        auto pcie_size = BytePSGlobal::GetPcieSwitchSize();
+        for (int i = BytePSGlobal::GetLocalRank() % pcie_size;
+             i < BytePSGlobal::GetLocalSize();
+             i += pcie_size) {
+            peers.push_back(i);
+        }
+        // without other switches there is nobody to signal
+        if (peers.size() > 1) {
+            _comm = CreateComm(comm, std::string("cpu"), peers);
+        }
+    }
+#endif
+    _simd_level = GetSimdLevel();
+    _stream_threshold = getenv("BYTEPS_CPU_REDUCER_STREAM_BYTES") ?
+                        atoll(getenv("BYTEPS_CPU_REDUCER_STREAM_BYTES")) : BYTEPS_CPU_REDUCER_STREAM_BYTES;
     return;
 }
 
-bool CpuReducer::isRoot() {
-    return (_comm->getRoot() == BytePSGlobal::GetLocalRank());
-}
-
-int CpuReducer::sum(void* dst, void* src, size_t len, DataType dtype) {
-    switch (dtype) {
-        case BYTEPS_FLOAT32:
-            return _sum_float32(dst, src, len);
-        case BYTEPS_FLOAT64:
-            return _sum_float64(dst, src, len);
-        case BYTEPS_FLOAT16:
-            return _sum_float16(dst, src, len);
-        case BYTEPS_UINT8:
-            return _sum_unit8(dst, src, len);
-        case BYTEPS_INT32:
-            return _sum_int32(dst, src, len);
-        case BYTEPS_INT8:
-            return _sum_int8(dst, src, len);
-        case BYTEPS_INT64:
-            return _sum_int64(dst, src, len);
-        default:
-            BPS_CHECK(0) << "Unsupported data type: " << dtype;
-    }
-    return 0;
-}
-
-int CpuReducer::_sum_float32(void* dst, void* src, size_t len) {
-    auto d = (float*)dst;
-    auto s = (float*)src;
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len / (size_t) 4; ++i) {
-        d[i] = d[i] + s[i];
-    }
-    return 0;
-}
-
-int CpuReducer::_sum_float64(void* dst, void* src, size_t len) {
-    auto d = (double*)dst;
-    auto s = (double*)src;
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len / (size_t) 8; ++i) {
-        d[i] = d[i] + s[i];
-    }
-    return 0;
-}
-
-int CpuReducer::_sum_float16(void* dst, void* src, size_t len) {
-    // convert half precision to fp32 --> do sum --> convert fp32 to half precision
-    auto d = (uint16_t*) dst;
-    auto s = (uint16_t*) src;
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len / (size_t) 2; ++i) {
-        float d_fp32 = _convert_half_to_full_precision((uint16_t) d[i]);
-        float s_fp32 = _convert_half_to_full_precision((uint16_t) s[i]);
-        d_fp32 = d_fp32 + s_fp32;
-        d[i] = _convert_full_to_half_precision((float) d_fp32);
-    }
-    return 0;
-}
-
-int CpuReducer::_sum_unit8(void* dst, void* src, size_t len) {
-    auto d = (unsigned char*)dst;
-    auto s = (unsigned char*)src;
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len; ++i) {
-        d[i] = d[i] + s[i];
-    }
-    return 0;
+CpuReducerPool* CpuReducer::_get_pool() {
+    // only the devices that actually reduce pay for the threads
+    std::call_once(_pool_once, [this] {
+        auto num_threads = getenv("BYTEPS_CPU_REDUCER_THREADS") ?
+                           atoi(getenv("BYTEPS_CPU_REDUCER_THREADS")) : BYTEPS_CPU_REDUCER_THREADS;
+        auto threshold = getenv("BYTEPS_CPU_REDUCER_PARALLEL_BYTES") ?
+                         atoll(getenv("BYTEPS_CPU_REDUCER_PARALLEL_BYTES")) : BYTEPS_CPU_REDUCER_PARALLEL_BYTES;
+        _pool.reset(new CpuReducerPool(num_threads, threshold));
+    });
+    return _pool.get();
 }
 
-int CpuReducer::_sum_int32(void* dst, void* src, size_t len) {
-    auto d = (int*)dst;
-    auto s = (int*)src;
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len / (size_t) 4; ++i) {
-        d[i] = d[i] + s[i];
-    }
-    return 0;
-}
-
-int CpuReducer::_sum_int8(void* dst, void* src, size_t len) {
-    auto d = (signed char*)dst;
-    auto s = (signed char*)src;
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len; ++i) {
-        d[i] = d[i] + s[i];
-    }
-    return 0;
+bool CpuReducer::isRoot() {
+#ifndef BYTEPS_BUILDING_SERVER
+    return !_comm || (_comm->getRoot() == BytePSGlobal::GetLocalRank());
+#else
+    return true;
+#endif
 }
 
-int CpuReducer::_sum_int64(void* dst, void* src, size_t len) {
-    auto d = (long long*)dst;
-    auto s = (long long*)src;
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len / (size_t) 8; ++i) {
-        d[i] = d[i] + s[i];
-    }
-    return 0;
+int CpuReducer::sum(void* dst, void* src, size_t len, DataType dtype) {
+    return sum(dst, dst, src, len, dtype);
 }
 
 int CpuReducer::sum(void* dst, void* src1, void* src2, size_t len, DataType dtype) {
-    switch (dtype) {
-        case BYTEPS_FLOAT32:
-            return _sum_float32(dst, src1, src2, len);
-        case BYTEPS_FLOAT64:
-            return _sum_float64(dst, src1, src2, len);
-        case BYTEPS_FLOAT16:
-            return _sum_float16(dst, src1, src2, len);
-        case BYTEPS_UINT8:
-            return _sum_unit8(dst, src1, src2, len);
-        case BYTEPS_INT32:
-            return _sum_int32(dst, src1, src2, len);
-        case BYTEPS_INT8:
-            return _sum_int8(dst, src1, src2, len);
-        case BYTEPS_INT64:
-            return _sum_int64(dst, src1, src2, len);
-        default:
-            BPS_CHECK(0) << "Unsupported data type: " << dtype;
-    }
-    return 0;
+    return reduce(dst, src1, src2, len, dtype, BYTEPS_OP_SUM);
 }
 
-int CpuReducer::_sum_float32(void* dst, void* src1, void* src2, size_t len) {
-    auto d = (float*)dst;
-    auto s1 = (float*)src1;
-    auto s2 = (float*)src2;
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len / (size_t) 4; ++i) {
-        d[i] = s1[i] + s2[i];
-    }
+int CpuReducer::reduce(void* dst, void* src1, void* src2, size_t len, DataType dtype, ReduceOp op) {
+    auto kernel = GetSimdReduceKernel(_simd_level, dtype, op, len >= _stream_threshold);
+    BPS_CHECK(kernel) << "Unsupported data type: " << dtype << " or reduce op: " << op;
+    _get_pool()->Run(dst, len, getDataTypeLength(dtype), [&](size_t offset, size_t bytes) {
+        kernel((char*) dst + offset, (char*) src1 + offset, (char*) src2 + offset, bytes);
+    });
     return 0;
 }
 
-int CpuReducer::_sum_float64(void* dst, void* src1, void* src2, size_t len) {
-    auto d = (double*)dst;
-    auto s1 = (double*)src1;
-    auto s2 = (double*)src2;
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len / (size_t) 8; ++i) {
-        d[i] = s1[i] + s2[i];
+int CpuReducer::reduce_n(void* dst, void** srcs, int n, size_t len, DataType dtype, ReduceOp op,
+                         double scale) {
+    BPS_CHECK_GE(n, 1);
+    auto kernel = GetSimdReduceNKernel(_simd_level, dtype, op, len >= _stream_threshold);
+    BPS_CHECK(kernel) << "Unsupported data type: " << dtype << " or reduce op: " << op;
+    for (int k = BYTEPS_CPU_REDUCER_MAX_SOURCES; k < n; ++k) {
+        BPS_CHECK_NE(srcs[k], dst) << "dst must be one of the first "
+                                   << BYTEPS_CPU_REDUCER_MAX_SOURCES << " sources";
     }
+    _get_pool()->Run(dst, len, getDataTypeLength(dtype), [&](size_t offset, size_t bytes) {
+        auto segment_dst = (char*) dst + offset;
+        const void* segment_srcs[BYTEPS_CPU_REDUCER_MAX_SOURCES];
+        int next = 0;
+        while (next < n) {
+            // after the first pass, dst holds the result so far
+            int num = 0;
+            if (next) segment_srcs[num++] = segment_dst;
+            for (; num < BYTEPS_CPU_REDUCER_MAX_SOURCES && next < n; ++num, ++next) {
+                segment_srcs[num] = (char*) srcs[next] + offset;
+            }
+            kernel(segment_dst, segment_srcs, num, bytes, (next == n) ? scale : 1.0);
+        }
+    });
     return 0;
 }
 
-int CpuReducer::_sum_float16(void* dst, void* src1, void* src2, size_t len) {
-    // convert half precision to fp32 --> do sum --> convert fp32 to half precision
-    auto d = (uint16_t*) dst;
-    auto s1 = (uint16_t*) src1;
-    auto s2 = (uint16_t*) src2;
-
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len / (size_t) 2; ++i) {
-        float d_fp32 = _convert_half_to_full_precision((uint16_t) d[i]);
-        float s1_fp32 = _convert_half_to_full_precision((uint16_t) s1[i]);
-        float s2_fp32 = _convert_half_to_full_precision((uint16_t) s2[i]);
-        d_fp32 = s1_fp32 + s2_fp32;
-        d[i] = _convert_full_to_half_precision((float) d_fp32);
-    }
+int CpuReducer::scale(void* dst, void* src, size_t len, DataType dtype, double factor) {
+    auto kernel = GetSimdScaleKernel(_simd_level, dtype, len >= _stream_threshold);
+    BPS_CHECK(kernel) << "Unsupported data type: " << dtype;
+    _get_pool()->Run(dst, len, getDataTypeLength(dtype), [&](size_t offset, size_t bytes) {
+        kernel((char*) dst + offset, (char*) src + offset, bytes, factor);
+    });
     return 0;
 }
 
-int CpuReducer::_sum_unit8(void* dst, void* src1, void* src2, size_t len) {
-    auto d = (unsigned char*)dst;
-    auto s1 = (unsigned char*)src1;
-    auto s2 = (unsigned char*)src2;
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len; ++i) {
-        d[i] = s1[i] + s2[i];
-    }
-    return 0;
-}
-
-int CpuReducer::_sum_int32(void* dst, void* src1, void* src2, size_t len) {
-    auto d = (int*)dst;
-    auto s1 = (int*)src1;
-    auto s2 = (int*)src2;
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len / (size_t) 4; ++i) {
-        d[i] = s1[i] + s2[i];
-    }
-    return 0;
-}
-
-int CpuReducer::_sum_int8(void* dst, void* src1, void* src2, size_t len) {
-    auto d = (signed char*)dst;
-    auto s1 = (signed char*)src1;
-    auto s2 = (signed char*)src2;
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len; ++i) {
-        d[i] = s1[i] + s2[i];
-    }
-    return 0;
-}
-
-int CpuReducer::_sum_int64(void* dst, void* src1, void* src2, size_t len) {
-    auto d = (long long*)dst;
-    auto s1 = (long long*)src1;
-    auto s2 = (long long*)src2;
-#pragma omp parallel for simd num_threads(_num_threads)
-    for (size_t i = 0; i < len / (size_t) 8; ++i) {
-        d[i] = s1[i] + s2[i];
-    }
-    return 0;
-}
-
-float CpuReducer::_convert_half_to_full_precision(uint16_t h) {
-    float f = ((h&0x8000)<<16) | (((h&0x7c00)+0x1C000)<<13) | ((h&0x03FF)<<13);
-    return f;
-}
-
-uint16_t CpuReducer::_convert_full_to_half_precision(float f) {
-    uint32_t x = *((uint32_t*)&f);
-    uint16_t h = ((x>>16)&0x8000) | ((((x&0x7f800000)-0x38000000)>>13)&0x7c00) | ((x>>13)&0x03ff);
-    return h;
-}
-
-
 } // namespace common
 } // namespace byteps
@@ -17,11 +17,18 @@
 #define BYTEPS_CPU_REDUCER_H
 
 #include <memory>
+#include <mutex>
 #include "common.h"
 #include "communicator.h"
+#include "cpu_reducer_simd.h"
 #include "logging.h"
+#include "reducer_pool.h"
 
 #define BYTEPS_CPU_REDUCER_THREADS 16
+#define BYTEPS_CPU_REDUCER_PARALLEL_BYTES (256 * 1024)
+#define BYTEPS_CPU_REDUCER_STREAM_BYTES (1024 * 1024)
+// sources reduce_n() reads in one pass, at least the local size of any machine
+#define BYTEPS_CPU_REDUCER_MAX_SOURCES 32
 
 namespace byteps {
 namespace common {
@@ -37,31 +44,26 @@ public:
     
     int sum(void* dst, void* src, size_t len, DataType dtype);
     int sum(void* dst, void* src1, void* src2, size_t len, DataType dtype);
+    int reduce(void* dst, void* src1, void* src2, size_t len, DataType dtype, ReduceOp op);
+    // dst = (srcs[0] op ... op srcs[n-1]) * scale, reading each source once; dst may be one of srcs.
+    // Beyond BYTEPS_CPU_REDUCER_MAX_SOURCES the rest are folded into dst in further passes,
+    // so dst may then only be one of the first BYTEPS_CPU_REDUCER_MAX_SOURCES.
+    int reduce_n(void* dst, void** srcs, int n, size_t len, DataType dtype, ReduceOp op,
+                 double scale = 1.0);
+    // dst = src * factor, e.g. to turn a sum into an average
+    int scale(void* dst, void* src, size_t len, DataType dtype, double factor);
     bool isRoot();
     std::shared_ptr<BytePSComm> getComm() { return _comm; }
 
 private:
-    int _sum_float32(void* dst, void* src, size_t len);
-    int _sum_float64(void* dst, void* src, size_t len);
-    int _sum_float16(void* dst, void* src, size_t len);
-    int _sum_unit8(void* dst, void* src, size_t len);
-    int _sum_int32(void* dst, void* src, size_t len);
-    int _sum_int8(void* dst, void* src, size_t len);
-    int _sum_int64(void* dst, void* src, size_t len);
-
-    int _sum_float32(void* dst, void* src1, void* src2, size_t len);
-    int _sum_float64(void* dst, void* src1, void* src2, size_t len);
-    int _sum_float16(void* dst, void* src1, void* src2, size_t len);
-    int _sum_unit8(void* dst, void* src1, void* src2, size_t len);
-    int _sum_int32(void* dst, void* src1, void* src2, size_t len);
-    int _sum_int8(void* dst, void* src1, void* src2, size_t len);
-    int _sum_int64(void* dst, void* src1, void* src2, size_t len);
-
-    float _convert_half_to_full_precision(uint16_t h);
-    uint16_t _convert_full_to_half_precision(float f);
+    CpuReducerPool* _get_pool();
 
     std::shared_ptr<BytePSComm> _comm;
-    int _num_threads;
+    std::unique_ptr<CpuReducerPool> _pool;
+    std::once_flag _pool_once;
+    SimdLevel _simd_level;
+    // outputs of at least this size are written with non-temporal stores
+    size_t _stream_threshold;
 };
 
 
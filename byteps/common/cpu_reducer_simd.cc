@@ -0,0 +1,1042 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <type_traits>
+
+#include "cpu_reducer_simd.h"
+#include "logging.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define BYTEPS_SIMD_X86 1
+#endif
+
+namespace byteps {
+namespace common {
+
+// Element-wise ops. The portable loops call Op::apply(a, b), the vector
+// kernels Ops<T>::apply(Op(), a, b) with the same operand order, so that
+// e.g. max/min agree with (v)maxps/(v)minps on NaN and signed zeros.
+struct OpSum {
+    template <typename T> static T apply(T a, T b) { return a + b; }
+};
+
+struct OpMax {
+    template <typename T> static T apply(T a, T b) { return a > b ? a : b; }
+};
+
+struct OpMin {
+    template <typename T> static T apply(T a, T b) { return a < b ? a : b; }
+};
+
+struct OpProd {
+    template <typename T> static T apply(T a, T b) { return a * b; }
+};
+
+// Number of leading elements to handle before dst + i is aligned to align
+// bytes, or 0 if no streaming stores are used
+template <bool kStream, typename T>
+inline size_t AlignedPrefix(const T* dst, size_t n, size_t align) {
+    if (!kStream) return 0;
+    size_t misalign = (uintptr_t) dst & (align - 1);
+    size_t prefix = misalign ? (align - misalign) / sizeof(T) : 0;
+    return prefix < n ? prefix : n;
+}
+
+// x * factor. Floating point types scale in their own precision like the
+// vector kernels, integers in double precision and truncated.
+template <typename T>
+inline T ScaleOne(T x, double factor) {
+    typedef typename std::conditional<std::is_floating_point<T>::value, T, double>::type F;
+    return (T) (x * (F) factor);
+}
+
+// Portable loops, used when there is no vector kernel for the dtype/op/CPU
+namespace scalar {
+
+template <typename T, typename Op>
+void Reduce(void* dst, const void* src1, const void* src2, size_t len) {
+    auto d = (T*) dst;
+    auto s1 = (const T*) src1;
+    auto s2 = (const T*) src2;
+#pragma omp simd
+    for (size_t i = 0; i < len / sizeof(T); ++i) {
+        d[i] = Op::apply(s1[i], s2[i]);
+    }
+}
+
+template <typename T, typename Op>
+void ReduceN(void* dst, const void* const* srcs, int num, size_t len, double scale) {
+    auto d = (T*) dst;
+    auto s = (const T* const*) srcs;
+    const bool scaled = (scale != 1.0);
+    for (size_t i = 0; i < len / sizeof(T); ++i) {
+        T acc = s[0][i];
+        for (int k = 1; k < num; ++k) acc = Op::apply(acc, s[k][i]);
+        d[i] = scaled ? ScaleOne(acc, scale) : acc;
+    }
+}
+
+// fp16/bf16 as uint16_t, converted through fp32
+template <float (*ToFloat)(uint16_t), uint16_t (*FromFloat)(float), typename Op>
+void ReduceHalf(void* dst, const void* src1, const void* src2, size_t len) {
+    auto d = (uint16_t*) dst;
+    auto s1 = (const uint16_t*) src1;
+    auto s2 = (const uint16_t*) src2;
+    for (size_t i = 0; i < len / 2; ++i) {
+        d[i] = FromFloat(Op::apply(ToFloat(s1[i]), ToFloat(s2[i])));
+    }
+}
+
+template <float (*ToFloat)(uint16_t), uint16_t (*FromFloat)(float), typename Op>
+void ReduceNHalf(void* dst, const void* const* srcs, int num, size_t len, double scale) {
+    auto d = (uint16_t*) dst;
+    auto s = (const uint16_t* const*) srcs;
+    const bool scaled = (scale != 1.0);
+    for (size_t i = 0; i < len / 2; ++i) {
+        float acc = ToFloat(s[0][i]);
+        for (int k = 1; k < num; ++k) acc = Op::apply(acc, ToFloat(s[k][i]));
+        d[i] = FromFloat(scaled ? ScaleOne(acc, scale) : acc);
+    }
+}
+
+template <typename T>
+void Scale(void* dst, const void* src, size_t len, double factor) {
+    auto d = (T*) dst;
+    auto s = (const T*) src;
+#pragma omp simd
+    for (size_t i = 0; i < len / sizeof(T); ++i) {
+        d[i] = ScaleOne(s[i], factor);
+    }
+}
+
+template <float (*ToFloat)(uint16_t), uint16_t (*FromFloat)(float)>
+void ScaleHalf(void* dst, const void* src, size_t len, double factor) {
+    auto d = (uint16_t*) dst;
+    auto s = (const uint16_t*) src;
+    for (size_t i = 0; i < len / 2; ++i) {
+        d[i] = FromFloat(ScaleOne(ToFloat(s[i]), factor));
+    }
+}
+
+template <typename Op>
+SimdReduceKernel ReduceKernel(DataType dtype) {
+    switch (dtype) {
+        case BYTEPS_FLOAT32: return Reduce<float, Op>;
+        case BYTEPS_FLOAT64: return Reduce<double, Op>;
+        case BYTEPS_FLOAT16: return ReduceHalf<HalfToFloat, FloatToHalf, Op>;
+        case BYTEPS_BFLOAT16: return ReduceHalf<BFloat16ToFloat, FloatToBFloat16, Op>;
+        case BYTEPS_UINT8: return Reduce<unsigned char, Op>;
+        case BYTEPS_INT32: return Reduce<int, Op>;
+        case BYTEPS_INT8: return Reduce<signed char, Op>;
+        case BYTEPS_INT64: return Reduce<long long, Op>;
+        default: return nullptr;
+    }
+}
+
+template <typename Op>
+SimdReduceNKernel ReduceNKernel(DataType dtype) {
+    switch (dtype) {
+        case BYTEPS_FLOAT32: return ReduceN<float, Op>;
+        case BYTEPS_FLOAT64: return ReduceN<double, Op>;
+        case BYTEPS_FLOAT16: return ReduceNHalf<HalfToFloat, FloatToHalf, Op>;
+        case BYTEPS_BFLOAT16: return ReduceNHalf<BFloat16ToFloat, FloatToBFloat16, Op>;
+        case BYTEPS_UINT8: return ReduceN<unsigned char, Op>;
+        case BYTEPS_INT32: return ReduceN<int, Op>;
+        case BYTEPS_INT8: return ReduceN<signed char, Op>;
+        case BYTEPS_INT64: return ReduceN<long long, Op>;
+        default: return nullptr;
+    }
+}
+
+inline SimdScaleKernel ScaleKernel(DataType dtype) {
+    switch (dtype) {
+        case BYTEPS_FLOAT32: return Scale<float>;
+        case BYTEPS_FLOAT64: return Scale<double>;
+        case BYTEPS_FLOAT16: return ScaleHalf<HalfToFloat, FloatToHalf>;
+        case BYTEPS_BFLOAT16: return ScaleHalf<BFloat16ToFloat, FloatToBFloat16>;
+        case BYTEPS_UINT8: return Scale<unsigned char>;
+        case BYTEPS_INT32: return Scale<int>;
+        case BYTEPS_INT8: return Scale<signed char>;
+        case BYTEPS_INT64: return Scale<long long>;
+        default: return nullptr;
+    }
+}
+
+} // namespace scalar
+
+#ifdef BYTEPS_SIMD_X86
+
+// The kernels are compiled for their instruction set regardless of the
+// global -m flags, and only ever called after GetSimdLevel() checked the CPU.
+
+#pragma GCC push_options
+#pragma GCC target("avx2,f16c")
+namespace avx2 {
+
+template <typename T> struct Ops;
+
+template <> struct Ops<float> {
+    typedef __m256 V;
+    static V load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+    static void stream(float* p, V v) { _mm256_stream_ps(p, v); }
+    static V set1(float x) { return _mm256_set1_ps(x); }
+    static V apply(OpSum, V a, V b) { return _mm256_add_ps(a, b); }
+    static V apply(OpMax, V a, V b) { return _mm256_max_ps(a, b); }
+    static V apply(OpMin, V a, V b) { return _mm256_min_ps(a, b); }
+    static V apply(OpProd, V a, V b) { return _mm256_mul_ps(a, b); }
+};
+
+template <> struct Ops<double> {
+    typedef __m256d V;
+    static V load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, V v) { _mm256_storeu_pd(p, v); }
+    static void stream(double* p, V v) { _mm256_stream_pd(p, v); }
+    static V set1(double x) { return _mm256_set1_pd(x); }
+    static V apply(OpSum, V a, V b) { return _mm256_add_pd(a, b); }
+    static V apply(OpMax, V a, V b) { return _mm256_max_pd(a, b); }
+    static V apply(OpMin, V a, V b) { return _mm256_min_pd(a, b); }
+    static V apply(OpProd, V a, V b) { return _mm256_mul_pd(a, b); }
+};
+
+template <typename T> struct IntOps {
+    typedef __m256i V;
+    static V load(const T* p) { return _mm256_loadu_si256((const __m256i*) p); }
+    static void store(T* p, V v) { _mm256_storeu_si256((__m256i*) p, v); }
+    static void stream(T* p, V v) { _mm256_stream_si256((__m256i*) p, v); }
+};
+
+template <> struct Ops<unsigned char> : IntOps<unsigned char> {
+    static V apply(OpSum, V a, V b) { return _mm256_add_epi8(a, b); }
+    static V apply(OpMax, V a, V b) { return _mm256_max_epu8(a, b); }
+    static V apply(OpMin, V a, V b) { return _mm256_min_epu8(a, b); }
+};
+
+template <> struct Ops<signed char> : IntOps<signed char> {
+    static V apply(OpSum, V a, V b) { return _mm256_add_epi8(a, b); }
+    static V apply(OpMax, V a, V b) { return _mm256_max_epi8(a, b); }
+    static V apply(OpMin, V a, V b) { return _mm256_min_epi8(a, b); }
+};
+
+template <> struct Ops<int> : IntOps<int> {
+    static V apply(OpSum, V a, V b) { return _mm256_add_epi32(a, b); }
+    static V apply(OpMax, V a, V b) { return _mm256_max_epi32(a, b); }
+    static V apply(OpMin, V a, V b) { return _mm256_min_epi32(a, b); }
+    static V apply(OpProd, V a, V b) { return _mm256_mullo_epi32(a, b); }
+};
+
+template <> struct Ops<long long> : IntOps<long long> {
+    static V apply(OpSum, V a, V b) { return _mm256_add_epi64(a, b); }
+    // no 64-bit max/min before AVX-512
+    static V apply(OpMax, V a, V b) { return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b)); }
+    static V apply(OpMin, V a, V b) { return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(b, a)); }
+};
+
+// There are no 8-bit or 64-bit vector multiplies, see Pick*()
+template <typename T, typename Op> struct HasVec : std::true_type {};
+template <> struct HasVec<unsigned char, OpProd> : std::false_type {};
+template <> struct HasVec<signed char, OpProd> : std::false_type {};
+template <> struct HasVec<long long, OpProd> : std::false_type {};
+
+// Non-temporal stores bypass the caches, which pays off for large outputs
+// that are consumed by a DMA (network or H2D copy) rather than re-read.
+// They need an aligned destination, see AlignedPrefix().
+template <bool kStream, typename T, typename V>
+inline void Store(T* p, V v) {
+    if (kStream) {
+        Ops<T>::stream(p, v);
+    } else {
+        Ops<T>::store(p, v);
+    }
+}
+
+template <bool kStream>
+inline void StoreHalf(uint16_t* p, __m128i v) {
+    if (kStream) {
+        _mm_stream_si128((__m128i*) p, v);
+    } else {
+        _mm_storeu_si128((__m128i*) p, v);
+    }
+}
+
+// round 8 fp32 to nearest even bf16, returned in the low 16 bits of each lane
+static inline __m256i RoundBFloat16(__m256 v) {
+    __m256i x = _mm256_castps_si256(v);
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(x, 16), _mm256_set1_epi32(1));
+    __m256i r = _mm256_srli_epi32(
+        _mm256_add_epi32(_mm256_add_epi32(x, _mm256_set1_epi32(0x7fff)), lsb), 16);
+    __m256i nan = _mm256_or_si256(_mm256_srli_epi32(x, 16), _mm256_set1_epi32(0x40));
+    return _mm256_blendv_epi8(r, nan, _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q)));
+}
+
+// fp16/bf16 are widened to width fp32 lanes, reduced as Ops<float> and
+// rounded back once
+struct Float16 {
+    static const size_t width = 8;
+    static const size_t align = 16;
+    static float to_float(uint16_t h) { return HalfToFloat(h); }
+    static uint16_t from_float(float f) { return FloatToHalf(f); }
+    static __m256 load(const uint16_t* p) {
+        return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) p));
+    }
+    template <bool kStream>
+    static void store(uint16_t* p, __m256 v) {
+        StoreHalf<kStream>(p, _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+};
+
+struct BFloat16 {
+    static const size_t width = 8;
+    static const size_t align = 16;
+    static float to_float(uint16_t b) { return BFloat16ToFloat(b); }
+    static uint16_t from_float(float f) { return FloatToBFloat16(f); }
+    static __m256 load(const uint16_t* p) {
+        __m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) p));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(x, 16));
+    }
+    template <bool kStream>
+    static void store(uint16_t* p, __m256 v) {
+        __m256i r = RoundBFloat16(v);
+        StoreHalf<kStream>(p, _mm_packus_epi32(_mm256_castsi256_si128(r),
+                                               _mm256_extracti128_si256(r, 1)));
+    }
+};
+
+template <typename T, typename Op, bool kStream>
+void Reduce(void* dst, const void* src1, const void* src2, size_t len) {
+    auto d = (T*) dst;
+    auto s1 = (const T*) src1;
+    auto s2 = (const T*) src2;
+    size_t n = len / sizeof(T);
+    const size_t w = 32 / sizeof(T);
+    size_t i = 0;
+    for (size_t prefix = AlignedPrefix<kStream>(d, n, 32); i < prefix; ++i) {
+        d[i] = Op::apply(s1[i], s2[i]);
+    }
+    for (; i + 2 * w <= n; i += 2 * w) {
+        auto a0 = Ops<T>::apply(Op(), Ops<T>::load(s1 + i), Ops<T>::load(s2 + i));
+        auto a1 = Ops<T>::apply(Op(), Ops<T>::load(s1 + i + w), Ops<T>::load(s2 + i + w));
+        Store<kStream>(d + i, a0);
+        Store<kStream>(d + i + w, a1);
+    }
+    for (; i < n; ++i) {
+        d[i] = Op::apply(s1[i], s2[i]);
+    }
+    if (kStream) _mm_sfence();
+}
+
+template <typename T, typename Op, bool kStream, typename S>
+void ReduceNBody(void* dst, const void* const* srcs, int num, size_t len, S scale) {
+    auto d = (T*) dst;
+    auto s = (const T* const*) srcs;
+    size_t n = len / sizeof(T);
+    const size_t w = 32 / sizeof(T);
+    size_t i = 0;
+    for (size_t prefix = AlignedPrefix<kStream>(d, n, 32); i < prefix; ++i) {
+        T acc = s[0][i];
+        for (int k = 1; k < num; ++k) acc = Op::apply(acc, s[k][i]);
+        d[i] = scale(acc);
+    }
+    for (; i + w <= n; i += w) {
+        auto acc = Ops<T>::load(s[0] + i);
+        for (int k = 1; k < num; ++k) {
+            acc = Ops<T>::apply(Op(), acc, Ops<T>::load(s[k] + i));
+        }
+        Store<kStream>(d + i, scale(acc));
+    }
+    for (; i < n; ++i) {
+        T acc = s[0][i];
+        for (int k = 1; k < num; ++k) acc = Op::apply(acc, s[k][i]);
+        d[i] = scale(acc);
+    }
+    if (kStream) _mm_sfence();
+}
+
+template <typename H, typename Op, bool kStream>
+void ReduceHalf(void* dst, const void* src1, const void* src2, size_t len) {
+    auto d = (uint16_t*) dst;
+    auto s1 = (const uint16_t*) src1;
+    auto s2 = (const uint16_t*) src2;
+    size_t n = len / 2;
+    size_t i = 0;
+    for (size_t prefix = AlignedPrefix<kStream>(d, n, H::align); i < prefix; ++i) {
+        d[i] = H::from_float(Op::apply(H::to_float(s1[i]), H::to_float(s2[i])));
+    }
+    for (; i + H::width <= n; i += H::width) {
+        auto v = Ops<float>::apply(Op(), H::load(s1 + i), H::load(s2 + i));
+        H::template store<kStream>(d + i, v);
+    }
+    for (; i < n; ++i) {
+        d[i] = H::from_float(Op::apply(H::to_float(s1[i]), H::to_float(s2[i])));
+    }
+    if (kStream) _mm_sfence();
+}
+
+template <typename H, typename Op, bool kStream, typename S>
+void ReduceNHalfBody(void* dst, const void* const* srcs, int num, size_t len, S scale) {
+    auto d = (uint16_t*) dst;
+    auto s = (const uint16_t* const*) srcs;
+    size_t n = len / 2;
+    size_t i = 0;
+    for (size_t prefix = AlignedPrefix<kStream>(d, n, H::align); i < prefix; ++i) {
+        float acc = H::to_float(s[0][i]);
+        for (int k = 1; k < num; ++k) acc = Op::apply(acc, H::to_float(s[k][i]));
+        d[i] = H::from_float(scale(acc));
+    }
+    for (; i + H::width <= n; i += H::width) {
+        auto acc = H::load(s[0] + i);
+        for (int k = 1; k < num; ++k) {
+            acc = Ops<float>::apply(Op(), acc, H::load(s[k] + i));
+        }
+        H::template store<kStream>(d + i, scale(acc));
+    }
+    for (; i < n; ++i) {
+        float acc = H::to_float(s[0][i]);
+        for (int k = 1; k < num; ++k) acc = Op::apply(acc, H::to_float(s[k][i]));
+        d[i] = H::from_float(scale(acc));
+    }
+    if (kStream) _mm_sfence();
+}
+
+// The final multiply of the N-way kernels, fused into their stores
+struct Unscaled {
+    template <typename X> X operator()(X x) const { return x; }
+};
+
+template <typename T> struct Scaled {
+    T f;
+    typename Ops<T>::V vf;
+    explicit Scaled(double scale) : f((T) scale), vf(Ops<T>::set1(f)) {}
+    T operator()(T x) const { return x * f; }
+    typename Ops<T>::V operator()(typename Ops<T>::V x) const {
+        return Ops<T>::apply(OpProd(), x, vf);
+    }
+};
+
+template <typename T, typename Op, bool kStream>
+void ReduceNScaled(void* dst, const void* const* srcs, int num, size_t len, double scale,
+                   std::true_type /* floating point */) {
+    ReduceNBody<T, Op, kStream>(dst, srcs, num, len, Scaled<T>(scale));
+}
+
+// there is no vector conversion from integers to double here
+template <typename T, typename Op, bool kStream>
+void ReduceNScaled(void* dst, const void* const* srcs, int num, size_t len, double scale,
+                   std::false_type) {
+    scalar::ReduceN<T, Op>(dst, srcs, num, len, scale);
+}
+
+template <typename T, typename Op, bool kStream>
+void ReduceN(void* dst, const void* const* srcs, int num, size_t len, double scale) {
+    if (scale == 1.0) {
+        ReduceNBody<T, Op, kStream>(dst, srcs, num, len, Unscaled());
+    } else {
+        ReduceNScaled<T, Op, kStream>(dst, srcs, num, len, scale, std::is_floating_point<T>());
+    }
+}
+
+template <typename H, typename Op, bool kStream>
+void ReduceNHalf(void* dst, const void* const* srcs, int num, size_t len, double scale) {
+    if (scale == 1.0) {
+        ReduceNHalfBody<H, Op, kStream>(dst, srcs, num, len, Unscaled());
+    } else {
+        ReduceNHalfBody<H, Op, kStream>(dst, srcs, num, len, Scaled<float>(scale));
+    }
+}
+
+template <typename T, bool kStream>
+void Scale(void* dst, const void* src, size_t len, double factor) {
+    auto d = (T*) dst;
+    auto s = (const T*) src;
+    size_t n = len / sizeof(T);
+    const size_t w = 32 / sizeof(T);
+    const T f = (T) factor;
+    const auto vf = Ops<T>::set1(f);
+    size_t i = 0;
+    for (size_t prefix = AlignedPrefix<kStream>(d, n, 32); i < prefix; ++i) {
+        d[i] = s[i] * f;
+    }
+    for (; i + w <= n; i += w) {
+        Store<kStream>(d + i, Ops<T>::apply(OpProd(), Ops<T>::load(s + i), vf));
+    }
+    for (; i < n; ++i) {
+        d[i] = s[i] * f;
+    }
+    if (kStream) _mm_sfence();
+}
+
+template <typename H, bool kStream>
+void ScaleHalf(void* dst, const void* src, size_t len, double factor) {
+    auto d = (uint16_t*) dst;
+    auto s = (const uint16_t*) src;
+    size_t n = len / 2;
+    const float f = (float) factor;
+    const auto vf = Ops<float>::set1(f);
+    size_t i = 0;
+    for (size_t prefix = AlignedPrefix<kStream>(d, n, H::align); i < prefix; ++i) {
+        d[i] = H::from_float(H::to_float(s[i]) * f);
+    }
+    for (; i + H::width <= n; i += H::width) {
+        H::template store<kStream>(d + i, Ops<float>::apply(OpProd(), H::load(s + i), vf));
+    }
+    for (; i < n; ++i) {
+        d[i] = H::from_float(H::to_float(s[i]) * f);
+    }
+    if (kStream) _mm_sfence();
+}
+
+template <typename T, typename Op, bool kStream>
+SimdReduceKernel PickReduce(std::true_type) { return Reduce<T, Op, kStream>; }
+
+template <typename T, typename Op, bool kStream>
+SimdReduceKernel PickReduce(std::false_type) { return scalar::Reduce<T, Op>; }
+
+template <typename T, typename Op, bool kStream>
+SimdReduceNKernel PickReduceN(std::true_type) { return ReduceN<T, Op, kStream>; }
+
+template <typename T, typename Op, bool kStream>
+SimdReduceNKernel PickReduceN(std::false_type) { return scalar::ReduceN<T, Op>; }
+
+template <typename Op, bool kStream>
+SimdReduceKernel ReduceKernel(DataType dtype) {
+    switch (dtype) {
+        case BYTEPS_FLOAT32: return PickReduce<float, Op, kStream>(HasVec<float, Op>());
+        case BYTEPS_FLOAT64: return PickReduce<double, Op, kStream>(HasVec<double, Op>());
+        case BYTEPS_FLOAT16: return ReduceHalf<Float16, Op, kStream>;
+        case BYTEPS_BFLOAT16: return ReduceHalf<BFloat16, Op, kStream>;
+        case BYTEPS_UINT8:
+            return PickReduce<unsigned char, Op, kStream>(HasVec<unsigned char, Op>());
+        case BYTEPS_INT32: return PickReduce<int, Op, kStream>(HasVec<int, Op>());
+        case BYTEPS_INT8: return PickReduce<signed char, Op, kStream>(HasVec<signed char, Op>());
+        case BYTEPS_INT64: return PickReduce<long long, Op, kStream>(HasVec<long long, Op>());
+        default: return nullptr;
+    }
+}
+
+template <typename Op, bool kStream>
+SimdReduceNKernel ReduceNKernel(DataType dtype) {
+    switch (dtype) {
+        case BYTEPS_FLOAT32: return PickReduceN<float, Op, kStream>(HasVec<float, Op>());
+        case BYTEPS_FLOAT64: return PickReduceN<double, Op, kStream>(HasVec<double, Op>());
+        case BYTEPS_FLOAT16: return ReduceNHalf<Float16, Op, kStream>;
+        case BYTEPS_BFLOAT16: return ReduceNHalf<BFloat16, Op, kStream>;
+        case BYTEPS_UINT8:
+            return PickReduceN<unsigned char, Op, kStream>(HasVec<unsigned char, Op>());
+        case BYTEPS_INT32: return PickReduceN<int, Op, kStream>(HasVec<int, Op>());
+        case BYTEPS_INT8: return PickReduceN<signed char, Op, kStream>(HasVec<signed char, Op>());
+        case BYTEPS_INT64: return PickReduceN<long long, Op, kStream>(HasVec<long long, Op>());
+        default: return nullptr;
+    }
+}
+
+// integers have no vector conversion to double here and use scalar::
+template <bool kStream>
+SimdScaleKernel ScaleKernel(DataType dtype) {
+    switch (dtype) {
+        case BYTEPS_FLOAT32: return Scale<float, kStream>;
+        case BYTEPS_FLOAT64: return Scale<double, kStream>;
+        case BYTEPS_FLOAT16: return ScaleHalf<Float16, kStream>;
+        case BYTEPS_BFLOAT16: return ScaleHalf<BFloat16, kStream>;
+        default: return scalar::ScaleKernel(dtype);
+    }
+}
+
+} // namespace avx2
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx2,f16c")
+// GCC 12 takes the _mm512_undefined_*() of the intrinsics headers for
+// uninitialized reads
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+namespace avx512 {
+
+template <typename T> struct Ops;
+
+template <> struct Ops<float> {
+    typedef __m512 V;
+    static V load(const float* p) { return _mm512_loadu_ps(p); }
+    static void store(float* p, V v) { _mm512_storeu_ps(p, v); }
+    static void stream(float* p, V v) { _mm512_stream_ps(p, v); }
+    static V set1(float x) { return _mm512_set1_ps(x); }
+    static V apply(OpSum, V a, V b) { return _mm512_add_ps(a, b); }
+    static V apply(OpMax, V a, V b) { return _mm512_max_ps(a, b); }
+    static V apply(OpMin, V a, V b) { return _mm512_min_ps(a, b); }
+    static V apply(OpProd, V a, V b) { return _mm512_mul_ps(a, b); }
+};
+
+template <> struct Ops<double> {
+    typedef __m512d V;
+    static V load(const double* p) { return _mm512_loadu_pd(p); }
+    static void store(double* p, V v) { _mm512_storeu_pd(p, v); }
+    static void stream(double* p, V v) { _mm512_stream_pd(p, v); }
+    static V set1(double x) { return _mm512_set1_pd(x); }
+    static V apply(OpSum, V a, V b) { return _mm512_add_pd(a, b); }
+    static V apply(OpMax, V a, V b) { return _mm512_max_pd(a, b); }
+    static V apply(OpMin, V a, V b) { return _mm512_min_pd(a, b); }
+    static V apply(OpProd, V a, V b) { return _mm512_mul_pd(a, b); }
+};
+
+template <typename T> struct IntOps {
+    typedef __m512i V;
+    static V load(const T* p) { return _mm512_loadu_si512((const void*) p); }
+    static void store(T* p, V v) { _mm512_storeu_si512((void*) p, v); }
+    static void stream(T* p, V v) { _mm512_stream_si512((__m512i*) p, v); }
+};
+
+template <> struct Ops<unsigned char> : IntOps<unsigned char> {
+    static V apply(OpSum, V a, V b) { return _mm512_add_epi8(a, b); }
+    static V apply(OpMax, V a, V b) { return _mm512_max_epu8(a, b); }
+    static V apply(OpMin, V a, V b) { return _mm512_min_epu8(a, b); }
+};
+
+template <> struct Ops<signed char> : IntOps<signed char> {
+    static V apply(OpSum, V a, V b) { return _mm512_add_epi8(a, b); }
+    static V apply(OpMax, V a, V b) { return _mm512_max_epi8(a, b); }
+    static V apply(OpMin, V a, V b) { return _mm512_min_epi8(a, b); }
+};
+
+template <> struct Ops<int> : IntOps<int> {
+    static V apply(OpSum, V a, V b) { return _mm512_add_epi32(a, b); }
+    static V apply(OpMax, V a, V b) { return _mm512_max_epi32(a, b); }
+    static V apply(OpMin, V a, V b) { return _mm512_min_epi32(a, b); }
+    static V apply(OpProd, V a, V b) { return _mm512_mullo_epi32(a, b); }
+};
+
+template <> struct Ops<long long> : IntOps<long long> {
+    static V apply(OpSum, V a, V b) { return _mm512_add_epi64(a, b); }
+    static V apply(OpMax, V a, V b) { return _mm512_max_epi64(a, b); }
+    static V apply(OpMin, V a, V b) { return _mm512_min_epi64(a, b); }
+};
+
+// There are no 8-bit vector multiplies, and the 64-bit one needs AVX-512DQ
+template <typename T, typename Op> struct HasVec : std::true_type {};
+template <> struct HasVec<unsigned char, OpProd> : std::false_type {};
+template <> struct HasVec<signed char, OpProd> : std::false_type {};
+template <> struct HasVec<long long, OpProd> : std::false_type {};
+
+// Non-temporal stores bypass the caches, which pays off for large outputs
+// that are consumed by a DMA (network or H2D copy) rather than re-read.
+// They need an aligned destination, see AlignedPrefix().
+template <bool kStream, typename T, typename V>
+inline void Store(T* p, V v) {
+    if (kStream) {
+        Ops<T>::stream(p, v);
+    } else {
+        Ops<T>::store(p, v);
+    }
+}
+
+template <bool kStream>
+inline void StoreHalf(uint16_t* p, __m256i v) {
+    if (kStream) {
+        _mm256_stream_si256((__m256i*) p, v);
+    } else {
+        _mm256_storeu_si256((__m256i*) p, v);
+    }
+}
+
+// round 16 fp32 to nearest even bf16 and narrow them
+static inline __m256i RoundBFloat16(__m512 v) {
+    __m512i x = _mm512_castps_si512(v);
+    __m512i lsb = _mm512_and_si512(_mm512_srli_epi32(x, 16), _mm512_set1_epi32(1));
+    __m512i r = _mm512_srli_epi32(
+        _mm512_add_epi32(_mm512_add_epi32(x, _mm512_set1_epi32(0x7fff)), lsb), 16);
+    __m512i nan = _mm512_or_si512(_mm512_srli_epi32(x, 16), _mm512_set1_epi32(0x40));
+    r = _mm512_mask_blend_epi32(_mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q), r, nan);
+    return _mm512_cvtepi32_epi16(r);
+}
+
+// fp16/bf16 are widened to width fp32 lanes, reduced as Ops<float> and
+// rounded back once
+struct Float16 {
+    static const size_t width = 16;
+    static const size_t align = 32;
+    static float to_float(uint16_t h) { return HalfToFloat(h); }
+    static uint16_t from_float(float f) { return FloatToHalf(f); }
+    static __m512 load(const uint16_t* p) {
+        return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*) p));
+    }
+    template <bool kStream>
+    static void store(uint16_t* p, __m512 v) {
+        StoreHalf<kStream>(p, _mm512_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+};
+
+struct BFloat16 {
+    static const size_t width = 16;
+    static const size_t align = 32;
+    static float to_float(uint16_t b) { return BFloat16ToFloat(b); }
+    static uint16_t from_float(float f) { return FloatToBFloat16(f); }
+    static __m512 load(const uint16_t* p) {
+        __m512i x = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*) p));
+        return _mm512_castsi512_ps(_mm512_slli_epi32(x, 16));
+    }
+    template <bool kStream>
+    static void store(uint16_t* p, __m512 v) {
+        StoreHalf<kStream>(p, RoundBFloat16(v));
+    }
+};
+
+template <typename T, typename Op, bool kStream>
+void Reduce(void* dst, const void* src1, const void* src2, size_t len) {
+    auto d = (T*) dst;
+    auto s1 = (const T*) src1;
+    auto s2 = (const T*) src2;
+    size_t n = len / sizeof(T);
+    const size_t w = 64 / sizeof(T);
+    size_t i = 0;
+    for (size_t prefix = AlignedPrefix<kStream>(d, n, 64); i < prefix; ++i) {
+        d[i] = Op::apply(s1[i], s2[i]);
+    }
+    for (; i + 2 * w <= n; i += 2 * w) {
+        auto a0 = Ops<T>::apply(Op(), Ops<T>::load(s1 + i), Ops<T>::load(s2 + i));
+        auto a1 = Ops<T>::apply(Op(), Ops<T>::load(s1 + i + w), Ops<T>::load(s2 + i + w));
+        Store<kStream>(d + i, a0);
+        Store<kStream>(d + i + w, a1);
+    }
+    for (; i < n; ++i) {
+        d[i] = Op::apply(s1[i], s2[i]);
+    }
+    if (kStream) _mm_sfence();
+}
+
+template <typename T, typename Op, bool kStream, typename S>
+void ReduceNBody(void* dst, const void* const* srcs, int num, size_t len, S scale) {
+    auto d = (T*) dst;
+    auto s = (const T* const*) srcs;
+    size_t n = len / sizeof(T);
+    const size_t w = 64 / sizeof(T);
+    size_t i = 0;
+    for (size_t prefix = AlignedPrefix<kStream>(d, n, 64); i < prefix; ++i) {
+        T acc = s[0][i];
+        for (int k = 1; k < num; ++k) acc = Op::apply(acc, s[k][i]);
+        d[i] = scale(acc);
+    }
+    for (; i + w <= n; i += w) {
+        auto acc = Ops<T>::load(s[0] + i);
+        for (int k = 1; k < num; ++k) {
+            acc = Ops<T>::apply(Op(), acc, Ops<T>::load(s[k] + i));
+        }
+        Store<kStream>(d + i, scale(acc));
+    }
+    for (; i < n; ++i) {
+        T acc = s[0][i];
+        for (int k = 1; k < num; ++k) acc = Op::apply(acc, s[k][i]);
+        d[i] = scale(acc);
+    }
+    if (kStream) _mm_sfence();
+}
+
+template <typename H, typename Op, bool kStream>
+void ReduceHalf(void* dst, const void* src1, const void* src2, size_t len) {
+    auto d = (uint16_t*) dst;
+    auto s1 = (const uint16_t*) src1;
+    auto s2 = (const uint16_t*) src2;
+    size_t n = len / 2;
+    size_t i = 0;
+    for (size_t prefix = AlignedPrefix<kStream>(d, n, H::align); i < prefix; ++i) {
+        d[i] = H::from_float(Op::apply(H::to_float(s1[i]), H::to_float(s2[i])));
+    }
+    for (; i + H::width <= n; i += H::width) {
+        auto v = Ops<float>::apply(Op(), H::load(s1 + i), H::load(s2 + i));
+        H::template store<kStream>(d + i, v);
+    }
+    for (; i < n; ++i) {
+        d[i] = H::from_float(Op::apply(H::to_float(s1[i]), H::to_float(s2[i])));
+    }
+    if (kStream) _mm_sfence();
+}
+
+template <typename H, typename Op, bool kStream, typename S>
+void ReduceNHalfBody(void* dst, const void* const* srcs, int num, size_t len, S scale) {
+    auto d = (uint16_t*) dst;
+    auto s = (const uint16_t* const*) srcs;
+    size_t n = len / 2;
+    size_t i = 0;
+    for (size_t prefix = AlignedPrefix<kStream>(d, n, H::align); i < prefix; ++i) {
+        float acc = H::to_float(s[0][i]);
+        for (int k = 1; k < num; ++k) acc = Op::apply(acc, H::to_float(s[k][i]));
+        d[i] = H::from_float(scale(acc));
+    }
+    for (; i + H::width <= n; i += H::width) {
+        auto acc = H::load(s[0] + i);
+        for (int k = 1; k < num; ++k) {
+            acc = Ops<float>::apply(Op(), acc, H::load(s[k] + i));
+        }
+        H::template store<kStream>(d + i, scale(acc));
+    }
+    for (; i < n; ++i) {
+        float acc = H::to_float(s[0][i]);
+        for (int k = 1; k < num; ++k) acc = Op::apply(acc, H::to_float(s[k][i]));
+        d[i] = H::from_float(scale(acc));
+    }
+    if (kStream) _mm_sfence();
+}
+
+// The final multiply of the N-way kernels, fused into their stores
+struct Unscaled {
+    template <typename X> X operator()(X x) const { return x; }
+};
+
+template <typename T> struct Scaled {
+    T f;
+    typename Ops<T>::V vf;
+    explicit Scaled(double scale) : f((T) scale), vf(Ops<T>::set1(f)) {}
+    T operator()(T x) const { return x * f; }
+    typename Ops<T>::V operator()(typename Ops<T>::V x) const {
+        return Ops<T>::apply(OpProd(), x, vf);
+    }
+};
+
+template <typename T, typename Op, bool kStream>
+void ReduceNScaled(void* dst, const void* const* srcs, int num, size_t len, double scale,
+                   std::true_type /* floating point */) {
+    ReduceNBody<T, Op, kStream>(dst, srcs, num, len, Scaled<T>(scale));
+}
+
+// there is no vector conversion from integers to double here
+template <typename T, typename Op, bool kStream>
+void ReduceNScaled(void* dst, const void* const* srcs, int num, size_t len, double scale,
+                   std::false_type) {
+    scalar::ReduceN<T, Op>(dst, srcs, num, len, scale);
+}
+
+template <typename T, typename Op, bool kStream>
+void ReduceN(void* dst, const void* const* srcs, int num, size_t len, double scale) {
+    if (scale == 1.0) {
+        ReduceNBody<T, Op, kStream>(dst, srcs, num, len, Unscaled());
+    } else {
+        ReduceNScaled<T, Op, kStream>(dst, srcs, num, len, scale, std::is_floating_point<T>());
+    }
+}
+
+template <typename H, typename Op, bool kStream>
+void ReduceNHalf(void* dst, const void* const* srcs, int num, size_t len, double scale) {
+    if (scale == 1.0) {
+        ReduceNHalfBody<H, Op, kStream>(dst, srcs, num, len, Unscaled());
+    } else {
+        ReduceNHalfBody<H, Op, kStream>(dst, srcs, num, len, Scaled<float>(scale));
+    }
+}
+
+template <typename T, bool kStream>
+void Scale(void* dst, const void* src, size_t len, double factor) {
+    auto d = (T*) dst;
+    auto s = (const T*) src;
+    size_t n = len / sizeof(T);
+    const size_t w = 64 / sizeof(T);
+    const T f = (T) factor;
+    const auto vf = Ops<T>::set1(f);
+    size_t i = 0;
+    for (size_t prefix = AlignedPrefix<kStream>(d, n, 64); i < prefix; ++i) {
+        d[i] = s[i] * f;
+    }
+    for (; i + w <= n; i += w) {
+        Store<kStream>(d + i, Ops<T>::apply(OpProd(), Ops<T>::load(s + i), vf));
+    }
+    for (; i < n; ++i) {
+        d[i] = s[i] * f;
+    }
+    if (kStream) _mm_sfence();
+}
+
+template <typename H, bool kStream>
+void ScaleHalf(void* dst, const void* src, size_t len, double factor) {
+    auto d = (uint16_t*) dst;
+    auto s = (const uint16_t*) src;
+    size_t n = len / 2;
+    const float f = (float) factor;
+    const auto vf = Ops<float>::set1(f);
+    size_t i = 0;
+    for (size_t prefix = AlignedPrefix<kStream>(d, n, H::align); i < prefix; ++i) {
+        d[i] = H::from_float(H::to_float(s[i]) * f);
+    }
+    for (; i + H::width <= n; i += H::width) {
+        H::template store<kStream>(d + i, Ops<float>::apply(OpProd(), H::load(s + i), vf));
+    }
+    for (; i < n; ++i) {
+        d[i] = H::from_float(H::to_float(s[i]) * f);
+    }
+    if (kStream) _mm_sfence();
+}
+
+template <typename T, typename Op, bool kStream>
+SimdReduceKernel PickReduce(std::true_type) { return Reduce<T, Op, kStream>; }
+
+template <typename T, typename Op, bool kStream>
+SimdReduceKernel PickReduce(std::false_type) { return scalar::Reduce<T, Op>; }
+
+template <typename T, typename Op, bool kStream>
+SimdReduceNKernel PickReduceN(std::true_type) { return ReduceN<T, Op, kStream>; }
+
+template <typename T, typename Op, bool kStream>
+SimdReduceNKernel PickReduceN(std::false_type) { return scalar::ReduceN<T, Op>; }
+
+template <typename Op, bool kStream>
+SimdReduceKernel ReduceKernel(DataType dtype) {
+    switch (dtype) {
+        case BYTEPS_FLOAT32: return PickReduce<float, Op, kStream>(HasVec<float, Op>());
+        case BYTEPS_FLOAT64: return PickReduce<double, Op, kStream>(HasVec<double, Op>());
+        case BYTEPS_FLOAT16: return ReduceHalf<Float16, Op, kStream>;
+        case BYTEPS_BFLOAT16: return ReduceHalf<BFloat16, Op, kStream>;
+        case BYTEPS_UINT8:
+            return PickReduce<unsigned char, Op, kStream>(HasVec<unsigned char, Op>());
+        case BYTEPS_INT32: return PickReduce<int, Op, kStream>(HasVec<int, Op>());
+        case BYTEPS_INT8: return PickReduce<signed char, Op, kStream>(HasVec<signed char, Op>());
+        case BYTEPS_INT64: return PickReduce<long long, Op, kStream>(HasVec<long long, Op>());
+        default: return nullptr;
+    }
+}
+
+template <typename Op, bool kStream>
+SimdReduceNKernel ReduceNKernel(DataType dtype) {
+    switch (dtype) {
+        case BYTEPS_FLOAT32: return PickReduceN<float, Op, kStream>(HasVec<float, Op>());
+        case BYTEPS_FLOAT64: return PickReduceN<double, Op, kStream>(HasVec<double, Op>());
+        case BYTEPS_FLOAT16: return ReduceNHalf<Float16, Op, kStream>;
+        case BYTEPS_BFLOAT16: return ReduceNHalf<BFloat16, Op, kStream>;
+        case BYTEPS_UINT8:
+            return PickReduceN<unsigned char, Op, kStream>(HasVec<unsigned char, Op>());
+        case BYTEPS_INT32: return PickReduceN<int, Op, kStream>(HasVec<int, Op>());
+        case BYTEPS_INT8: return PickReduceN<signed char, Op, kStream>(HasVec<signed char, Op>());
+        case BYTEPS_INT64: return PickReduceN<long long, Op, kStream>(HasVec<long long, Op>());
+        default: return nullptr;
+    }
+}
+
+// integers have no vector conversion to double here and use scalar::
+template <bool kStream>
+SimdScaleKernel ScaleKernel(DataType dtype) {
+    switch (dtype) {
+        case BYTEPS_FLOAT32: return Scale<float, kStream>;
+        case BYTEPS_FLOAT64: return Scale<double, kStream>;
+        case BYTEPS_FLOAT16: return ScaleHalf<Float16, kStream>;
+        case BYTEPS_BFLOAT16: return ScaleHalf<BFloat16, kStream>;
+        default: return scalar::ScaleKernel(dtype);
+    }
+}
+
+} // namespace avx512
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+
+static SimdLevel DetectSimdLevel() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return SIMD_SCALAR;
+    bool osxsave = ecx & (1u << 27);
+    bool avx = ecx & (1u << 28);
+    bool f16c = ecx & (1u << 29);
+    if (!(osxsave && avx && f16c)) return SIMD_SCALAR;
+
+    // the OS must save the YMM (and for AVX-512 also the opmask/ZMM) state
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 0x6) != 0x6) return SIMD_SCALAR;
+
+    if (__get_cpuid_max(0, nullptr) < 7) return SIMD_SCALAR;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    bool avx2 = ebx & (1u << 5);
+    bool avx512f = ebx & (1u << 16);
+    bool avx512bw = ebx & (1u << 30);
+    if (!avx2) return SIMD_SCALAR;
+    if (avx512f && avx512bw && (xcr0_lo & 0xe6) == 0xe6) return SIMD_AVX512;
+    return SIMD_AVX2;
+}
+
+#else
+
+static SimdLevel DetectSimdLevel() { return SIMD_SCALAR; }
+
+#endif // BYTEPS_SIMD_X86
+
+SimdLevel GetSimdLevel() {
+    static SimdLevel level = [] {
+        auto l = DetectSimdLevel();
+        auto cap = getenv("BYTEPS_CPU_REDUCER_SIMD");
+        if (cap && atoi(cap) < l) l = (SimdLevel) atoi(cap);
+        if (l < SIMD_SCALAR) l = SIMD_SCALAR;
+        BPS_LOG(DEBUG) << "CpuReducer SIMD level=" << l;
+        return l;
+    }();
+    return level;
+}
+
+
+template <typename Op>
+static SimdReduceKernel ReduceKernelOf(SimdLevel level, DataType dtype, bool stream) {
+#ifdef BYTEPS_SIMD_X86
+    if (level == SIMD_AVX512) {
+        return stream ? avx512::ReduceKernel<Op, true>(dtype) : avx512::ReduceKernel<Op, false>(dtype);
+    }
+    if (level == SIMD_AVX2) {
+        return stream ? avx2::ReduceKernel<Op, true>(dtype) : avx2::ReduceKernel<Op, false>(dtype);
+    }
+#endif
+    return scalar::ReduceKernel<Op>(dtype);
+}
+
+template <typename Op>
+static SimdReduceNKernel ReduceNKernelOf(SimdLevel level, DataType dtype, bool stream) {
+#ifdef BYTEPS_SIMD_X86
+    if (level == SIMD_AVX512) {
+        return stream ? avx512::ReduceNKernel<Op, true>(dtype) : avx512::ReduceNKernel<Op, false>(dtype);
+    }
+    if (level == SIMD_AVX2) {
+        return stream ? avx2::ReduceNKernel<Op, true>(dtype) : avx2::ReduceNKernel<Op, false>(dtype);
+    }
+#endif
+    return scalar::ReduceNKernel<Op>(dtype);
+}
+
+SimdReduceKernel GetSimdReduceKernel(SimdLevel level, DataType dtype, ReduceOp op, bool stream) {
+    switch (op) {
+        case BYTEPS_OP_SUM:
+        case BYTEPS_OP_AVERAGE: return ReduceKernelOf<OpSum>(level, dtype, stream);
+        case BYTEPS_OP_MAX: return ReduceKernelOf<OpMax>(level, dtype, stream);
+        case BYTEPS_OP_MIN: return ReduceKernelOf<OpMin>(level, dtype, stream);
+        case BYTEPS_OP_PRODUCT: return ReduceKernelOf<OpProd>(level, dtype, stream);
+        default: return nullptr;
+    }
+}
+
+SimdReduceNKernel GetSimdReduceNKernel(SimdLevel level, DataType dtype, ReduceOp op, bool stream) {
+    switch (op) {
+        case BYTEPS_OP_SUM:
+        case BYTEPS_OP_AVERAGE: return ReduceNKernelOf<OpSum>(level, dtype, stream);
+        case BYTEPS_OP_MAX: return ReduceNKernelOf<OpMax>(level, dtype, stream);
+        case BYTEPS_OP_MIN: return ReduceNKernelOf<OpMin>(level, dtype, stream);
+        case BYTEPS_OP_PRODUCT: return ReduceNKernelOf<OpProd>(level, dtype, stream);
+        default: return nullptr;
+    }
+}
+
+SimdScaleKernel GetSimdScaleKernel(SimdLevel level, DataType dtype, bool stream) {
+#ifdef BYTEPS_SIMD_X86
+    if (level == SIMD_AVX512) {
+        return stream ? avx512::ScaleKernel<true>(dtype) : avx512::ScaleKernel<false>(dtype);
+    }
+    if (level == SIMD_AVX2) {
+        return stream ? avx2::ScaleKernel<true>(dtype) : avx2::ScaleKernel<false>(dtype);
+    }
+#endif
+    return scalar::ScaleKernel(dtype);
+}
+
+} // namespace common
+} // namespace byteps
@@ -0,0 +1,137 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+
+#ifndef BYTEPS_CPU_REDUCER_SIMD_H
+#define BYTEPS_CPU_REDUCER_SIMD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "common.h"
+
+namespace byteps {
+namespace common {
+
+enum SimdLevel { SIMD_SCALAR = 0, SIMD_AVX2 = 1, SIMD_AVX512 = 2 };
+
+// dst = src1 op src2 over len bytes, single threaded. dst may alias src1.
+typedef void (*SimdReduceKernel)(void* dst, const void* src1, const void* src2, size_t len);
+
+// dst = (srcs[0] op ... op srcs[n-1]) * scale over len bytes in one pass,
+// single threaded. dst may alias any of srcs. fp16/bf16 accumulate and scale
+// in fp32 and round once; integers are scaled as by SimdScaleKernel.
+typedef void (*SimdReduceNKernel)(void* dst, const void* const* srcs, int n, size_t len,
+                                  double scale);
+
+// dst = src * factor over len bytes, single threaded. dst may alias src.
+// Integers are scaled in double precision and truncated.
+typedef void (*SimdScaleKernel)(void* dst, const void* src, size_t len, double factor);
+
+// The best level supported by both the CPU (via CPUID/XGETBV) and the OS,
+// capped by BYTEPS_CPU_REDUCER_SIMD if set
+SimdLevel GetSimdLevel();
+
+// Kernels of the given level, or the portable loops if the level has no
+// instruction for the dtype/op (e.g. 8-bit products). nullptr only for
+// unsupported dtypes or ops. BYTEPS_OP_AVERAGE reduces as BYTEPS_OP_SUM,
+// the division is left to a scale kernel. With stream, the vector kernels
+// write dst with non-temporal stores that bypass the caches.
+SimdReduceKernel GetSimdReduceKernel(SimdLevel level, DataType dtype, ReduceOp op,
+                                     bool stream = false);
+SimdReduceNKernel GetSimdReduceNKernel(SimdLevel level, DataType dtype, ReduceOp op,
+                                       bool stream = false);
+SimdScaleKernel GetSimdScaleKernel(SimdLevel level, DataType dtype, bool stream = false);
+
+// Scalar IEEE 754 half <-> float conversions, bit-exact with F16C
+// (denormals, Inf and quieted NaN included, round to nearest even).
+// Used by the scalar fallback and as the reference for the kernels.
+inline float HalfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0x1f) { // Inf or NaN
+        bits = sign | 0x7f800000 | (mant << 13) | (mant ? 0x400000 : 0);
+    } else if (exp == 0) {
+        if (mant == 0) { // signed zero
+            bits = sign;
+        } else { // denormal, normalize it
+            exp = 127 - 15 + 1;
+            while (!(mant & 0x400)) {
+                mant <<= 1;
+                exp--;
+            }
+            bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+        }
+    } else {
+        bits = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+inline uint16_t FloatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t absx = x & 0x7fffffff;
+    if (absx >= 0x7f800000) { // Inf or NaN
+        return sign | 0x7c00 | (absx > 0x7f800000 ? (0x200 | ((absx >> 13) & 0x3ff)) : 0);
+    }
+    if (absx >= 0x477ff000) { // rounds to above 65504
+        return sign | 0x7c00;
+    }
+    if (absx < 0x38800000) { // below 2^-14, the result is denormal or zero
+        int e = absx >> 23;
+        if (e < 102) return sign;
+        uint32_t mant = (absx & 0x7fffff) | 0x800000;
+        int shift = 126 - e;
+        uint32_t h = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t half = 1u << (shift - 1);
+        if (rem > half || (rem == half && (h & 1))) h++;
+        return sign | h;
+    }
+    uint32_t h = (absx >> 13) - ((127 - 15) << 10);
+    uint32_t rem = absx & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return sign | h;
+}
+
+// bfloat16 is the upper half of a float
+inline float BFloat16ToFloat(uint16_t b) {
+    uint32_t bits = (uint32_t) b << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// Round to nearest even, NaN stays a (quiet) NaN
+inline uint16_t FloatToBFloat16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7fffffff) > 0x7f800000) {
+        return (x >> 16) | 0x40;
+    }
+    x += 0x7fff + ((x >> 16) & 1);
+    return x >> 16;
+}
+
+} // namespace common
+} // namespace byteps
+
+#endif // BYTEPS_CPU_REDUCER_SIMD_H
@@ -0,0 +1,160 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "executor.h"
+#include "logging.h"
+
+namespace byteps {
+namespace common {
+
+thread_local bool BytePSExecutor::_is_worker = false;
+thread_local bool BytePSExecutor::_stage_idle = false;
+
+BytePSExecutor::BytePSExecutor(int num_threads, const std::vector<int> &cores,
+                               std::function<void()> thread_init) {
+    BPS_CHECK_GT(num_threads, 0);
+    for (int i = 0; i < num_threads; i++) {
+        std::unique_ptr<Worker> w(new Worker);
+        w->busy = false;
+        w->thread = nullptr;
+        _workers.push_back(std::move(w));
+    }
+    _cores = cores;
+    _thread_init = thread_init;
+    _notifier = std::make_shared<TaskNotifier>();
+    _should_stop = false;
+}
+
+BytePSExecutor::~BytePSExecutor() {
+    Stop();
+    BPS_LOG(DEBUG) << "Clear BytePSExecutor";
+}
+
+void BytePSExecutor::AddStage(StageFunction stage, int affinity) {
+    PushStage(affinity % _workers.size(), stage);
+}
+
+void BytePSExecutor::Start() {
+    for (size_t i = 0; i < _workers.size(); i++) {
+        _workers[i]->thread = new std::thread(&BytePSExecutor::WorkerLoop, this, i);
+    }
+    BPS_LOG(DEBUG) << "Started executor with " << _workers.size() << " threads";
+}
+
+void BytePSExecutor::Stop() {
+    _should_stop = true;
+    _notifier->notify();
+    for (auto &w : _workers) {
+        if (w->thread && w->thread->joinable()) {
+            w->thread->join();
+            delete w->thread;
+            w->thread = nullptr;
+        }
+    }
+}
+
+void BytePSExecutor::PushStage(int index, StageFunction stage) {
+    std::lock_guard<std::mutex> lock(_workers[index]->mu);
+    _workers[index]->stages.push_back(stage);
+}
+
+bool BytePSExecutor::PopStage(int index, StageFunction* stage) {
+    std::lock_guard<std::mutex> lock(_workers[index]->mu);
+    if (_workers[index]->stages.empty()) return false;
+    *stage = _workers[index]->stages.front();
+    _workers[index]->stages.pop_front();
+    return true;
+}
+
+bool BytePSExecutor::StealStage(int index, StageFunction* stage) {
+    // only steal from workers that are running a stage right now,
+    // i.e., stages that would otherwise wait behind it
+    for (size_t i = 1; i < _workers.size(); i++) {
+        auto &victim = _workers[(index + i) % _workers.size()];
+        if (!victim->busy) continue;
+        std::lock_guard<std::mutex> lock(victim->mu);
+        if (victim->stages.empty()) continue;
+        *stage = victim->stages.back();
+        victim->stages.pop_back();
+        return true;
+    }
+    return false;
+}
+
+size_t BytePSExecutor::OwnedStages(int index) {
+    std::lock_guard<std::mutex> lock(_workers[index]->mu);
+    return _workers[index]->stages.size();
+}
+
+void BytePSExecutor::WorkerLoop(int index) {
+    _is_worker = true;
+    if (_cores.size()) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(_cores[index % _cores.size()], &cpuset);
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+        if (rc) {
+            BPS_LOG(WARNING) << "Failed to pin executor thread " << index
+                             << " to core " << _cores[index % _cores.size()];
+        }
+    }
+    if (_thread_init) _thread_init();
+
+    auto &me = _workers[index];
+    size_t idle_runs = 0;
+    uint64_t seen = 0;
+    while (!_should_stop) {
+        if (!idle_runs) {
+            seen = _notifier->version();
+        }
+        StageFunction stage;
+        if (!PopStage(index, &stage)) {
+            if (!StealStage(index, &stage)) {
+                _notifier->wait(seen);
+                idle_runs = 0;
+                continue;
+            }
+        }
+
+        me->busy = true;
+        _stage_idle = false;
+        stage();
+        me->busy = false;
+        PushStage(index, stage);
+
+        if (!_stage_idle) {
+            idle_runs = 0;
+            continue;
+        }
+        // every stage we own found nothing to do since we read seen
+        if (++idle_runs >= OwnedStages(index)) {
+            if (StealStage(index, &stage)) {
+                // the stolen stage has not run since we read seen, so sweep
+                // again before parking, or its work waits for the timeout
+                PushStage(index, stage);
+                idle_runs = 0;
+                continue;
+            }
+            _notifier->wait(seen);
+            idle_runs = 0;
+        }
+    }
+}
+
+} // namespace common
+} // namespace byteps
@@ -0,0 +1,88 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_EXECUTOR_H
+#define BYTEPS_EXECUTOR_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "task_notifier.h"
+
+namespace byteps {
+namespace common {
+
+// One iteration of a core loop stage, e.g., RunPushLoopOnce()
+typedef bool (*StageFunction)();
+
+// Runs the non-blocking core loop stages on a small pool of (optionally
+// core-pinned) threads instead of one dedicated thread per stage.
+// Each stage is owned by exactly one worker at a time, so a stage never runs
+// concurrently with itself. Workers round-robin over the stages they own and
+// steal the stages queued behind a busy worker when their own are idle, so a
+// slow stage does not hold back the others.
+class BytePSExecutor {
+
+public:
+    BytePSExecutor(int num_threads, const std::vector<int> &cores,
+                   std::function<void()> thread_init);
+    ~BytePSExecutor();
+
+    // affinity is a hint for the initial owner, taken modulo the pool size
+    void AddStage(StageFunction stage, int affinity);
+    void Start();
+    void Stop();
+
+    // Queues feeding the stages must notify this to wake up parked workers
+    std::shared_ptr<TaskNotifier> GetNotifier() { return _notifier; }
+
+    // Called by a stage that found nothing to do, instead of blocking
+    static bool IsWorkerThread() { return _is_worker; }
+    static void ReportIdle() { _stage_idle = true; }
+
+private:
+    struct Worker {
+        std::mutex mu;
+        std::deque<StageFunction> stages;
+        std::atomic<bool> busy;
+        std::thread* thread;
+    };
+
+    void WorkerLoop(int index);
+    bool PopStage(int index, StageFunction* stage);
+    bool StealStage(int index, StageFunction* stage);
+    void PushStage(int index, StageFunction stage);
+    size_t OwnedStages(int index);
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<int> _cores;
+    std::function<void()> _thread_init;
+    std::shared_ptr<TaskNotifier> _notifier;
+    std::atomic<bool> _should_stop;
+
+    static thread_local bool _is_worker;
+    static thread_local bool _stage_idle;
+};
+
+
+} // namespace common
+} // namespace byteps
+
+#endif // BYTEPS_EXECUTOR_H
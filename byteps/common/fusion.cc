@@ -0,0 +1,295 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <algorithm>
+#include <sstream>
+
+#include "fusion.h"
+#include "global.h"
+#include "logging.h"
+#include "operations.h"
+
+namespace byteps {
+namespace common {
+
+namespace {
+
+// The fused tensor as the stages see it
+class FusionTensor : public Tensor {
+
+public:
+    FusionTensor(DataType dtype, void* data, size_t size)
+        : _dtype(dtype), _data(data), _size(size) {}
+
+    const DataType dtype() const { return _dtype; }
+    const TensorShape shape() const {
+        TensorShape shape;
+        shape.AddDim(_size / getDataTypeLength(_dtype));
+        return shape;
+    }
+    const void* data() const { return _data; }
+    int64_t size() const { return _size; }
+
+private:
+    DataType _dtype;
+    void* _data;
+    size_t _size;
+};
+
+// Ready once the inputs of all members are
+class FusionReadyEvent : public ReadyEvent {
+
+public:
+    FusionReadyEvent(std::vector<std::shared_ptr<ReadyEvent>> events)
+        : _events(std::move(events)) {}
+
+    bool Ready() const {
+        for (auto &event : _events) {
+            if (!event->Ready()) return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<std::shared_ptr<ReadyEvent>> _events;
+};
+
+} // namespace
+
+std::mutex BytePSFusion::_mutex;
+size_t BytePSFusion::_threshold = 0;
+size_t BytePSFusion::_tensor_bytes = BYTEPS_FUSION_TENSOR_BYTES;
+int BytePSFusion::_timeout_sec = 60;
+bool BytePSFusion::_planned = false;
+std::vector<std::unique_ptr<BytePSFusionGroup>> BytePSFusion::_groups;
+std::unique_ptr<std::thread> BytePSFusion::_watcher;
+std::condition_variable BytePSFusion::_watcher_cv;
+bool BytePSFusion::_should_stop = false;
+
+void BytePSFusion::Init() {
+    _threshold = getenv("BYTEPS_FUSION_THRESHOLD") ?
+                 atoll(getenv("BYTEPS_FUSION_THRESHOLD")) : 0;
+    _tensor_bytes = getenv("BYTEPS_FUSION_TENSOR_BYTES") ?
+                    atoll(getenv("BYTEPS_FUSION_TENSOR_BYTES")) : BYTEPS_FUSION_TENSOR_BYTES;
+    _timeout_sec = getenv("BYTEPS_FUSION_TIMEOUT_SEC") ?
+                   atoi(getenv("BYTEPS_FUSION_TIMEOUT_SEC")) : 60;
+    if (IsEnabled()) {
+        BPS_LOG(DEBUG) << "Tensor fusion enabled, threshold=" << _threshold
+                       << " bytes, tensors up to " << _tensor_bytes << " bytes"
+                       << ", timeout=" << _timeout_sec << "s";
+    }
+}
+
+void BytePSFusion::Shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _should_stop = true;
+    }
+    _watcher_cv.notify_all();
+    if (_watcher && _watcher->joinable()) {
+        _watcher->join();
+    }
+    _watcher.reset();
+}
+
+void BytePSFusion::WatchLoop() {
+    auto timeout = std::chrono::seconds(_timeout_sec);
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_should_stop) {
+        _watcher_cv.wait_for(lock, std::chrono::seconds(1));
+        auto now = std::chrono::steady_clock::now();
+        for (auto &group : _groups) {
+            if (group->counts.empty() || now - group->since.front() < timeout) continue;
+            std::stringstream missing;
+            auto &round = group->rounds.front();
+            for (size_t i = 0; i < round.size(); ++i) {
+                if (!round[i]) missing << " " << group->members[i]->tensor_name;
+            }
+            BPS_CHECK(0) << group->context->tensor_name << " waited more than " << _timeout_sec
+                         << "s for" << missing.str() << ", all tensors of a fusion buffer must be"
+                         << " pushed in every round, see BYTEPS_FUSION_TIMEOUT_SEC";
+        }
+    }
+}
+
+bool BytePSFusion::IsFusible(size_t size, bool on_cpu) {
+#ifndef BYTEPS_CPU_ONLY
+    // the fusion buffer is on the GPU, and CPU tensors are rare anyway
+    if (on_cpu) return false;
+#endif
+    return IsEnabled() && size <= _tensor_bytes && size < _threshold;
+}
+
+Status BytePSFusion::Fuse(std::shared_ptr<TensorTableEntry>& entry) {
+    if (!IsEnabled()) {
+        return Status::OK();
+    }
+    auto &context = *entry->context;
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_planned) {
+        // the first two rounds are not fused, see fusion.h
+        if (++context.enqueues < 3) {
+            return Status::OK();
+        }
+        Plan(entry->device);
+        _planned = true;
+        if (_groups.size() && _timeout_sec > 0) {
+            _watcher.reset(new std::thread(&BytePSFusion::WatchLoop));
+        }
+    }
+    auto group = context.fusion;
+    if (!group) {
+        return Status::OK();
+    }
+
+    // the first round this member has not been enqueued for
+    auto index = context.fusion_index;
+    size_t r = 0;
+    while (r < group->counts.size() && group->rounds[r][index]) {
+        ++r;
+    }
+    if (r == group->counts.size()) {
+        if (r == group->rounds.size()) {
+            group->rounds.emplace_back(group->members.size());
+        }
+        group->counts.push_back(0);
+        group->since.push_back(std::chrono::steady_clock::now());
+    }
+    for (auto &member : group->rounds[r]) {
+        if (member && member->scale != entry->scale) {
+            return Status::InvalidArgument(context.tensor_name +
+                                           ": fused tensors must have the same scale factor");
+        }
+    }
+    group->rounds[r][index] = entry;
+    ++group->counts[r];
+
+    // Members fill their rounds in order, so only the front one can be complete
+    if (group->counts.front() < group->members.size()) {
+        entry = nullptr;
+        return Status::OK();
+    }
+    auto fused_context = group->context.get();
+    auto e = GetTensorEntry(*fused_context);
+    // take the members, and keep the emptied round for reuse
+    e->fused.swap(group->rounds.front());
+    group->rounds.front().resize(group->members.size());
+    std::rotate(group->rounds.begin(), group->rounds.begin() + 1, group->rounds.end());
+    group->counts.erase(group->counts.begin());
+    group->since.erase(group->since.begin());
+    auto &members = e->fused;
+
+    e->tensor = group->buffer;
+    e->output = group->buffer;
+    std::vector<std::shared_ptr<ReadyEvent>> events;
+    for (auto &member : members) {
+        if (member->ready_event) events.push_back(member->ready_event);
+    }
+    if (events.size()) {
+        e->ready_event = std::make_shared<FusionReadyEvent>(std::move(events));
+    }
+    // as urgent as the most urgent member
+    e->priority = members[0]->priority;
+    for (auto &member : members) {
+        e->priority = std::max(e->priority, member->priority);
+    }
+    e->device = entry->device;
+    e->version = entry->version;
+    // the members are called back with the fused entry, see FinishEntry()
+    e->queue_list = entry->queue_list;
+    e->op = group->op;
+    e->scale = entry->scale;
+
+    entry = e;
+    return Status::OK();
+}
+
+void BytePSFusion::Plan(int device) {
+    std::vector<std::unique_ptr<BytePSFusionGroup>> groups;
+    std::unique_ptr<BytePSFusionGroup> group;
+    auto close = [&groups, &group]() {
+        // one member alone gains nothing
+        if (group && group->members.size() > 1) {
+            groups.push_back(std::move(group));
+        }
+        group.reset();
+    };
+
+    // the contexts come in the order of their declared keys
+    for (auto context : BytePSGlobal::GetContexts()) {
+        // in both rounds so far, see fusion.h
+        if (!context->initialized || !context->fusible || context->enqueues < 2) continue;
+        if (group && (context->dtype != group->dtype || context->op != group->op ||
+                      group->size + context->buff_len > _threshold)) {
+            close();
+        }
+        if (!group) {
+            group.reset(new BytePSFusionGroup);
+            group->dtype = context->dtype;
+            group->op = context->op;
+        }
+        group->members.push_back(context);
+        group->size += context->buff_len;
+    }
+    close();
+
+    // declared keys count up from 0, so the fusion buffers take theirs from the top
+    auto first_key = groups.size() ? BytePSGlobal::ReserveDeclaredKeys(groups.size()) : 0;
+    for (size_t i = 0; i < groups.size(); ++i) {
+        auto &g = groups[i];
+        auto context = new BPSContext;
+        context->initialized = false;
+        context->tensor_name = "byteps.fusion." + std::to_string(i);
+        context->declared_key = first_key + i;
+        g->context.reset(context);
+        InitTensor(*context, g->size, g->dtype, nullptr, g->op);
+        g->buffer = CreateBuffer(g.get(), device);
+
+        size_t offset = 0;
+        for (size_t j = 0; j < g->members.size(); ++j) {
+            auto member = g->members[j];
+            member->fusion = g.get();
+            member->fusion_offset = offset;
+            member->fusion_index = j;
+            offset += member->buff_len;
+        }
+        BPS_LOG(DEBUG) << context->tensor_name << " fuses " << g->members.size()
+                       << " tensors from " << g->members.front()->tensor_name
+                       << " to " << g->members.back()->tensor_name
+                       << ", size=" << g->size
+                       << " rank=" << BytePSGlobal::GetLocalRank();
+        _groups.push_back(std::move(g));
+    }
+}
+
+std::shared_ptr<Tensor> BytePSFusion::CreateBuffer(BytePSFusionGroup* group, int device) {
+#ifdef BYTEPS_CPU_ONLY
+    // The stages pack the members into the shared memory and read them
+    // back from there, see CopyDevice2Host() and CopyHost2Device()
+    void* data = group->context->cpubuff;
+#else
+    // lives as long as the process, like the shared memory of the context
+    void* data = nullptr;
+    int current;
+    CUDA_CALL(cudaGetDevice(&current));
+    CUDA_CALL(cudaSetDevice(device));
+    CUDA_CALL(cudaMalloc(&data, group->size));
+    CUDA_CALL(cudaSetDevice(current));
+#endif
+    return std::make_shared<FusionTensor>(group->dtype, data, group->size);
+}
+
+} // namespace common
+} // namespace byteps
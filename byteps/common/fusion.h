@@ -0,0 +1,119 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_FUSION_H
+#define BYTEPS_FUSION_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "common.h"
+
+#define BYTEPS_FUSION_TENSOR_BYTES (64 * 1024)
+
+namespace byteps {
+namespace common {
+
+// Small tensors that are declared next to each other share one fusion
+// buffer, which goes through the stages as one tensor with its own keys.
+//
+// All local ranks and all workers have to agree on the groups, so they are
+// not formed on the fly from what happens to be ready. Instead the groups
+// are planned once, when the first tensor is enqueued for the third time,
+// from the tensors enqueued in both rounds before. That leaves out those
+// pushed once, e.g., the broadcast of the parameters before training. The
+// plan packs the fusible tensors in the order of their declared keys,
+// which is also their priority order, so a group never mixes gradients of
+// far apart layers. The first two rounds are not fused.
+//
+// A group is enqueued when the last of its members is, with the highest
+// priority among them. A member that stops being pushed would hold back
+// the others forever, so a group waiting longer than
+// BYTEPS_FUSION_TIMEOUT_SEC for its members aborts the job.
+struct BytePSFusionGroup {
+    // the fused key range
+    std::unique_ptr<BPSContext> context;
+    std::vector<BPSContext*> members;
+    DataType dtype;
+    ReduceOp op;
+    size_t size = 0;
+    // where the stages find the fused tensor, see BytePSFusion::Plan()
+    std::shared_ptr<Tensor> buffer;
+    // Member entries by round, as a member may run a round ahead of others.
+    // The first counts.size() rounds are pending, the rest are kept for reuse.
+    std::vector<std::vector<std::shared_ptr<TensorTableEntry>>> rounds;
+    std::vector<size_t> counts;
+    // when the first member of each pending round came in
+    std::vector<std::chrono::steady_clock::time_point> since;
+};
+
+class BytePSFusion {
+
+public:
+    static void Init();
+    static void Shutdown();
+    static bool IsEnabled() { return _threshold > 0; }
+    // Whether InitTensor() should consider the tensor for fusion
+    static bool IsFusible(size_t size, bool on_cpu);
+
+    // Takes the entry of a member for the group. Sets entry to the fused
+    // entry once all members are in, to nullptr before, and leaves it alone
+    // for tensors that are not fused.
+    static Status Fuse(std::shared_ptr<TensorTableEntry>& entry);
+
+    // Calls fn for every member overlapping [task->offset, task->offset + task->len)
+    // of the fused tensor, with the member entry, the offset in the member
+    // and the offset in the fused tensor of the overlap, and its length.
+    // A template, as the stages call it for every partition.
+    template <typename F>
+    static void ForEachMember(const std::shared_ptr<TensorTableEntry> &task, F fn) {
+        size_t begin = task->offset;
+        size_t end = begin + task->len;
+        for (auto &member : task->parent->fused) {
+            size_t member_begin = member->context->fusion_offset;
+            size_t member_end = member_begin + member->context->buff_len;
+            size_t b = std::max(begin, member_begin);
+            size_t e = std::min(end, member_end);
+            if (b < e) {
+                fn(member.get(), b - member_begin, b, e - b);
+            }
+        }
+    }
+
+private:
+    static void Plan(int device);
+    static std::shared_ptr<Tensor> CreateBuffer(BytePSFusionGroup* group, int device);
+    // Aborts once a group waited too long for a member, see above
+    static void WatchLoop();
+
+    static std::mutex _mutex;
+    static size_t _threshold;
+    static size_t _tensor_bytes;
+    static int _timeout_sec;
+    static bool _planned;
+    static std::vector<std::unique_ptr<BytePSFusionGroup>> _groups;
+    static std::unique_ptr<std::thread> _watcher;
+    static std::condition_variable _watcher_cv;
+    static bool _should_stop;
+};
+
+} // namespace common
+} // namespace byteps
+
+#endif // BYTEPS_FUSION_H
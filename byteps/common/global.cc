@@ -14,6 +14,10 @@
 // =============================================================================
 
 #include "global.h"
+#include "fusion.h"
+#include <algorithm>
+#include <limits>
+#include <sstream>
 #include <malloc.h>
 #include <unistd.h>
 #include <numa.h>
@@ -36,6 +40,7 @@ BytePSRole BytePSGlobal::_my_role;
 bool BytePSGlobal::_is_root_device;
 bool BytePSGlobal::_is_distributed_job;
 bool BytePSGlobal::_is_cross_pcie_switch;
+int BytePSGlobal::_pcie_switch_size = 1;
 uint32_t BytePSGlobal::_partition_bytes = 4096000;
 
 std::shared_ptr<BytePSComm> BytePSGlobal::_basic_comm;
@@ -45,10 +50,21 @@ std::unordered_map<uint64_t, PSKV> BytePSGlobal::ps_kv_;
 volatile BytePSScheduledQueue* BytePSGlobal::_queues[QueueNum] = {NULL};
 std::mutex BytePSGlobal::_queues_mutex[QueueNum];
 std::vector<std::thread*> BytePSGlobal::_threads;
+std::shared_ptr<BytePSExecutor> BytePSGlobal::_executor;
 
 std::mutex BytePSGlobal::_context_mutex;
-ps::KVWorker<char>* BytePSGlobal::_ps = NULL;
+std::shared_ptr<BytePSBackend> BytePSGlobal::_backend;
+std::shared_ptr<BytePSPartitionPolicy> BytePSGlobal::_partition_policy;
 std::mutex BytePSGlobal::_encode_mutex;
+bool BytePSGlobal::_is_greedy_key_assignment = false;
+int BytePSGlobal::_key_partition_bits = BYTEPS_KEY_PARTITION_BITS;
+int BytePSGlobal::_key_declared_bits = BYTEPS_KEY_DECLARED_BITS;
+std::vector<size_t> BytePSGlobal::_server_bytes;
+std::vector<size_t> BytePSGlobal::_server_keys;
+std::unordered_map<uint64_t, int> BytePSGlobal::_planned_servers;
+std::vector<size_t> BytePSGlobal::_planned_bytes;
+uint64_t BytePSGlobal::_planned_tensors = 0;
+std::vector<size_t> BytePSGlobal::_declared_sizes;
 ReadyTable* BytePSGlobal::_reduce_table;
 ReadyTable* BytePSGlobal::_pcie_reduce_table;
 ReadyTable* BytePSGlobal::_broadcast_table;
@@ -57,9 +73,14 @@ ReadyTable* BytePSGlobal::_push_table;
 ReadyTable* BytePSGlobal::_copy_table;
 std::unordered_map<std::string, BPSContext> BytePSGlobal::_name_to_cxt;
 unsigned int next_key_ = 0;
+// the declared keys from here on are reserved, 0 until the first reservation
+uint64_t reserved_key_ = 0;
+std::shared_ptr<BytePSComm> BytePSGlobal::_signal_comm;
+#ifndef BYTEPS_CPU_ONLY
 cudaStream_t* BytePSGlobal::_copy_device2host_stream;
 cudaStream_t* BytePSGlobal::_copy_host2device_stream;
 std::shared_ptr<NcclManager> BytePSGlobal::_nccl_manager;
+#endif
 std::shared_ptr<CpuReducer> BytePSGlobal::_cpu_reducer;
 
 uint64_t BytePSGlobal::_sample_key = std::numeric_limits<uint64_t>::max();
@@ -84,7 +105,7 @@ void BytePSGlobal::Init() {
         return;
     }
 
-    _basic_comm = std::make_shared<BytePSCommSocket>();
+    _basic_comm = CreateComm();
 
     _basic_comm->init(&_rank, &_size, &_local_rank, &_local_size, &_worker_id, &_my_role);
 
@@ -96,9 +117,9 @@ void BytePSGlobal::Init() {
                    << ", aligned to " << AlignTo(_partition_bytes, (8 * _local_size)) << " bytes";
     // alignment for Reduce-Scatter/All-Gather
     _partition_bytes = AlignTo(_partition_bytes, (8 * _local_size));
+    BytePSFusion::Init();
 
     BPS_CHECK(getenv("DMLC_NUM_WORKER")) << "error: env DMLC_NUM_WORKER not set";
-    BPS_CHECK(getenv("DMLC_NUM_SERVER")) << "error: env DMLC_NUM_SERVER not set";
 
     _num_worker = atoi(getenv("DMLC_NUM_WORKER"));
 
@@ -110,24 +131,45 @@ void BytePSGlobal::Init() {
     BPS_LOG(DEBUG) << "Number of worker=" << _num_worker << ", launching "
                    << (IsDistributed() ? "" : "non-") << "distributed job";
 
+    _partition_policy = CreatePartitionPolicy(_partition_bytes, 8 * _local_size);
+
+    std::string assignment = getenv("BYTEPS_KEY_ASSIGNMENT") ? getenv("BYTEPS_KEY_ASSIGNMENT") : "hash";
+    BPS_CHECK(assignment == "hash" || assignment == "greedy")
+        << "unknown BYTEPS_KEY_ASSIGNMENT " << assignment;
+    _is_greedy_key_assignment = (assignment == "greedy");
+
+    // the workers need not know the server, so BYTEPS_SERVER_MXNET_PATH is a hint only
+    std::string layout = getenv("BYTEPS_KEY_LAYOUT") ? getenv("BYTEPS_KEY_LAYOUT") :
+                         (getenv("BYTEPS_SERVER_MXNET_PATH") ? "mxnet" : "native");
+    BPS_CHECK(layout == "native" || layout == "mxnet") << "unknown BYTEPS_KEY_LAYOUT " << layout;
+    if (layout == "mxnet") {
+        _key_partition_bits = BYTEPS_KEY_MXNET_PARTITION_BITS;
+        _key_declared_bits = BYTEPS_KEY_MXNET_DECLARED_BITS;
+    }
+    BPS_LOG(DEBUG) << "Key layout " << layout << ": " << _key_declared_bits
+                   << " bits of declared key, " << _key_partition_bits << " of partition";
+
     _shm_obj = std::make_shared<BytePSSharedMemory>(); // share memory obj
 
     if (IsDistributed() && _my_role == BytePSRole::LOCAL_ROOT) { // only the root need to do networking
         // init low-level ps implementation
-        _ps = new ps::KVWorker<char>(0, 0);
-        ps::StartAsync(0, "byteps\0");
-        if (!ps::Postoffice::Get()->is_recovery()) {
-            ps::Postoffice::Get()->Barrier(
-                0, ps::kWorkerGroup + ps::kServerGroup + ps::kScheduler);
-        }
+        _backend = CreateBackend();
     }
 
+#ifndef BYTEPS_CPU_ONLY
     // Set to associated GPU
-    CUDA_CALL(cudaSetDevice(_local_rank));
+    SetDevice();
 
     // Init NCCL
     _nccl_manager = std::make_shared<NcclManager>(_basic_comm);
-    _is_cross_pcie_switch = (_local_size > _nccl_manager->GetSize());
+    _pcie_switch_size = _nccl_manager->GetSize();
+    _signal_comm = _nccl_manager->GetSignalComm();
+#else
+    // Without GPUs all local ranks reduce together over shared memory
+    _pcie_switch_size = _local_size;
+    _signal_comm = CreateComm(_basic_comm, std::string("reduce"), std::vector<int>());
+#endif
+    _is_cross_pcie_switch = (_local_size > _pcie_switch_size);
 
     // Bind to NUMA node
     if (_is_cross_pcie_switch) {
@@ -136,8 +178,12 @@ void BytePSGlobal::Init() {
         numa_bind(numa_parse_nodestring(std::to_string(numa_index).c_str()));
     }
 
-    // Init CPU Reducer
-    if (_is_cross_pcie_switch) {
+    // Init CPU Reducer, also used to scale the pulled results
+#ifndef BYTEPS_CPU_ONLY
+    if (_is_cross_pcie_switch || _is_distributed_job) {
+#else
+    {
+#endif
         _cpu_reducer = std::make_shared<CpuReducer>(_basic_comm);
     }
 
@@ -156,12 +202,13 @@ void BytePSGlobal::Init() {
         }
     }
 
-    // ReadyTable for per-PCIe-switch NCCL calls
-    if (_nccl_manager->IsSignalRoot()) {
+    // ReadyTable for per-PCIe-switch NCCL calls, or the shm reduce in CPU-only builds
+    if (IsSignalRoot()) {
         _reduce_table = new ReadyTable(GetPcieSwitchSize()-1, "NCCL_REDUCE");
         _broadcast_table = new ReadyTable(GetPcieSwitchSize()-1, "NCCL_BROADCAST");
     }
 
+#ifndef BYTEPS_CPU_ONLY
     // Create CUDA streams for GPU-CPU copies
     _copy_host2device_stream  = (cudaStream_t*) malloc(sizeof(cudaStream_t) * 1);
     _copy_device2host_stream  = (cudaStream_t*) malloc(sizeof(cudaStream_t) * 1);
@@ -169,6 +216,23 @@ void BytePSGlobal::Init() {
     CUDA_CALL(cudaStreamCreateWithFlags(_copy_device2host_stream, cudaStreamNonBlocking));
     CUDA_CALL(cudaStreamSynchronize(*_copy_host2device_stream));
     CUDA_CALL(cudaStreamSynchronize(*_copy_device2host_stream));
+#endif
+
+    // Optionally run the core loop stages on a shared thread pool
+    if (getenv("BYTEPS_USE_EXECUTOR") && atoi(getenv("BYTEPS_USE_EXECUTOR"))) {
+        int num_threads = getenv("BYTEPS_EXECUTOR_THREADS") ?
+                          atoi(getenv("BYTEPS_EXECUTOR_THREADS")) : 2;
+        std::vector<int> cores;
+        if (getenv("BYTEPS_EXECUTOR_CORES")) {
+            std::stringstream ss(getenv("BYTEPS_EXECUTOR_CORES"));
+            std::string core;
+            while (std::getline(ss, core, ',')) {
+                cores.push_back(atoi(core.c_str()));
+            }
+        }
+        _executor = std::make_shared<BytePSExecutor>(num_threads, cores, &BytePSGlobal::SetDevice);
+        BPS_LOG(DEBUG) << "Using executor with " << num_threads << " threads";
+    }
 
     // Create queues
     for (int i = 0; i < QueueNum; i++) {
@@ -176,6 +240,18 @@ void BytePSGlobal::Init() {
         auto type = static_cast<QueueType>(i);
         BytePSGlobal::CreateScheduledQueue(type);
     }
+    if (_executor) {
+        // any new task may unblock a stage on any executor thread
+        for (int i = 0; i < QueueNum; i++) {
+            GetScheduledQueue(static_cast<QueueType>(i))->setNotifier(_executor->GetNotifier());
+        }
+    }
+#ifndef BYTEPS_CPU_ONLY
+    else if (IsSignalRoot()) {
+        // RootNcclLoop polls both REDUCE and BROADCAST, so let either of them wake it up
+        GetScheduledQueue(BROADCAST)->setNotifier(GetScheduledQueue(REDUCE)->getNotifier());
+    }
+#endif
 
     _initialized = true;
     BPS_LOG(DEBUG) << "Inited rank=" << _rank
@@ -213,6 +289,19 @@ Status BytePSGlobal::CheckInit() {
 
 void BytePSGlobal::Shutdown() {
     _should_shutdown = true;
+    // wake up the parked loops so that they see _should_shutdown
+    for (size_t i = 0; i < QueueNum; i++) {
+        if (_queues[i]) {
+            GetScheduledQueue(static_cast<QueueType>(i))->getNotifier()->notify();
+        }
+    }
+#ifndef BYTEPS_CPU_ONLY
+    _nccl_manager->NotifyGroup();
+#endif
+    if (_executor) {
+        _executor->Stop();
+    }
+    BytePSFusion::Shutdown();
     for (size_t i = 0; i < _threads.size(); i++) {
         if (_threads[i]->joinable()) {
             _threads[i]->join();
@@ -226,13 +315,15 @@ void BytePSGlobal::Shutdown() {
         }
     }
 
-    if (_ps) {
-        ps::Finalize(0, false);
-        delete _ps;
+    if (!_server_bytes.empty()) {
+        LogServerLoad();
     }
+    _backend.reset();
 
+#ifndef BYTEPS_CPU_ONLY
     CUDA_CALL(cudaStreamDestroy(*_copy_device2host_stream));
     CUDA_CALL(cudaStreamDestroy(*_copy_host2device_stream));
+#endif
 
     if (_reduce_table) {
         delete _reduce_table;
@@ -251,10 +342,15 @@ void BytePSGlobal::Shutdown() {
         delete _copy_table;
     }
 
+    _executor.reset();
     _basic_comm.reset();
-    _shm_obj.reset();
+    // the reducer caches where the pages of the shared memory live
     _cpu_reducer.reset();
+    _shm_obj.reset();
+    _signal_comm.reset();
+#ifndef BYTEPS_CPU_ONLY
     _nccl_manager.reset();
+#endif
 
     BPS_LOG(DEBUG) << "Clear all BytePS resources";
     return;
@@ -266,12 +362,27 @@ BPSContext& BytePSGlobal::GetContextFromName(const std::string &name) {
     return _name_to_cxt[name];
 }
 
-bool BytePSGlobal::IsTensorDeclared(const std::string &name) {
+std::vector<BPSContext*> BytePSGlobal::GetContexts() {
+    std::lock_guard<std::mutex> lock(_context_mutex);
+    std::vector<BPSContext*> contexts;
+    for (auto &it : _name_to_cxt) {
+        contexts.push_back(&it.second);
+    }
+    std::sort(contexts.begin(), contexts.end(), [](BPSContext* a, BPSContext* b) {
+        return a->declared_key < b->declared_key;
+    });
+    return contexts;
+}
+
+bool BytePSGlobal::IsTensorDeclared(const std::string &name, size_t size) {
     std::lock_guard<std::mutex> lock(_context_mutex);
     if (_name_to_cxt.find(name) == _name_to_cxt.end()) {
+        BPS_CHECK(!reserved_key_ || next_key_ < reserved_key_) << name << ": too many tensors, the keys from "
+                                               << reserved_key_ << " on are reserved";
         _name_to_cxt[name].initialized = false;
         _name_to_cxt[name].tensor_name = name.c_str(); // disable copy-on-write
         _name_to_cxt[name].declared_key = (ps::Key) next_key_++;
+        _declared_sizes.push_back(size);
         BPS_LOG(DEBUG) << "Declared tensor " << name
                        << ", declared key (not PS key): " << _name_to_cxt[name].declared_key
                        << " rank=" << BytePSGlobal::GetLocalRank();
@@ -284,16 +395,30 @@ PSKV& BytePSGlobal::EncodeDefaultKey(uint64_t key, size_t len) {
     std::lock_guard<std::mutex> lock(_encode_mutex);
     PSKV& pskv = ps_kv_[key];
     if (!pskv.keys.empty()) {
-        BPS_CHECK_EQ(static_cast<size_t>(pskv.size), len)
+        BPS_CHECK_EQ(pskv.size, len)
             << "The value size cannot be changed " << len
             << ". Key is " << key;
     } else {
         auto krs = ps::Postoffice::Get()->GetServerKeyRanges();
         const int num_servers = krs.size();
         BPS_CHECK_GT(num_servers, 0);
-        // send it to a single random picked server
-        int server = (((key >> 16) + key) * 9973) % num_servers;
-        BPS_LOG(DEBUG) << "key " << key << " assigned to server " << server;
+        // the keys go up to 2^48, see GetKeyPartitionBits()
+        BPS_CHECK_LE(num_servers, 1 << 16) << "too many servers for the key space";
+        BPS_CHECK_LE(len, (size_t) std::numeric_limits<int>::max())
+            << "ps-lite lengths are int, key " << key << " is " << len << " bytes";
+        if (_server_bytes.empty()) {
+            _server_bytes.assign(num_servers, 0);
+            _server_keys.assign(num_servers, 0);
+        }
+        int server = _is_greedy_key_assignment ? PlanServer(key, num_servers) : -1;
+        if (server < 0) {
+            // send it to a single random picked server
+            server = (((key >> _key_partition_bits) + key) * 9973) % num_servers;
+        }
+        _server_bytes[server] += len;
+        ++_server_keys[server];
+        BPS_LOG(DEBUG) << "key " << key << " assigned to server " << server
+                       << ", len=" << len << ", server_bytes=" << _server_bytes[server];
         ps::Key ps_key = krs[server].begin() + key;
         BPS_CHECK_LT(ps_key, krs[server].end());
         pskv.keys.push_back(ps_key);
@@ -304,11 +429,72 @@ PSKV& BytePSGlobal::EncodeDefaultKey(uint64_t key, size_t len) {
     return pskv;
 }
 
+// The caller must hold _encode_mutex. Returns -1 for the keys of tensors
+// declared without a size, e.g., the fusion buffers, which are hashed.
+int BytePSGlobal::PlanServer(uint64_t key, int num_servers) {
+    // Inits come in a different order on each worker, e.g., the TF plugin
+    // inits every tensor in a thread of its own, while all workers declare
+    // the same tensors in the same order. So the plan takes the partitions
+    // of each declared tensor in turn to the least loaded server in bytes,
+    // the first one on ties, and depends on the declared tensors up to the
+    // key only, which are all declared by the time the key is encoded.
+    if (_planned_bytes.empty()) {
+        _planned_bytes.assign(num_servers, 0);
+    }
+    uint64_t declared_key = key >> _key_partition_bits;
+    {
+        std::lock_guard<std::mutex> lock(_context_mutex);
+        while (_planned_tensors <= declared_key && _planned_tensors < _declared_sizes.size()) {
+            size_t size = _declared_sizes[_planned_tensors];
+            // the same partitions as InitTensor()
+            size_t bound = size ? _partition_policy->GetPartitionBytes(size) : 0;
+            uint64_t partition_key = _planned_tensors << _key_partition_bits;
+            for (size_t accumulated = 0; accumulated < size; ++partition_key) {
+                size_t len = std::min(bound, size - accumulated);
+                int server = std::min_element(_planned_bytes.begin(), _planned_bytes.end())
+                             - _planned_bytes.begin();
+                _planned_bytes[server] += len;
+                _planned_servers[partition_key] = server;
+                accumulated += len;
+            }
+            ++_planned_tensors;
+        }
+    }
+    auto it = _planned_servers.find(key);
+    return (it == _planned_servers.end()) ? -1 : it->second;
+}
+
+void BytePSGlobal::LogServerLoad() {
+    std::lock_guard<std::mutex> lock(_encode_mutex);
+    size_t total = 0, most = 0;
+    std::stringstream ss;
+    for (size_t i = 0; i < _server_bytes.size(); ++i) {
+        total += _server_bytes[i];
+        most = std::max(most, _server_bytes[i]);
+        ss << " server " << i << ": " << _server_bytes[i] << " bytes in "
+           << _server_keys[i] << " keys,";
+    }
+    // the busiest server bounds the iteration, 1 is a perfect balance
+    double imbalance = total ? (double) most * _server_bytes.size() / total : 1;
+    BPS_LOG(INFO) << "Server load of " << total << " bytes," << ss.str()
+                  << " max/mean=" << imbalance;
+}
+
 uint32_t BytePSGlobal::GetTensorCount() {
     std::lock_guard<std::mutex> lock(_context_mutex);
     return BytePSGlobal::_name_to_cxt.size();
 }
 
+uint64_t BytePSGlobal::ReserveDeclaredKeys(size_t count) {
+    std::lock_guard<std::mutex> lock(_context_mutex);
+    // All workers declare the same tensors, so they agree on the keys
+    uint64_t top = reserved_key_ ? reserved_key_ : 1ULL << _key_declared_bits;
+    BPS_CHECK_LE(next_key_ + count, top) << "too many tensors to reserve " << count << " keys";
+    reserved_key_ = top - count;
+    return reserved_key_;
+}
+
+#ifndef BYTEPS_CPU_ONLY
 cudaStream_t* BytePSGlobal::GetCopyDevice2HostStream() {
     return BytePSGlobal::_copy_device2host_stream;
 }
@@ -316,6 +502,50 @@ cudaStream_t* BytePSGlobal::GetCopyDevice2HostStream() {
 cudaStream_t* BytePSGlobal::GetCopyHost2DeviceStream() {
     return BytePSGlobal::_copy_host2device_stream;
 }
+#endif
+
+void BytePSGlobal::SetDevice() {
+#ifndef BYTEPS_CPU_ONLY
+    CUDA_CALL(cudaSetDevice(_local_rank));
+#endif
+}
+
+int BytePSGlobal::GetGroupSize() {
+#ifndef BYTEPS_CPU_ONLY
+    return _nccl_manager->GetGroupSize();
+#else
+    // the shm reduce finishes each task before taking the next one
+    return 1;
+#endif
+}
+
+QueueType BytePSGlobal::GetScaleStage(DataType dtype) {
+    // Summing is linear, so any stage that every element passes exactly once
+    // can scale. Prefer those that make a pass over the data anyway.
+    // Integers truncate when scaled, so in distributed jobs they wait for the
+    // full sum to come back from the servers.
+    bool is_integer = dtype == BYTEPS_INT8 || dtype == BYTEPS_UINT8 ||
+                      dtype == BYTEPS_INT32 || dtype == BYTEPS_INT64;
+    if (is_integer && IsDistributed()) {
+        return COPYH2D;
+    }
+#ifdef BYTEPS_CPU_ONLY
+    // every local rank reduces its own slice, see ReduceShmSlice()
+    return REDUCE;
+#else
+    if (IsCrossPcieSwitch()) {
+        return PCIE_REDUCE;
+    }
+    if (_pcie_switch_size > 1 && NcclManager::CanPreMulSum(dtype)) {
+        return REDUCE;
+    }
+    // an extra CPU pass over the pulled data, still off the framework streams
+    if (IsDistributed()) {
+        return COPYH2D;
+    }
+    return QUEUE_NUM_AND_NOT_A_REAL_QUEUE_TYPE_AND_MUST_BE_THE_LAST;
+#endif
+}
 
 
 } // namespace common
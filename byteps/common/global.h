@@ -30,8 +30,13 @@
 #include "scheduled_queue.h"
 #include "ready_table.h"
 #include "shared_memory.h"
+#ifndef BYTEPS_CPU_ONLY
 #include "nccl_manager.h"
+#endif
 #include "cpu_reducer.h"
+#include "executor.h"
+#include "backend.h"
+#include "partition.h"
 #include "ps/ps.h"
 
 namespace byteps {
@@ -39,8 +44,8 @@ namespace common {
 
 struct PSKV {
     ps::SArray<ps::Key> keys;  // n keys
-    ps::SArray<int> lens;  // the length of the i-th value
-    int size;
+    ps::SArray<int> lens;  // the length of the i-th value, one partition fits in int
+    size_t size;
 };
 
 typedef void (*LoopFunction)();
@@ -52,6 +57,8 @@ public:
 
     static void Init();
     static void Start(const std::vector<LoopFunction> &func);
+    static bool UseExecutor() { return _executor != nullptr; }
+    static std::shared_ptr<BytePSExecutor> GetExecutor() { return _executor; }
     static Status CheckInit();
     static bool ShouldShutdown() { return _should_shutdown; }
     static void Shutdown();
@@ -62,9 +69,9 @@ public:
     static int GetLocalSize() { return _local_size; }
     static int GetWorkerID() { return _worker_id; }
     static int GetNumWorker() { return _num_worker; }
-    static int GetPcieSwitchSize() { return _nccl_manager->GetSize(); }
-    static int GetPcieSwitchIndex() { return _local_rank / _nccl_manager->GetSize(); }
-    static int GetPcieSwitchNum() { return _local_size / _nccl_manager->GetSize(); }
+    static int GetPcieSwitchSize() { return _pcie_switch_size; }
+    static int GetPcieSwitchIndex() { return _local_rank / _pcie_switch_size; }
+    static int GetPcieSwitchNum() { return _local_size / _pcie_switch_size; }
     static bool IsRootDevice() { return _is_root_device; }
     static bool IsDistributed() { return _is_distributed_job; }
     static bool IsCrossPcieSwitch() { return _is_cross_pcie_switch; }
@@ -74,20 +81,38 @@ public:
 
     static BytePSScheduledQueue* GetScheduledQueue(QueueType queueType);
     static void CreateScheduledQueue(QueueType queueType);
-    static ps::KVWorker<char>* GetPS() { return _ps; }
+    static std::shared_ptr<BytePSBackend> GetBackend() { return _backend; }
 
-    static bool IsTensorDeclared(const std::string &name);
+    // size in bytes, 0 if unknown yet, see PlanServer()
+    static bool IsTensorDeclared(const std::string &name, size_t size = 0);
     static ps::Key GetKeyFromName(const std::string &name);
     static BPSContext& GetContextFromName(const std::string &name);
+    // All declared tensors, ordered by declared key
+    static std::vector<BPSContext*> GetContexts();
     static uint32_t GetTensorCount();
+    // Takes count declared keys from the top for tensors of our own and
+    // returns the first, see BytePSFusion::Plan()
+    static uint64_t ReserveDeclaredKeys(size_t count);
+
+    // The split of a PS key into declared key and partition, by BYTEPS_KEY_LAYOUT
+    static int GetKeyPartitionBits() { return _key_partition_bits; }
+    static int GetKeyDeclaredBits() { return _key_declared_bits; }
 
     static std::unordered_map<uint64_t, PSKV> ps_kv_;
     static PSKV& EncodeDefaultKey(uint64_t key, size_t len);
+    // Bytes and keys per server so far, at INFO
+    static void LogServerLoad();
 
+    // the largest partition of any tensor
     static uint32_t GetPartitionBound() { return _partition_bytes; }
+    static std::shared_ptr<BytePSPartitionPolicy> GetPartitionPolicy() { return _partition_policy; }
 
+#ifndef BYTEPS_CPU_ONLY
     static cudaStream_t* GetCopyDevice2HostStream();
     static cudaStream_t* GetCopyHost2DeviceStream();
+#endif
+    // Bind the calling thread to the GPU of this process, if there is one
+    static void SetDevice();
 
     // methods to access or modify the _ready_table
     static ReadyTable* GetReduceTable() { return _reduce_table; }
@@ -98,11 +123,23 @@ public:
     // for non-root
     static ReadyTable* GetCopyTable() { return _copy_table; }
 
+    // The comm that REDUCE/BROADCAST are coordinated on, i.e. the signal comm
+    // of NCCL, or the one of all local ranks in CPU-only builds
+    static std::shared_ptr<BytePSComm> GetSignalComm() { return _signal_comm; }
+    static bool IsSignalRoot() { return _signal_comm->getRoot() == _local_rank; }
+    // How many REDUCE/BROADCAST tasks the signal root has in flight at most
+    static int GetGroupSize();
+#ifndef BYTEPS_CPU_ONLY
     static std::shared_ptr<NcclManager> GetNccl() { return _nccl_manager; }
+#endif
     static std::shared_ptr<CpuReducer> GetCpuReducer() { return _cpu_reducer; }
 
     static bool IsTensorSampled(uint64_t key) { return (key == _sample_key); }
 
+    // The one stage that multiplies tasks of dtype by their scale factor, or
+    // QUEUE_NUM_AND_NOT_A_REAL_QUEUE_TYPE_AND_MUST_BE_THE_LAST if none can
+    static QueueType GetScaleStage(DataType dtype);
+
 private:
 
     static std::mutex _init_mutex;
@@ -118,6 +155,7 @@ private:
     static bool _is_root_device;
     static bool _is_distributed_job;
     static bool _is_cross_pcie_switch;
+    static int _pcie_switch_size;
     static BytePSRole _my_role;
     static std::shared_ptr<BytePSComm> _basic_comm;
     static std::shared_ptr<BytePSSharedMemory> _shm_obj;
@@ -125,15 +163,33 @@ private:
     static volatile BytePSScheduledQueue* _queues[QueueNum];
     static std::mutex _queues_mutex[QueueNum];
     static std::vector<std::thread*> _threads;
+    static std::shared_ptr<BytePSExecutor> _executor;
 
     static std::mutex _context_mutex;
 
-    static ps::KVWorker<char>* _ps;
+    static std::shared_ptr<BytePSBackend> _backend;
+    static std::shared_ptr<BytePSPartitionPolicy> _partition_policy;
     static std::mutex _encode_mutex;
+    // whether EncodeDefaultKey() picks the least loaded server rather than hashing
+    static bool _is_greedy_key_assignment;
+    static int _key_partition_bits;
+    static int _key_declared_bits;
+    static std::vector<size_t> _server_bytes;
+    static std::vector<size_t> _server_keys;
+    // The greedy assignment of the partitions of the declared tensors so far,
+    // taken in the order of their declared keys
+    static int PlanServer(uint64_t key, int num_servers);
+    static std::unordered_map<uint64_t, int> _planned_servers;
+    static std::vector<size_t> _planned_bytes;
+    static uint64_t _planned_tensors;
+    // by declared key, guarded by _context_mutex
+    static std::vector<size_t> _declared_sizes;
     static std::unordered_map<std::string, BPSContext> _name_to_cxt;
 
+#ifndef BYTEPS_CPU_ONLY
     static cudaStream_t* _copy_device2host_stream;
     static cudaStream_t* _copy_host2device_stream;
+#endif
 
     static uint32_t _partition_bytes;
 
@@ -146,7 +202,10 @@ private:
     // (key, ready_signal_count) pair, only valid for non-root device
     static ReadyTable* _copy_table;
 
+    static std::shared_ptr<BytePSComm> _signal_comm;
+#ifndef BYTEPS_CPU_ONLY
     static std::shared_ptr<NcclManager> _nccl_manager;
+#endif
     static std::shared_ptr<CpuReducer> _cpu_reducer;
 
     // for debug sampling
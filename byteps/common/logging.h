@@ -45,6 +45,7 @@ enum class LogLevel {
    ? common::LogMessageFatal(__FILE__, __LINE__) << "Check  notnull: " #x << ' ', \
    (x) : (x))  // NOLINT(*)
    
+#ifndef BYTEPS_CPU_ONLY
 /*!
  * \brief Protected CUDA call.
  * \param func Expression to call.
@@ -67,6 +68,7 @@ enum class LogLevel {
   BPS_CHECK(r == ncclSuccess)                      \
     << "NCCL error: " << ncclGetErrorString(r);    \
 }
+#endif // BYTEPS_CPU_ONLY
 
 class LogMessage : public std::basic_ostringstream<char> {
  public:
@@ -14,6 +14,7 @@
 // =============================================================================
 
 #include "nccl_manager.h"
+#include "cpu_reducer_simd.h"
 #include "logging.h"
 #include "global.h"
 
@@ -78,7 +79,7 @@ void NcclManager::ConstructRings() {
         peers.push_back(i);
         log_string = log_string + " " + std::to_string(i);
     }
-    _signal_comm = std::make_shared<BytePSCommSocket>(_global_comm, std::string("nccl"), peers);
+    _signal_comm = CreateComm(_global_comm, std::string("nccl"), peers);
     BPS_LOG(DEBUG) << log_string;
 
     // init and sycn NCCL-reduce-id using out-of-band socket
@@ -156,14 +157,49 @@ void NcclManager::InitGlobalEnv() { // init all global env/param here
     return;
 }
 
+bool NcclManager::CanPreMulSum(DataType dtype) {
+#if defined(NCCL_VERSION_CODE) && NCCL_VERSION_CODE >= 21100
+    return dtype == BYTEPS_FLOAT32 || dtype == BYTEPS_FLOAT64 ||
+           dtype == BYTEPS_FLOAT16 || dtype == BYTEPS_BFLOAT16;
+#else
+    return false;
+#endif
+}
+
+ncclRedOp_t NcclManager::GetPreMulSumOp(ncclComm_t comm, DataType dtype, double scale) {
+    BPS_CHECK(CanPreMulSum(dtype)) << "PreMulSum is not available for data type " << dtype;
+#if defined(NCCL_VERSION_CODE) && NCCL_VERSION_CODE >= 21100
+    std::lock_guard<std::mutex> lock(_premul_mutex);
+    auto key = std::make_tuple(comm, (int) dtype, scale);
+    auto it = _premul_ops.find(key);
+    if (it != _premul_ops.end()) {
+        return it->second;
+    }
+    float f = scale;
+    double d = scale;
+    uint16_t h = (dtype == BYTEPS_FLOAT16) ? FloatToHalf(f) : FloatToBFloat16(f);
+    void* scalar = (dtype == BYTEPS_FLOAT32) ? (void*) &f :
+                   (dtype == BYTEPS_FLOAT64) ? (void*) &d : (void*) &h;
+    ncclRedOp_t op;
+    NCCLCHECK(ncclRedOpCreatePreMulSum(&op, scalar, getNcclDataType(dtype),
+                                       ncclScalarHostImmediate, comm));
+    _premul_ops[key] = op;
+    return op;
+#else
+    return ncclSum;
+#endif
+}
+
 void NcclManager::EnqueueGroup(std::shared_ptr<NcclGroupEntry> e) {
     std::lock_guard<std::mutex> lock(_nccl_mutex);
     _nccl_pipeline.push(e);
+    _nccl_notifier.notify();
     return;
 }
 
 std::shared_ptr<NcclGroupEntry> NcclManager::DequeueGroup() {
     std::lock_guard<std::mutex> lock(_nccl_mutex);
+    _nccl_seen_version = _nccl_notifier.version();
     if (!_nccl_pipeline.size()) {
         return nullptr;
     }
@@ -17,11 +17,14 @@
 #define BYTEPS_NCCL_MANAGER_H
 
 #include <vector>
+#include <map>
 #include <memory>
 #include <queue>
+#include <tuple>
 #include "common.h"
 #include "scheduled_queue.h"
 #include "communicator.h"
+#include "task_notifier.h"
 
 namespace byteps {
 namespace common {
@@ -70,6 +73,9 @@ public:
     int GetGroupSize() { return _nccl_group_size; }
     void EnqueueGroup(std::shared_ptr<NcclGroupEntry> e);
     std::shared_ptr<NcclGroupEntry> DequeueGroup();
+    // Park until a group is enqueued after the last DequeueGroup()
+    void WaitGroup() { _nccl_notifier.wait(_nccl_seen_version); }
+    void NotifyGroup() { _nccl_notifier.notify(); }
 
     virtual cudaStream_t GetStream(uint64_t key, QueueType op);
     virtual ncclComm_t GetComm(uint64_t key, QueueType op);
@@ -79,6 +85,12 @@ public:
     int GetSize() { return _nccl_size; }
     std::shared_ptr<BytePSComm> GetSignalComm() { return _signal_comm; }
     bool IsSignalRoot();
+
+    // Whether PreMulSum can scale dtype, which takes NCCL >= 2.11 and a
+    // floating point type (the scalar has the type of the data)
+    static bool CanPreMulSum(DataType dtype);
+    // ncclSum that first multiplies every input by scale, created once per comm/dtype/scale
+    ncclRedOp_t GetPreMulSumOp(ncclComm_t comm, DataType dtype, double scale);
     
 
 protected:
@@ -100,10 +112,15 @@ protected:
     // for pipelining nccl
     std::mutex _nccl_mutex;
     std::queue<std::shared_ptr<NcclGroupEntry>> _nccl_pipeline;
+    TaskNotifier _nccl_notifier;
+    uint64_t _nccl_seen_version = 0;
 
     std::shared_ptr<BytePSComm> _signal_comm;
     std::shared_ptr<BytePSComm> _global_comm;
 
+    std::mutex _premul_mutex;
+    std::map<std::tuple<ncclComm_t, int, double>, ncclRedOp_t> _premul_ops;
+
 };
 
 class NcclManagerExpr : public NcclManager {
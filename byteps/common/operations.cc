@@ -16,12 +16,15 @@
 #include <cstring>
 #include <memory>
 #include <thread>
+#ifndef BYTEPS_CPU_ONLY
 #include <cuda_runtime.h>
+#endif
 
 #include "logging.h"
 #include "operations.h"
 #include "core_loops.h"
 #include "global.h"
+#include "fusion.h"
 
 namespace byteps {
 namespace common {
@@ -34,46 +37,90 @@ void byteps_init() {
     // The order of func does not matter
     std::vector<LoopFunction> func;
 
+    // Non-blocking stages may share the executor threads instead,
+    // the affinity groups network, copy and NCCL stages respectively
+    auto executor = BytePSGlobal::GetExecutor();
+    auto add_stage = [&func, executor](LoopFunction loop, StageFunction once, int affinity) {
+        if (executor) {
+            executor->AddStage(once, affinity);
+        }
+        else {
+            func.push_back(loop);
+        }
+    };
+
     // Push & Pull in distirbuted mode
     if (BytePSGlobal::IsDistributed()) {
         if (BytePSGlobal::IsRootDevice()) {
-            func.push_back(PullLoop);
+            add_stage(PullLoop, RunPullLoopOnce, 0);
         }
     }
 
+#ifdef BYTEPS_CPU_ONLY
+    // Copy into and out of shared memory, with PUSH as a real push in
+    // distributed mode or a barrier before reading the reduced result
+    add_stage(CopyDevice2HostLoop, RunCopyDevice2HostLoopOnce, 1);
+    if (BytePSGlobal::IsRootDevice()) {
+        add_stage(PushLoop, RunPushLoopOnce, 0);
+        add_stage(RootCopyHost2DeviceLoop, RunRootCopyHost2DeviceLoopOnce, 1);
+    }
+    else {
+        add_stage(CoordinatePushLoop, RunCoordinatePushLoopOnce, 0);
+        add_stage(NonRootCopyHost2DeviceLoop, RunNonRootCopyHost2DeviceLoopOnce, 1);
+        // blocks on the socket, always a dedicated thread
+        func.push_back(NonRootCopyListenLoop);
+    }
+
+    // Reduce-scatter among all local ranks over shared memory
+    if (BytePSGlobal::IsSignalRoot()) {
+        add_stage(RootShmReduceLoop, RunRootShmReduceLoopOnce, 2);
+    }
+    else {
+        add_stage(CoordinateReduceLoop, RunCoordinateReduceLoopOnce, 2);
+        // blocks on the socket, always a dedicated thread
+        func.push_back(NonRootShmReduceLoop);
+    }
+#else
     // Cross-PCIe-switch reduce
     if (BytePSGlobal::IsCrossPcieSwitch()) {
-        func.push_back(PcieReduceLoop);
+        add_stage(PcieReduceLoop, RunPcieReduceLoopOnce, 1);
     }
 
     // Copy between GPU and CPU
     if (BytePSGlobal::IsCrossPcieSwitch() || BytePSGlobal::IsDistributed()) {
-        func.push_back(CopyDevice2HostLoop);
+        add_stage(CopyDevice2HostLoop, RunCopyDevice2HostLoopOnce, 1);
         if (BytePSGlobal::IsRootDevice()) {
             // PUSH can be a real push in distirbuted mode
             // Or a dummy barrier in cross-pcie-switch mode
-            func.push_back(PushLoop);
-            func.push_back(RootCopyHost2DeviceLoop);
+            add_stage(PushLoop, RunPushLoopOnce, 0);
+            add_stage(RootCopyHost2DeviceLoop, RunRootCopyHost2DeviceLoopOnce, 1);
         }
         else {
-            func.push_back(CoordinatePushLoop);
-            func.push_back(NonRootCopyHost2DeviceLoop);
+            add_stage(CoordinatePushLoop, RunCoordinatePushLoopOnce, 0);
+            add_stage(NonRootCopyHost2DeviceLoop, RunNonRootCopyHost2DeviceLoopOnce, 1);
+            // blocks on the socket, always a dedicated thread
             func.push_back(NonRootCopyListenLoop);
         }
     }
 
     // Per-PCIe-switch NCCL calls
+    // SyncNcclLoop blocks on CUDA events, always a dedicated thread
     func.push_back(SyncNcclLoop);
-    if (BytePSGlobal::GetNccl()->IsSignalRoot()) {
-        func.push_back(RootNcclLoop);
+    if (BytePSGlobal::IsSignalRoot()) {
+        add_stage(RootNcclLoop, RunRootNcclLoopOnce, 2);
     }
     else {
-        func.push_back(CoordinateReduceLoop);
-        func.push_back(CoordinateBroadcastLoop);
+        add_stage(CoordinateReduceLoop, RunCoordinateReduceLoopOnce, 2);
+        add_stage(CoordinateBroadcastLoop, RunCoordinateBroadcastLoopOnce, 2);
+        // blocks on the socket, always a dedicated thread
         func.push_back(NonRootNcclLoop);
     }
+#endif
 
     BytePSGlobal::Start(func);
+    if (executor) {
+        executor->Start();
+    }
     return;
 }
 
@@ -105,35 +152,29 @@ Status CheckInitialized() {
     return BytePSGlobal::CheckInit();
 }
 
+// Only sets what the partitions keep across iterations, EnqueueTensor() the rest
 void PartitionTensor(std::shared_ptr<TensorTableEntry> entry,
                     std::vector<std::shared_ptr<TensorTableEntry> > &partitions) {
-    BPS_CHECK(entry->counter_ptr) << entry->tensor_name << " counter pointer is null";
-    auto size = entry->tensor ? entry->tensor->size() : entry->output->size();
-    auto bound = BytePSGlobal::GetPartitionBound();
-    auto accumulated = 0;
+    auto context = entry->context;
+    size_t size = context->buff_len;
+    auto bound = context->partition_bytes;
+    size_t accumulated = 0;
     int i = 0;
 
     while (accumulated < size) {
         std::shared_ptr<TensorTableEntry> e(new TensorTableEntry);
-        // will assign the key later, so don't do it now
-        // e->key = entry->key;
         e->tensor_name = entry->tensor_name + std::string("_") + std::to_string(i);
-        e->context = entry->context;
-        e->ready_event = entry->ready_event;
-        e->device = entry->device;
-        e->priority = entry->priority;
-        e->version = entry->version;
-        e->callback = entry->callback;
+        e->key = context->key_list[i];
+        e->context = context;
         e->cpubuff = entry->cpubuff;
         e->gpu_ptr = entry->gpu_ptr;
         e->pcie_cpubuff = entry->pcie_cpubuff;
-        e->queue_list = entry->queue_list;
-        e->tensor = entry->tensor;
-        e->output = entry->output;
+        e->rank_cpubuff = entry->rank_cpubuff;
         e->offset = accumulated;
         e->len = ((size - accumulated) > bound) ? bound : (size - accumulated);
-        e->counter_ptr = entry->counter_ptr;
+        e->parent = entry.get();
         e->total_partnum = entry->total_partnum;
+        e->op = entry->op;
 
         accumulated += e->len;
         ++i;
@@ -142,55 +183,130 @@ void PartitionTensor(std::shared_ptr<TensorTableEntry> entry,
     }
 }
 
+std::shared_ptr<TensorTableEntry> GetTensorEntry(BPSContext &context) {
+    std::lock_guard<std::mutex> lock(context.entry_mutex);
+    for (auto &entry : context.entries) {
+        // Once the caller and the stages dropped an entry and its partitions,
+        // only the context holds them
+        bool idle = (entry.use_count() == 1);
+        for (size_t i = 0; idle && i < entry->partitions.size(); ++i) {
+            idle = (entry->partitions[i].use_count() == 1);
+        }
+        if (idle) {
+            // pairs with the release of the last reference by another thread
+            std::atomic_thread_fence(std::memory_order_acquire);
+            entry->counter = 0;
+            return entry;
+        }
+    }
+
+    std::shared_ptr<TensorTableEntry> entry(new TensorTableEntry);
+    entry->tensor_name = context.tensor_name;
+    entry->context = &context;
+    entry->cpubuff = context.cpubuff;
+    entry->gpu_ptr = context.gpu_ptr;
+    entry->pcie_cpubuff = context.pcie_cpubuff;
+    entry->rank_cpubuff = context.rank_cpubuff;
+    entry->total_partnum = context.key_list.size();
+    entry->op = context.op;
+    PartitionTensor(entry, entry->partitions);
+    BPS_CHECK_EQ(context.key_list.size(), entry->partitions.size()) << context.tensor_name
+            << ": " << context.key_list.size()
+            << ", " << entry->partitions.size();
+    context.entries.push_back(entry);
+    BPS_LOG(DEBUG) << context.tensor_name << " has " << context.entries.size()
+                   << " entries of " << entry->partitions.size() << " partition(s)"
+                   << ", rank=" << BytePSGlobal::GetLocalRank();
+    return entry;
+}
+
 Status EnqueueTensor(BPSContext &context,
                      std::shared_ptr<Tensor> input,
                      std::shared_ptr<Tensor> output,
                      std::shared_ptr<ReadyEvent> ready_event,
                      const int device, const int priority, const int version,
                      StatusCallback callback,
-                     std::shared_ptr<std::vector<QueueType>> queue_list) {
+                     std::shared_ptr<std::vector<QueueType>> queue_list,
+                     double scale) {
     
     auto& name = context.tensor_name;
     if (input && output) {
         BPS_CHECK_EQ(input->size(), output->size()) << name << " output tensor size does not match";
     }
 
-    std::shared_ptr<TensorTableEntry> e(new TensorTableEntry);
-    e->tensor_name = name;
-    e->context = &context;
+#ifdef BYTEPS_CPU_ONLY
+    if (device != CPU_DEVICE_ID) {
+        return Status::InvalidArgument(name + ": BytePS is built without GPU support, "
+                                       "the tensor must be on CPU");
+    }
+#endif
+
+    auto dtype = (input ? input : output)->dtype();
+    if (context.op == BYTEPS_OP_AVERAGE) {
+        scale /= BytePSGlobal::GetSize();
+    }
+    if (scale != 1.0) {
+        if (context.op != BYTEPS_OP_SUM && context.op != BYTEPS_OP_AVERAGE) {
+            return Status::InvalidArgument(name + ": only a sum can be scaled");
+        }
+        if (!CanScaleInCore(dtype)) {
+            return Status::InvalidArgument(name + ": cannot scale data type " +
+                                           std::to_string(dtype) + " in this configuration");
+        }
+    }
+
+    if (queue_list->size() == 0) {
+        BPS_LOG(TRACE) << name
+                       << ", device=" << device
+                       << " has no queue_list assigned, skipped";
+        callback(Status::OK());
+        return Status::OK();
+    }
+
+    auto e = GetTensorEntry(context);
     e->tensor = input;
     e->output = output;
     e->ready_event = ready_event;
     e->device = device;
     e->priority = priority;
     e->version = version;
-    e->callback = callback;
-    e->cpubuff = context.cpubuff;
-    e->gpu_ptr = context.gpu_ptr;
-    e->pcie_cpubuff = context.pcie_cpubuff;
-    e->queue_list = *queue_list;
-    e->counter_ptr = std::make_shared<std::atomic_int>(0);
-    e->total_partnum = context.key_list.size();
-
-    std::vector<std::shared_ptr<TensorTableEntry> > partitions;
-    PartitionTensor(e, partitions);
-    BPS_CHECK_EQ(context.key_list.size(), partitions.size()) << name
-            << ": " << context.key_list.size()
-            << ", " << partitions.size();
-
-    if (e->queue_list.size() == 0) {
-        BPS_CHECK(e->tensor_name != "");
-        BPS_LOG(TRACE) << e->tensor_name
-                       << ", device=" << e->device
-                       << " has no queue_list assigned, skipped";
-        e->callback(Status::OK());
+    e->callback = std::move(callback);
+    e->queue_list = queue_list;
+    e->scale = scale;
+
+    // A small tensor waits for the other members of its fusion group,
+    // the last one enqueues the fusion buffer in place of its own tensor
+    auto status = BytePSFusion::Fuse(e);
+    if (!status.ok()) {
+        // nothing may hold on to the tensors or run the callback once the
+        // entry is reused
+        e->tensor = nullptr;
+        e->output = nullptr;
+        e->ready_event = nullptr;
+        e->callback = nullptr;
+        e->queue_list = nullptr;
+        return status;
+    }
+    if (!e) {
+        BPS_LOG(TRACE) << "EnqueueTensor: " << name << " waits for its fusion group";
         return Status::OK();
     }
 
-    unsigned int accumulated = 0;
-    for (size_t i = 0; i < partitions.size(); ++i) {
-        auto task = partitions[i];
-        task->key = context.key_list[i]; // assign the key now
+    auto tensor = (e->tensor ? e->tensor : e->output);
+    BPS_CHECK(tensor);
+    BPS_CHECK_EQ((size_t) tensor->size(), e->context->buff_len)
+        << e->tensor_name << ": the tensor size cannot be changed";
+
+    for (auto &task : e->partitions) {
+        task->tensor = e->tensor;
+        task->output = e->output;
+        task->ready_event = e->ready_event;
+        task->device = e->device;
+        task->priority = e->priority;
+        task->version = e->version;
+        task->queue_list = e->queue_list;
+        task->stage = 0;
+        task->scale = e->scale;
         BPS_CHECK(task->tensor_name != "");
         BPS_LOG(TRACE) << "EnqueueTensor: " << (task->tensor_name)
                        << ", key=" << (task->key)
@@ -199,44 +315,58 @@ Status EnqueueTensor(BPSContext &context,
                        << ", device=" << (task->device)
                        << " rank=" << BytePSGlobal::GetLocalRank();
 
-        BytePSGlobal::GetScheduledQueue(e->queue_list[0])->addTask(task);
-        accumulated += task->len;
+        BytePSGlobal::GetScheduledQueue((*task->queue_list)[0])->addTask(task);
     }
 
-    auto tensor = (e->tensor ? e->tensor : e->output);
-    BPS_CHECK(tensor);
-    BPS_CHECK_EQ(accumulated, tensor->size())
-        << "accumulated partition size not equal to original tensor size";
-
-    BPS_LOG(TRACE) << "EnqueueTensor finished: " << name
+    BPS_LOG(TRACE) << "EnqueueTensor finished: " << e->tensor_name
                    << ", rank=" << BytePSGlobal::GetLocalRank();
     return Status::OK();
 }
 
-void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff) {
+bool CanScaleInCore(DataType dtype) {
+    return BytePSGlobal::GetScaleStage(dtype) != QUEUE_NUM_AND_NOT_A_REAL_QUEUE_TYPE_AND_MUST_BE_THE_LAST;
+}
+
+void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff,
+                ReduceOp op) {
     std::lock_guard<std::mutex> lock(context.init_mutex);
     if (context.initialized) { return; }
 
     BPS_CHECK_GT(size, 0) << "init tensor size not larger than 0";
     // Get metadata
-    auto bound = BytePSGlobal::GetPartitionBound();
+    auto bound = BytePSGlobal::GetPartitionPolicy()->GetPartitionBytes(size);
     auto& name = context.tensor_name;
     context.buff_len = size;
+    context.partition_bytes = bound;
+    context.op = op;
+    context.dtype = (DataType) dtype;
+    context.fusible = BytePSFusion::IsFusible(size, cpubuff != nullptr);
+
+    // The PS server merges pushes by summation only
+    BPS_CHECK(!BytePSGlobal::IsDistributed() || op == BYTEPS_OP_SUM || op == BYTEPS_OP_AVERAGE)
+        << name << ": reduce op " << op << " is not supported by the server in distributed mode";
     size_t accumulated = 0;
 
     // Total key space is 0 to 2^64 - 1
     // It will be divided to N PS servers, for now we assume N <= 2^16
     // Then we have 2^48 key space left (top 16 bits for different servers)
-    // MXNet server has a bug dealing with keys larger than 2^32
-    // Below we support up to 2^16 tensors, and up to 2^16 partitions per tensor
-    ps::Key start_key = context.declared_key << 16;
+    // MXNet server has a bug dealing with keys larger than 2^32, the native one does not
+    // Below we support up to 2^28 tensors, and up to 2^20 partitions per tensor,
+    // or 2^16 of each with the MXNet key layout
+    int partition_bits = BytePSGlobal::GetKeyPartitionBits();
+    BPS_CHECK_LT(context.declared_key, 1ULL << BytePSGlobal::GetKeyDeclaredBits())
+        << name << ": too many tensors";
+    ps::Key start_key = context.declared_key << partition_bits;
     while (accumulated < size) {
         context.key_list.push_back(start_key++);
         accumulated += ((size - accumulated) > bound) ? bound : (size - accumulated);
     }
+    BPS_CHECK_LE(context.key_list.size(), 1ULL << partition_bits)
+        << name << ": too many partitions, size=" << size << ", bound=" << bound;
     BPS_LOG(DEBUG) << name << " partitioned to "
                     << context.key_list.size() << " part(s)"
                     << ", total_len=" << size
+                    << ", partition_bytes=" << bound
                     << ", key_range=["
                     << context.key_list.front()
                     << ", "
@@ -247,7 +377,7 @@ void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff) {
     auto key_list = context.key_list;
 
     BPS_CHECK_GT(key_list.size(), 0) << name;
-    BPS_CHECK_EQ(key_list.size(), (unsigned int) (size+bound-1)/bound) // round up
+    BPS_CHECK_EQ(key_list.size(), (size+bound-1)/bound) // round up
                     << key_list.size()
                     << ", size=" << size
                     << ", bound=" << bound;
@@ -256,6 +386,7 @@ void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff) {
                    << ", size=" << size
                    << ", parts=" << key_list.size();
 
+#ifndef BYTEPS_CPU_ONLY
     // If cpubuff is not nullprt, the tensor itself is on CPU
     // We need to register with CUDA so that NCCL can work on it
     if (cpubuff) {
@@ -263,6 +394,7 @@ void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff) {
         CUDA_CALL(cudaHostRegister(cpubuff, size, cudaHostRegisterMapped));
         CUDA_CALL(cudaHostGetDevicePointer(&(context.gpu_ptr), cpubuff, 0));
     }
+#endif
 
     // We always allocate our own cpu buffer
     // use the first key in key_list as the index
@@ -274,6 +406,10 @@ void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff) {
     else {
         context.cpubuff = shm_obj->openSharedMemory(std::string("BytePS_ShM_"), key_list[0], size);
     }
+#ifdef BYTEPS_CPU_ONLY
+    // every local rank stages its input where the others can reduce it
+    context.rank_cpubuff = shm_obj->openRankSharedMemory(key_list[0], size);
+#endif
     BPS_LOG(TRACE) << name << ": open shared memory size " << size;
 
     // Init tensors with BytePS server
@@ -285,15 +421,8 @@ void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff) {
         int len = ((size - accumulated) > bound) ? bound : (size - accumulated);
 
         if (BytePSGlobal::IsDistributed() && BytePSGlobal::IsRootDevice()) {
-            // encode the key for pskv scattering
-            auto& pskv = BytePSGlobal::EncodeDefaultKey(key, len);
-            // false means not to delete data when SArray is deleted
-            ps::SArray<char> vals(data + accumulated, len, false);
-            // cmd type
-            int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
             // blocking push, also as a global barrirer
-            BytePSGlobal::GetPS()->Wait(BytePSGlobal::GetPS()->ZPush(
-                pskv.keys, vals, pskv.lens, cmd));
+            BytePSGlobal::GetBackend()->Init(key, data + accumulated, len, dtype);
         }
 
         accumulated += len;
@@ -314,15 +443,32 @@ BPSContext& GetContextFromName(const std::string &name) {
     return BytePSGlobal::GetContextFromName(name);
 }
 
-bool IsTensorDeclared(const std::string &name) {
-    return BytePSGlobal::IsTensorDeclared(name);
+bool IsTensorDeclared(const std::string &name, size_t size) {
+    return BytePSGlobal::IsTensorDeclared(name, size);
 }
 
 std::shared_ptr<std::vector<QueueType>> GetPushQueueList(int device) {
     auto queue_list = std::make_shared<std::vector<QueueType>>();
 
+#ifdef BYTEPS_CPU_ONLY
+    // Copy the input to shared memory, then every local rank reduces its slice
+    queue_list->push_back(COPYD2H);
+    if (!BytePSGlobal::IsSignalRoot()) {
+        queue_list->push_back(COORDINATE_REDUCE);
+    }
+    queue_list->push_back(REDUCE);
+
+    // Push in distirbuted mode, otherwise PUSH runs as a dummy barrier
+    if (BytePSGlobal::IsRootDevice()) {
+        queue_list->push_back(PUSH);
+    }
+    else {
+        queue_list->push_back(COORDINATE_PUSH);
+    }
+    return queue_list;
+#else
     // Per-PCIe-switch NCCL reduce
-    if (BytePSGlobal::GetNccl()->IsSignalRoot()) {
+    if (BytePSGlobal::IsSignalRoot()) {
         queue_list->push_back(REDUCE);
     }
     else {
@@ -351,6 +497,7 @@ std::shared_ptr<std::vector<QueueType>> GetPushQueueList(int device) {
         }
     }
     return queue_list;
+#endif
 }
 
 std::shared_ptr<std::vector<QueueType>> GetPullQueueList(int device) {
@@ -363,19 +510,36 @@ std::shared_ptr<std::vector<QueueType>> GetPullQueueList(int device) {
         }
     }
 
+#ifdef BYTEPS_CPU_ONLY
+    // Every local rank copies the whole result out of shared memory,
+    // which is all the all-gather there is to do
+    queue_list->push_back(COPYH2D);
+#else
     // Copy from CPU to GPU
     if (BytePSGlobal::IsDistributed() || BytePSGlobal::IsCrossPcieSwitch()) {
         queue_list->push_back(COPYH2D);
     }
 
     // Per-PCIe-switch NCCL broadcast
-    if (BytePSGlobal::GetNccl()->IsSignalRoot()) {
+    if (BytePSGlobal::IsSignalRoot()) {
         queue_list->push_back(BROADCAST);
     }
     else {
         queue_list->push_back(COORDINATE_BROADCAST);
         queue_list->push_back(BROADCAST);
     }
+#endif
+    return queue_list;
+}
+
+std::shared_ptr<std::vector<QueueType>> GetPushPullQueueList(BPSContext &context, int device) {
+    std::lock_guard<std::mutex> lock(context.entry_mutex);
+    auto &queue_list = context.queue_lists[device];
+    if (!queue_list) {
+        queue_list = GetPushQueueList(device);
+        auto queue_list_pull = GetPullQueueList(device);
+        queue_list->insert(queue_list->end(), queue_list_pull->begin(), queue_list_pull->end());
+    }
     return queue_list;
 }
 
@@ -59,12 +59,23 @@ Status EnqueueTensor(BPSContext &context,
                      std::shared_ptr<ReadyEvent> ready_event,
                      const int device, const int priority, const int version,
                      StatusCallback callback,
-                     std::shared_ptr<std::vector<QueueType>> queue_list);
+                     std::shared_ptr<std::vector<QueueType>> queue_list,
+                     double scale = 1.0);
 
-void InitTensor(BPSContext &context, size_t size, int dtype, void* cpubuff);
+void InitTensor(BPSContext &context, size_t size, int dtype, void* cpubuff,
+                ReduceOp op = BYTEPS_OP_SUM);
+
+// An entry of the initialized tensor with its partitions, whose last
+// iteration is over. The entries are reused, so that enqueueing a tensor
+// does not allocate them again after the first iterations.
+std::shared_ptr<TensorTableEntry> GetTensorEntry(BPSContext &context);
+
+// Whether EnqueueTensor() can multiply a summed tensor of dtype by a scale
+// factor within its stages. If not, the framework has to scale the result.
+bool CanScaleInCore(DataType dtype);
 
 // Only call these in Framework plugins for the best performance
-bool IsTensorDeclared(const std::string &name);
+bool IsTensorDeclared(const std::string &name, size_t size = 0);
 
 BPSContext& GetContextFromName(const std::string &name);
 
@@ -72,6 +83,10 @@ std::shared_ptr<std::vector<QueueType>> GetPushQueueList(int device);
 
 std::shared_ptr<std::vector<QueueType>> GetPullQueueList(int device);
 
+// The push queues followed by the pull ones, built once per device of the
+// tensor. The stages never change a queue list, so all entries share it.
+std::shared_ptr<std::vector<QueueType>> GetPushPullQueueList(BPSContext &context, int device);
+
 } // namespace common
 } // namespace byteps
 
@@ -0,0 +1,64 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <algorithm>
+#include <string>
+
+#include "partition.h"
+#include "global.h"
+#include "logging.h"
+
+namespace byteps {
+namespace common {
+
+BytePSPartitionPolicyAdaptive::BytePSPartitionPolicyAdaptive(size_t bound, size_t alignment,
+                                                             size_t min_bytes, int num_servers,
+                                                             int local_size)
+    : _bound(bound), _alignment(alignment),
+      _min_bytes(std::max(min_bytes * local_size, alignment)),
+      _num_servers(std::max(num_servers, 1)) {}
+
+size_t BytePSPartitionPolicyAdaptive::GetPartitionBytes(size_t size) {
+    size_t needed = (size + _bound - 1) / _bound;
+    size_t parts = (needed + _num_servers - 1) / _num_servers * _num_servers;
+    // the minimum may cut the extra partitions, never those the bound needs
+    parts = std::max(std::min(parts, size / _min_bytes), needed);
+    if (parts <= 1) {
+        return _bound;
+    }
+    // rounding up keeps the number of partitions, and the bound is aligned
+    size_t bytes = (size + parts - 1) / parts;
+    return (bytes + _alignment - 1) / _alignment * _alignment;
+}
+
+std::shared_ptr<BytePSPartitionPolicy> CreatePartitionPolicy(size_t bound, size_t alignment) {
+    std::string policy = getenv("BYTEPS_PARTITION_POLICY") ? getenv("BYTEPS_PARTITION_POLICY") : "fixed";
+    if (policy == "adaptive") {
+        auto min_bytes = getenv("BYTEPS_PARTITION_MIN_BYTES") ?
+                         atoi(getenv("BYTEPS_PARTITION_MIN_BYTES")) : BYTEPS_PARTITION_MIN_BYTES;
+        // only the servers share the partitions out, locally there is one
+        auto num_servers = BytePSGlobal::IsDistributed() && getenv("DMLC_NUM_SERVER") ?
+                           atoi(getenv("DMLC_NUM_SERVER")) : 1;
+        BPS_LOG(DEBUG) << "Adaptive partitioning for " << num_servers << " servers"
+                       << ", min_bytes=" << min_bytes << " per local GPU";
+        return std::make_shared<BytePSPartitionPolicyAdaptive>(
+            bound, alignment, min_bytes, num_servers, BytePSGlobal::GetLocalSize());
+    }
+    BPS_CHECK(policy == "fixed") << "unknown BYTEPS_PARTITION_POLICY " << policy;
+    return std::make_shared<BytePSPartitionPolicyFixed>(bound);
+}
+
+} // namespace common
+} // namespace byteps
@@ -0,0 +1,77 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_PARTITION_H
+#define BYTEPS_PARTITION_H
+
+#include <memory>
+#include "common.h"
+
+#define BYTEPS_PARTITION_MIN_BYTES (128 * 1024)
+
+namespace byteps {
+namespace common {
+
+// Picks the partition size of each tensor at InitTensor(). All local ranks
+// and all workers must pick the same, so a policy may only depend on the
+// tensor size and on the job layout.
+class BytePSPartitionPolicy {
+
+public:
+    virtual ~BytePSPartitionPolicy() {}
+
+    // At most the partition bound, and a multiple of the alignment unless
+    // the tensor fits in one partition
+    virtual size_t GetPartitionBytes(size_t size) = 0;
+};
+
+// BYTEPS_PARTITION_BYTES for every tensor
+class BytePSPartitionPolicyFixed : public BytePSPartitionPolicy {
+
+public:
+    BytePSPartitionPolicyFixed(size_t bound) : _bound(bound) {}
+
+    size_t GetPartitionBytes(size_t size) { return _bound; }
+
+private:
+    size_t _bound;
+};
+
+// Splits a tensor into equal partitions, as many as the bound needs and
+// rounded up to a multiple of the servers so that all of them get a share,
+// but none smaller than min_bytes per local GPU. E.g., with 8 servers, a 5MB
+// tensor goes out in 8 partitions instead of a 4MB and a 1MB one.
+class BytePSPartitionPolicyAdaptive : public BytePSPartitionPolicy {
+
+public:
+    BytePSPartitionPolicyAdaptive(size_t bound, size_t alignment, size_t min_bytes,
+                                  int num_servers, int local_size);
+
+    size_t GetPartitionBytes(size_t size);
+
+private:
+    size_t _bound;
+    size_t _alignment;
+    size_t _min_bytes;
+    int _num_servers;
+};
+
+// Selected by BYTEPS_PARTITION_POLICY, fixed by default
+std::shared_ptr<BytePSPartitionPolicy> CreatePartitionPolicy(size_t bound, size_t alignment);
+
+} // namespace common
+} // namespace byteps
+
+#endif // BYTEPS_PARTITION_H
@@ -20,25 +20,86 @@
 namespace byteps {
 namespace common {
 
+ReadyTable::ReadyTable(int ready_count, const char* name) {
+    _ready_count = ready_count;
+    _table_name = std::string(name);
+    for (int i = 0; i < kFanout; i++) {
+        _ready_table.children[i] = nullptr;
+    }
+}
+
+ReadyTable::~ReadyTable() {
+    FreeChildren(&_ready_table, kKeyBits - kFanoutBits);
+}
+
+void ReadyTable::FreeChildren(Node* node, int shift) {
+    for (auto &slot : node->children) {
+        void* child = slot.load();
+        if (!child) continue;
+        if (shift == kFanoutBits) {
+            delete static_cast<Leaf*>(child);
+        }
+        else {
+            auto n = static_cast<Node*>(child);
+            FreeChildren(n, shift - kFanoutBits);
+            delete n;
+        }
+    }
+}
+
+template <typename T>
+T* ReadyTable::GetChild(std::atomic<void*> &slot, bool create) {
+    void* child = slot.load();
+    if (child || !create) return static_cast<T*>(child);
+    // value-initialization zeroes all children/counts
+    T* fresh = new T();
+    if (slot.compare_exchange_strong(child, fresh)) {
+        return fresh;
+    }
+    // someone else installed it first
+    delete fresh;
+    return static_cast<T*>(child);
+}
+
+std::atomic<int>* ReadyTable::GetCounter(uint64_t key, bool create) {
+    BPS_CHECK_LT(key, 1ULL << kKeyBits) << _table_name << ": key " << key << " out of range";
+    uint64_t partition = key & ((1ULL << BYTEPS_KEY_PARTITION_BITS) - 1);
+    uint64_t index = (partition << BYTEPS_KEY_DECLARED_BITS) | (key >> BYTEPS_KEY_PARTITION_BITS);
+    auto node = &_ready_table;
+    int shift = kKeyBits - kFanoutBits;
+    for (; shift > kFanoutBits; shift -= kFanoutBits) {
+        node = GetChild<Node>(node->children[(index >> shift) & (kFanout - 1)], create);
+        if (!node) return nullptr;
+    }
+    auto leaf = GetChild<Leaf>(node->children[(index >> shift) & (kFanout - 1)], create);
+    if (!leaf) return nullptr;
+    return &leaf->counts[index & (kFanout - 1)];
+}
 
 // below are methods for accessing/modifying the _ready_table
+// a key without a counter yet has a count of 0, only signals create it
 bool ReadyTable::IsKeyReady(uint64_t key) {
-    std::lock_guard<std::mutex> lock(_table_mutex);
-    return _ready_table[key] == (_ready_count);
+    auto counter = GetCounter(key, false);
+    return (counter ? counter->load() : 0) == _ready_count;
 }
 
 int ReadyTable::AddReadyCount(uint64_t key) {
-    std::lock_guard<std::mutex> lock(_table_mutex);
-    BPS_CHECK_LT(_ready_table[key], _ready_count)
+    int count = GetCounter(key, true)->fetch_add(1) + 1;
+    BPS_CHECK_LE(count, _ready_count)
         << _table_name << ": "
-        << _ready_table[key] << ", " << (_ready_count);
-    return ++_ready_table[key];
+        << count << ", " << (_ready_count);
+    if (count == _ready_count && _ready_callback) {
+        _ready_callback(key);
+    }
+    return count;
 }
 
 void ReadyTable::ClearReadyCount(uint64_t key) {
-    std::lock_guard<std::mutex> lock(_table_mutex);
-    _ready_table[key] = 0;
+    auto counter = GetCounter(key, false);
+    if (counter) {
+        counter->store(0);
+    }
 }
 
-}
-}
\ No newline at end of file
+} // namespace common
+} // namespace byteps
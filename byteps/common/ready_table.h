@@ -16,9 +16,11 @@
 #ifndef BYTEPS_READY_TABLE_H
 #define BYTEPS_READY_TABLE_H
 
-#include <mutex>
-#include <thread>
-#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "common.h"
 
 namespace byteps {
 namespace common {
@@ -26,22 +28,42 @@ namespace common {
 class ReadyTable {
 
 public:
-    ReadyTable(int ready_count, const char* name) {
-        _ready_count = ready_count;
-        _table_name = std::string(name);
-    }
-    // methods to access or modify the _ready_table
+    ReadyTable(int ready_count, const char* name);
+    ~ReadyTable();
+    // methods to access or modify the _ready_table, all of them lock-free
     bool IsKeyReady(uint64_t key);
     int AddReadyCount(uint64_t key);
     void ClearReadyCount(uint64_t key);
+    // invoked when the count of a key completes
+    void SetReadyCallback(std::function<void(uint64_t)> callback) { _ready_callback = callback; }
 
 private:
+    // PS keys are (declared_key << BYTEPS_KEY_PARTITION_BITS | partition)
+    // and fit in 48 bits, as do those of the MXNet key layout. The counters live in a radix tree of 256-way nodes
+    // indexed by (partition, declared_key), so that the first partitions of
+    // all tensors share the same leaves. Nodes are installed with CAS and only
+    // freed in the destructor, so lookups are wait-free, and IsKeyReady()
+    // and ClearReadyCount() never allocate.
+    static const int kKeyBits = BYTEPS_KEY_PARTITION_BITS + BYTEPS_KEY_DECLARED_BITS;
+    static const int kFanoutBits = 8;
+    static const int kFanout = 1 << kFanoutBits;
+    static_assert(kKeyBits % kFanoutBits == 0, "the tree must cover the key bits exactly");
+
+    struct Node { std::atomic<void*> children[kFanout]; };
+    struct Leaf { std::atomic<int> counts[kFanout]; };
+
+    // nullptr if the counter does not exist and create is false, so that
+    // only AddReadyCount() allocates nodes
+    std::atomic<int>* GetCounter(uint64_t key, bool create);
+    template <typename T> T* GetChild(std::atomic<void*> &slot, bool create);
+    // frees the subtree below node, whose children are picked by the index bits from shift up
+    void FreeChildren(Node* node, int shift);
+
     // (key, ready_signal_count) pair, only valid for root device
-    std::unordered_map<uint64_t, int> _ready_table;
-    // use this mutex to access/modify the _ready_table
-    std::mutex _table_mutex;
+    Node _ready_table;
     int _ready_count;
     std::string _table_name;
+    std::function<void(uint64_t)> _ready_callback;
 };
 
 
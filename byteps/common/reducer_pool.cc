@@ -0,0 +1,188 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+
+#include "reducer_pool.h"
+#include "logging.h"
+
+#include <numa.h>
+#include <numaif.h>
+#include <unistd.h>
+
+namespace byteps {
+namespace common {
+
+CpuReducerPool::CpuReducerPool(int num_threads, size_t threshold) {
+    _threshold = threshold;
+    _should_stop = false;
+    _num_nodes = (numa_available() < 0) ? 1 : numa_max_node() + 1;
+    if (num_threads < _num_nodes) _num_nodes = (num_threads > 0) ? num_threads : 1;
+
+    _workers_per_node.resize(_num_nodes, 0);
+    _queues.resize(_num_nodes);
+    std::vector<std::condition_variable> cvs(_num_nodes);
+    _cvs.swap(cvs);
+
+    // with a single thread there is nothing to gain from dispatching
+    if (num_threads <= 1) return;
+    for (int i = 0; i < num_threads; ++i) {
+        int node = i % _num_nodes;
+        _workers_per_node[node]++;
+        _threads.emplace_back(&CpuReducerPool::WorkerLoop, this, node);
+    }
+    BPS_LOG(DEBUG) << "CpuReducerPool started " << num_threads << " threads on "
+                   << _num_nodes << " NUMA nodes, threshold=" << _threshold;
+}
+
+CpuReducerPool::~CpuReducerPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mu);
+        _should_stop = true;
+    }
+    for (auto &cv : _cvs) cv.notify_all();
+    for (auto &t : _threads) t.join();
+}
+
+void CpuReducerPool::WorkerLoop(int node) {
+    if (_num_nodes > 1 && numa_run_on_node(node) != 0) {
+        BPS_LOG(WARNING) << "CpuReducerPool failed to pin a worker to NUMA node " << node;
+    }
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(_mu);
+            _cvs[node].wait(lock, [this, node] { return _should_stop || !_queues[node].empty(); });
+            if (_should_stop) return;
+            task = std::move(_queues[node].front());
+            _queues[node].pop_front();
+        }
+        for (auto &seg : task.segments) {
+            (*task.fn)(seg.first, seg.second);
+        }
+        std::lock_guard<std::mutex> lock(task.job->mu);
+        if (--task.job->remaining == 0) task.job->cv.notify_one();
+    }
+}
+
+const std::vector<int>& CpuReducerPool::PageNodes(void* base, size_t num_pages,
+                                                  std::vector<int>* scratch) {
+    if (_num_nodes > 1) {
+        std::lock_guard<std::mutex> lock(_cache_mu);
+        auto it = _node_cache.find(base);
+        if (it != _node_cache.end() && it->second.size() == num_pages) {
+            return it->second;
+        }
+    }
+    auto nodes = scratch;
+    nodes->assign(num_pages, 0);
+    if (_num_nodes == 1) return *nodes;
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    auto first = (char*) ((uintptr_t) base & ~(uintptr_t) (page_size - 1));
+    std::vector<void*> pages(num_pages);
+    for (size_t i = 0; i < num_pages; ++i) {
+        pages[i] = first + i * page_size;
+    }
+    // with a null node list, move_pages only reports where each page lives
+    bool complete = (numa_move_pages(0, num_pages, pages.data(), nullptr, nodes->data(), 0) == 0);
+    for (size_t i = 0; i < num_pages; ++i) {
+        auto &node = (*nodes)[i];
+        if (node < 0) { // not faulted in yet
+            node = i % _num_nodes;
+            complete = false;
+        }
+        node %= _num_nodes;
+    }
+    if (complete) {
+        std::lock_guard<std::mutex> lock(_cache_mu);
+        // never overwrite an entry, another thread may be reading it
+        auto &cached = _node_cache.emplace(base, *nodes).first->second;
+        if (cached.size() == num_pages) return cached;
+    }
+    return *nodes;
+}
+
+void CpuReducerPool::Run(void* base, size_t len, size_t unit, const SegmentFunction &fn) {
+    if (_threads.empty() || len < _threshold) {
+        fn(0, len);
+        return;
+    }
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t head = (uintptr_t) base & (page_size - 1);
+    size_t num_pages = (head + len + page_size - 1) / page_size;
+    std::vector<int> scratch;
+    auto &nodes = PageNodes(base, num_pages, &scratch);
+
+    // offset of page p inside the buffer, rounded down to a whole unit
+    auto page_offset = [&](size_t p) -> size_t {
+        if (p == 0) return 0;
+        if (p >= num_pages) return len;
+        size_t off = p * page_size - head;
+        return off - off % unit;
+    };
+
+    std::vector<std::vector<size_t>> node_pages(_num_nodes);
+    for (size_t p = 0; p < num_pages; ++p) {
+        node_pages[nodes[p]].push_back(p);
+    }
+
+    Job job;
+    job.remaining = 0;
+    std::vector<std::pair<int, Task>> tasks;
+    for (int n = 0; n < _num_nodes; ++n) {
+        auto &pages = node_pages[n];
+        if (pages.empty()) continue;
+        size_t workers = _workers_per_node[n];
+        size_t per_task = (pages.size() + workers - 1) / workers;
+        for (size_t i = 0; i < pages.size(); i += per_task) {
+            Task task;
+            task.fn = &fn;
+            task.job = &job;
+            size_t end = std::min(i + per_task, pages.size());
+            for (size_t j = i; j < end; ++j) {
+                size_t begin = page_offset(pages[j]);
+                size_t finish = page_offset(pages[j] + 1);
+                if (begin == finish) continue;
+                // merge pages that are adjacent in the buffer
+                if (!task.segments.empty() &&
+                    task.segments.back().first + task.segments.back().second == begin) {
+                    task.segments.back().second += finish - begin;
+                } else {
+                    task.segments.emplace_back(begin, finish - begin);
+                }
+            }
+            if (task.segments.empty()) continue;
+            tasks.emplace_back(n, std::move(task));
+            job.remaining++;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mu);
+        for (auto &t : tasks) {
+            _queues[t.first].push_back(std::move(t.second));
+        }
+    }
+    for (int n = 0; n < _num_nodes; ++n) {
+        if (!node_pages[n].empty()) _cvs[n].notify_all();
+    }
+
+    std::unique_lock<std::mutex> lock(job.mu);
+    job.cv.wait(lock, [&job] { return job.remaining == 0; });
+}
+
+} // namespace common
+} // namespace byteps
@@ -0,0 +1,90 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+
+#ifndef BYTEPS_REDUCER_POOL_H
+#define BYTEPS_REDUCER_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace byteps {
+namespace common {
+
+// Persistent worker threads for CpuReducer. Workers are spread over the NUMA
+// nodes and pinned to their node. A buffer is cut at page boundaries and each
+// page is reduced by a worker on the node that owns it, so interleaved and
+// node-local shared memory are both read locally. Buffers below the
+// threshold are reduced inline by the caller, avoiding the dispatch cost.
+class CpuReducerPool {
+
+public:
+    // segment of the buffer as (offset, bytes)
+    typedef std::function<void(size_t, size_t)> SegmentFunction;
+
+    CpuReducerPool(int num_threads, size_t threshold);
+    ~CpuReducerPool();
+
+    // Calls fn on segments covering [0, len) of the buffer at base and waits
+    // for all of them. Segments are cut at multiples of unit. Thread-safe.
+    void Run(void* base, size_t len, size_t unit, const SegmentFunction &fn);
+
+    int GetNumThreads() { return _threads.size(); }
+
+private:
+    struct Job {
+        int remaining;
+        std::mutex mu;
+        std::condition_variable cv;
+    };
+
+    struct Task {
+        const SegmentFunction* fn;
+        std::vector<std::pair<size_t, size_t>> segments;
+        Job* job;
+    };
+
+    void WorkerLoop(int node);
+    // The node of each page, from the cache or else in scratch. Cached
+    // entries are never changed or erased, so the reference stays valid.
+    const std::vector<int>& PageNodes(void* base, size_t num_pages, std::vector<int>* scratch);
+
+    int _num_nodes;
+    std::vector<int> _workers_per_node;
+    std::vector<std::thread> _threads;
+    size_t _threshold;
+
+    std::mutex _mu;
+    std::vector<std::condition_variable> _cvs;
+    std::vector<std::deque<Task>> _queues;
+    bool _should_stop;
+
+    // page node lookups of reduced buffers, keyed by their base and only
+    // filled once all pages are faulted in. The buffers must outlive the
+    // pool, as the shared memory and server buffers do.
+    std::mutex _cache_mu;
+    std::unordered_map<void*, std::vector<int>> _node_cache;
+};
+
+} // namespace common
+} // namespace byteps
+
+#endif // BYTEPS_REDUCER_POOL_H
@@ -13,17 +13,19 @@
 // limitations under the License.
 // =============================================================================
 
-#include <algorithm>
+#include <chrono>
+#include <thread>
 
 #include "logging.h"
 #include "scheduled_queue.h"
 #include "global.h"
+#include "executor.h"
 
 namespace byteps {
 namespace common {
 
 BytePSScheduledQueue::BytePSScheduledQueue(QueueType type) {
-    if (type == REDUCE && BytePSGlobal::GetNccl()->IsSignalRoot()) {
+    if (type == REDUCE && BytePSGlobal::IsSignalRoot()) {
         _is_scheduled = true;
     }
     else {
@@ -31,14 +33,18 @@ BytePSScheduledQueue::BytePSScheduledQueue(QueueType type) {
     }
 
     _qt = type;
+    _sq = TaskSet(QueueItemCompare{_is_scheduled});
+    _seq = 0;
+    _notifier = std::make_shared<TaskNotifier>();
+    _seen_version = 0;
     _credits = _is_scheduled ?
-               BytePSGlobal::GetPartitionBound() * (BytePSGlobal::GetNccl()->GetGroupSize() + 1)
+               BytePSGlobal::GetPartitionBound() * (BytePSGlobal::GetGroupSize() + 1)
                : 34359738368;  // 32GB, basically disabling credit control
     _rt = nullptr;
 
     switch (_qt) {
         case REDUCE:
-            if (BytePSGlobal::GetNccl()->IsSignalRoot()) {
+            if (BytePSGlobal::IsSignalRoot()) {
                 _rt = BytePSGlobal::GetReduceTable();
             }
             break;
@@ -60,28 +66,28 @@ BytePSScheduledQueue::BytePSScheduledQueue(QueueType type) {
             }
             break;
         case BROADCAST:
-            if (BytePSGlobal::GetNccl()->IsSignalRoot()) {
+            if (BytePSGlobal::IsSignalRoot()) {
                 _rt = BytePSGlobal::GetBroadcastTable();
             }
             break;
         default:
             break;
     }
+
+    if (_rt) {
+        _rt->SetReadyCallback([this](uint64_t key) { notifyReady(key); });
+    }
 }
 
 void BytePSScheduledQueue::addTask(std::shared_ptr<TensorTableEntry> entry) {
     std::lock_guard<std::mutex> lock(_mutex);
-    _sq.push_back(entry);
-    if (_is_scheduled) {
-        // TODO: below can be optimized to O(n) using insertion sort
-        std::sort(_sq.begin(), _sq.end(),
-            [](std::shared_ptr<TensorTableEntry> a, std::shared_ptr<TensorTableEntry> b) {
-                if (a->priority == b->priority) {
-                    return (a->key < b->key); // from the first partition to the last
-                }
-                return (a->priority > b->priority); // from higher priority to lower
-        });
+    if (entry->ready_event && !entry->ready_event->Ready()) {
+        _event_waiting[entry->ready_event.get()].push_back(entry);
     }
+    else {
+        admitTask(entry);
+    }
+    _notifier->notify();
     BPS_CHECK(entry->tensor_name != "");
     BPS_LOG(TRACE) << "Queue " << LogStrings[_qt]
                    << " addTask: " << entry->tensor_name
@@ -90,29 +96,71 @@ void BytePSScheduledQueue::addTask(std::shared_ptr<TensorTableEntry> entry) {
     return;
 }
 
+// The caller must hold _mutex, so that a concurrent notifyReady() of the
+// same key either finds the task in _waiting or happened before IsKeyReady()
+void BytePSScheduledQueue::admitTask(std::shared_ptr<TensorTableEntry> entry) {
+    if (_rt && !_rt->IsKeyReady(entry->key)) {
+        _waiting.emplace(entry->key, entry);
+        return;
+    }
+    pushReadyTask(entry);
+}
+
+void BytePSScheduledQueue::pushReadyTask(std::shared_ptr<TensorTableEntry> entry) {
+    auto it = _sq.insert(QueueItem{entry->priority, entry->key, _seq++, entry}).first;
+    _index.emplace(entry->key, it);
+}
+
+void BytePSScheduledQueue::pollReadyEvents() {
+    for (auto it = _event_waiting.begin(); it != _event_waiting.end();) {
+        if (!it->first->Ready()) {
+            ++it;
+            continue;
+        }
+        for (auto &entry : it->second) {
+            admitTask(entry);
+        }
+        it = _event_waiting.erase(it);
+    }
+}
+
+void BytePSScheduledQueue::notifyReady(uint64_t key) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _waiting.find(key);
+    if (it == _waiting.end()) {
+        // the task is not here yet, addTask() will see the count instead
+        return;
+    }
+    if (!_rt->IsKeyReady(key)) {
+        // a late callback of the previous round, whose task getTask() took
+        // and whose count it cleared, must not release the next round
+        return;
+    }
+    auto entry = it->second;
+    _waiting.erase(it);
+    pushReadyTask(entry);
+    _notifier->notify();
+}
+
 std::shared_ptr<TensorTableEntry> BytePSScheduledQueue::getTask() {
     std::lock_guard<std::mutex> lock(_mutex);
+    _seen_version = _notifier->version();
+    if (!_event_waiting.empty()) {
+        pollReadyEvents();
+    }
     std::shared_ptr<TensorTableEntry> task;
-    // TODO: below can be optimized -- if we take task from the tail, erase() can be faster
     for (auto it = _sq.begin(); it!=_sq.end(); ++it) {
-        if ((*it)->ready_event) {
-            if (!(*it)->ready_event->Ready()) {
-                continue;
-            }
-        }
+        auto &entry = it->task;
         if (_is_scheduled) {
-            if ((*it)->len > _credits) {
+            if (entry->len > _credits) {
                 continue;
             }
         }
         if (_rt) {
-            if (!_rt->IsKeyReady((*it)->key)) {
-                continue;
-            }
-            _rt->ClearReadyCount((*it)->key);
+            _rt->ClearReadyCount(entry->key);
         }
-        task = *it;
-        _sq.erase(it);
+        task = entry;
+        eraseTask(it);
         if (_is_scheduled) {
             _credits -= task->len;
         }
@@ -129,40 +177,86 @@ std::shared_ptr<TensorTableEntry> BytePSScheduledQueue::getTask() {
 
 std::shared_ptr<TensorTableEntry> BytePSScheduledQueue::getTask(uint64_t key){
     BPS_CHECK(!_is_scheduled);
+    BPS_CHECK(!_rt) << "getTask(key) does not support ReadyTable";
     std::lock_guard<std::mutex> lock(_mutex);
-    std::shared_ptr<TensorTableEntry> task;
-    for (auto it = _sq.begin(); it!=_sq.end(); ++it) {
-        if ((*it)->ready_event) {
-            BPS_CHECK((*it)->ready_event->Ready());
-        }
-        if ((*it)->key != (uint64_t)key) {
-            continue;
+    auto range = _index.equal_range(key);
+    if (range.first == range.second && !_event_waiting.empty()) {
+        pollReadyEvents();
+        range = _index.equal_range(key);
+    }
+    if (range.first == range.second) {
+        return nullptr;
+    }
+    // In case the same key is queued more than once, take the earliest one
+    auto first = range.first;
+    for (auto it = range.first; it != range.second; ++it) {
+        if (_sq.key_comp()(*(it->second), *(first->second))) {
+            first = it;
         }
-        task = *it;
-        _sq.erase(it);
+    }
+    auto task = first->second->task;
+    eraseTask(first->second);
 
-        BPS_CHECK(task->tensor_name != "");
-        BPS_LOG(TRACE) << "Queue " << LogStrings[_qt]
-                       << " getTask(key): " << task->tensor_name
-                       << " key: " << task->key
-                       << " rank: " << BytePSGlobal::GetLocalRank();
-        return task;
+    BPS_CHECK(task->tensor_name != "");
+    BPS_LOG(TRACE) << "Queue " << LogStrings[_qt]
+                   << " getTask(key): " << task->tensor_name
+                   << " key: " << task->key
+                   << " rank: " << BytePSGlobal::GetLocalRank();
+    return task;
+}
+
+void BytePSScheduledQueue::eraseTask(TaskSet::iterator pos) {
+    auto range = _index.equal_range(pos->key);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == pos) {
+            _index.erase(it);
+            break;
+        }
     }
-    return nullptr;
+    _sq.erase(pos);
 }
 
 uint32_t BytePSScheduledQueue::pendingSize() {
     std::lock_guard<std::mutex> lock(_mutex);
-    return _sq.size();
+    size_t size = _sq.size() + _waiting.size();
+    for (auto &it : _event_waiting) {
+        size += it.second.size();
+    }
+    return size;
 }
 
 void BytePSScheduledQueue::reportFinish(int size) {
     if (_is_scheduled) {
         std::lock_guard<std::mutex> lock(_mutex);
         _credits += size;
+        // tasks held back by credits may proceed now
+        _notifier->notify();
     }
     return;
 }
 
+void BytePSScheduledQueue::wait() {
+    bool polling;
+    uint64_t seen;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // ReadyEvent has no callback, so keep polling while any is pending.
+        // This also keeps an executor worker from parking, as nothing would
+        // wake it up when the event fires.
+        polling = !_event_waiting.empty();
+        seen = _seen_version;
+    }
+    if (polling) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+        return;
+    }
+    if (BytePSExecutor::IsWorkerThread()) {
+        // the executor parks its workers itself once all their stages are idle
+        BytePSExecutor::ReportIdle();
+        return;
+    }
+    _notifier->wait(seen);
+}
+
 } // namespace common
 } // namespace byteps
@@ -19,9 +19,11 @@
 #include <atomic>
 #include <vector>
 #include <memory>
+#include <set>
 #include <unordered_map>
 #include "common.h"
 #include "ready_table.h"
+#include "task_notifier.h"
 
 namespace byteps {
 namespace common {
@@ -36,10 +38,56 @@ public:
     std::shared_ptr<TensorTableEntry> getTask(uint64_t key);
     uint32_t pendingSize();
     void reportFinish(int size);
+    // Called by the ReadyTable when the count of key completes
+    void notifyReady(uint64_t key);
+    // Park the calling loop until the queue changed since the last getTask()
+    void wait();
+    std::shared_ptr<TaskNotifier> getNotifier() { return _notifier; }
+    // Share one notifier among queues that are polled by the same loop
+    void setNotifier(std::shared_ptr<TaskNotifier> notifier) { _notifier = notifier; }
 
 private:
-    // TODO: use priority queue or heap
-    std::vector<std::shared_ptr<TensorTableEntry>> _sq;
+    struct QueueItem {
+        int priority;
+        uint64_t key;
+        uint64_t seq;
+        std::shared_ptr<TensorTableEntry> task;
+    };
+
+    // Scheduled queues order by (higher priority, smaller key), the others are FIFO.
+    // The arrival sequence number breaks ties so that the order is strict.
+    struct QueueItemCompare {
+        bool by_priority;
+        bool operator()(const QueueItem &a, const QueueItem &b) const {
+            if (by_priority) {
+                if (a.priority != b.priority) return (a.priority > b.priority);
+                if (a.key != b.key) return (a.key < b.key);
+            }
+            return (a.seq < b.seq);
+        }
+    };
+
+    using TaskSet = std::set<QueueItem, QueueItemCompare>;
+
+    void eraseTask(TaskSet::iterator pos);
+    void admitTask(std::shared_ptr<TensorTableEntry> entry);
+    void pushReadyTask(std::shared_ptr<TensorTableEntry> entry);
+    void pollReadyEvents();
+
+    // Tasks are only in _sq once their ReadyEvent fired and their ReadyTable
+    // count completed, so getTask() never polls blocked work.
+    // Balanced tree instead of a heap: getTask() has to skip entries blocked
+    // by credits, so we need ordered iteration with O(log n) erase.
+    TaskSet _sq;
+    // key -> position in _sq, so that getTask(key) does not scan the queue
+    std::unordered_multimap<uint64_t, TaskSet::iterator> _index;
+    // Tasks waiting for their ReadyTable count, moved by notifyReady()
+    std::unordered_multimap<uint64_t, std::shared_ptr<TensorTableEntry>> _waiting;
+    // Tasks waiting for their ReadyEvent, grouped so each event is polled once
+    std::unordered_map<ReadyEvent*, std::vector<std::shared_ptr<TensorTableEntry>>> _event_waiting;
+    uint64_t _seq;
+    std::shared_ptr<TaskNotifier> _notifier;
+    uint64_t _seen_version;
     std::mutex _mutex;
     uint64_t _credits;
     bool _is_scheduled;
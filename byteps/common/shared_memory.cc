@@ -36,7 +36,9 @@ void* BytePSSharedMemory::openSharedMemory(const std::string &prefix, uint64_t k
     BPS_CHECK_GE(ftruncate(shm_fd, size), 0) << strerror(errno);
 
     void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+#ifndef BYTEPS_CPU_ONLY
     CUDA_CALL(cudaHostRegister(ptr, size, cudaHostRegisterDefault));
+#endif
     // mlock(ptr, size);
 
     BPS_CHECK_NE(ptr, (void *)-1) << strerror(errno);
@@ -79,6 +81,15 @@ std::vector<void*> BytePSSharedMemory::openPcieSharedMemory(uint64_t key, size_t
     return r;
 }
 
+std::vector<void*> BytePSSharedMemory::openRankSharedMemory(uint64_t key, size_t size) {
+    std::vector<void*> r;
+    for (int i = 0; i < BytePSGlobal::GetLocalSize(); i++) {
+        auto prefix = std::string("BytePS_Rank") + std::to_string(i) + "_ShM_";
+        r.push_back(openSharedMemory(prefix, key, size));
+    }
+    return r;
+}
+
 } // namespace common
 
 } // namespace byteps
\ No newline at end of file
@@ -24,7 +24,9 @@
 #include <thread>
 #include <cerrno>
 #include <cstring>
+#ifndef BYTEPS_CPU_ONLY
 #include <cuda_runtime.h>
+#endif
 #include "logging.h"
 
 namespace byteps {
@@ -38,7 +40,9 @@ public:
 
     ~BytePSSharedMemory() {
         for (auto &it : _key_shm_addr) {
+#ifndef BYTEPS_CPU_ONLY
             CUDA_CALL(cudaHostUnregister(it.second));
+#endif
             munmap(it.second, _key_shm_size[it.first]);
             shm_unlink(it.first.c_str());
         }
@@ -48,6 +52,7 @@ public:
 
     void* openSharedMemory(const std::string &prefix, uint64_t key, size_t size);
     std::vector<void*> openPcieSharedMemory(uint64_t key, size_t size);
+    std::vector<void*> openRankSharedMemory(uint64_t key, size_t size);
 
 private:
 
@@ -0,0 +1,64 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+#include "logging.h"
+#include "task_notifier.h"
+
+namespace byteps {
+namespace common {
+
+TaskNotifier::TaskNotifier() : _version(0), _parked(0) {
+    _spin_us = getenv("BYTEPS_IDLE_SPIN_US") ?
+               atoi(getenv("BYTEPS_IDLE_SPIN_US")) : 20;
+    _park_us = getenv("BYTEPS_IDLE_PARK_US") ?
+               atoi(getenv("BYTEPS_IDLE_PARK_US")) : 100000;
+    BPS_CHECK_GE(_spin_us, 0);
+    BPS_CHECK_GT(_park_us, 0);
+}
+
+void TaskNotifier::notify() {
+    _version.fetch_add(1);
+    // pairs with the increment of _parked in wait(): either the waiter sees
+    // the new version before sleeping, or we see it parked and wake it up
+    if (_parked.load()) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _cond.notify_all();
+    }
+}
+
+void TaskNotifier::wait(uint64_t seen) {
+    if (_spin_us) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(_spin_us);
+        while (std::chrono::steady_clock::now() < deadline) {
+            if (version() != seen) return;
+            std::this_thread::yield();
+        }
+    }
+
+    _parked.fetch_add(1);
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait_for(lock, std::chrono::microseconds(_park_us),
+                       [this, seen] { return version() != seen; });
+    }
+    _parked.fetch_sub(1);
+}
+
+} // namespace common
+} // namespace byteps
@@ -0,0 +1,53 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_TASK_NOTIFIER_H
+#define BYTEPS_TASK_NOTIFIER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace byteps {
+namespace common {
+
+// Lets an idle loop park until a producer announces new work.
+// Producers bump a version counter; a consumer remembers the version it saw
+// before polling and waits until the counter moves past it, first spinning
+// for BYTEPS_IDLE_SPIN_US and then sleeping on a condition variable for up
+// to BYTEPS_IDLE_PARK_US.
+class TaskNotifier {
+
+public:
+    TaskNotifier();
+    uint64_t version() { return _version.load(); }
+    void notify();
+    void wait(uint64_t seen);
+
+private:
+    std::atomic<uint64_t> _version;
+    // number of parked waiters, so that notify() can skip the futex wake
+    std::atomic<int> _parked;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    int _spin_us;
+    int _park_us;
+};
+
+
+} // namespace common
+} // namespace byteps
+
+#endif // BYTEPS_TASK_NOTIFIER_H
@@ -51,22 +51,19 @@ inline void InvokeCompleteCallback(Callback on_complete, const Status& status) {
 }
 
 void DoPushPull(BPSContext &context, NDArray* input, int version, int priority,
-                 Callback on_complete) {
+                 double scale, Callback on_complete) {
     ThrowIfError(common::CheckInitialized());
 
     auto device = TensorUtil::GetDevice(input);
     auto byteps_input = std::make_shared<MXTensor<NDArray>>(input);
-    auto queue_list = common::GetPushQueueList(device);
-    auto queue_list_pull = common::GetPullQueueList(device);
-    queue_list->insert(queue_list->end(),
-                       queue_list_pull->begin(), queue_list_pull->end());
+    auto queue_list = common::GetPushPullQueueList(context, device);
 
     auto enqueue_result =
         common::EnqueueTensor(context, byteps_input, byteps_input, nullptr,
                               device, priority, version,
                               [on_complete](const Status& status) {
                                 InvokeCompleteCallback(on_complete, status);
-                              }, queue_list);
+                              }, queue_list, scale);
     ThrowIfError(enqueue_result);
 }
 
@@ -84,17 +81,21 @@ extern "C" int byteps_mxnet_push_pull_async(NDArray* tensor,
         const_cast<void*>(std::make_shared<MXTensor<NDArray>>(tensor)->data()) : nullptr;
     common::InitTensor(context, size, dtype, cpubuff);
 
-    auto push_pull_async_fn = [&context, tensor, version, priority](RunContext rctx,
+    // average the aggregated gradient within the BytePS stages if possible,
+    // instead of another engine op over the tensor
+    bool scale_in_core = common::CanScaleInCore(dtype);
+    double scale = (is_average && scale_in_core) ? 1.0 / byteps_size() : 1.0;
+
+    auto push_pull_async_fn = [&context, tensor, version, priority, scale](RunContext rctx,
                                       Callback on_complete) mutable {
-        DoPushPull(context, tensor, version, priority, on_complete);
+        DoPushPull(context, tensor, version, priority, scale, on_complete);
     };
 
     Engine::Get()->PushAsync(push_pull_async_fn, Context::CPU(),
                             {}, {tensor->var()},
                             FnProperty::kCPUPrioritized, 0, "BytePSPushPull");
 
-    if (is_average) {
-        // average the aggregated gradient
+    if (is_average && !scale_in_core) {
         auto num_worker = byteps_size();
         *tensor /= num_worker;
     }
@@ -104,7 +105,7 @@ extern "C" int byteps_mxnet_push_pull_async(NDArray* tensor,
 
 extern "C" void byteps_mxnet_declare_tensor(NDArray* tensor, char* name) {
     std::string tensor_name = GetOpName("byteps", name);
-    common::IsTensorDeclared(tensor_name);
+    common::IsTensorDeclared(tensor_name, TensorUtil::GetSize(tensor));
     return;
 }
 
@@ -0,0 +1,25 @@
+# Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+import ctypes
+
+from byteps.common import get_extension_full_path
+
+
+def run():
+    """Runs the BytePS server or scheduler, depending on DMLC_ROLE.
+    Blocks until the job finalizes."""
+    c_lib = ctypes.CDLL(get_extension_full_path(__file__, 'c_lib'), mode=ctypes.RTLD_GLOBAL)
+    c_lib.byteps_server()
@@ -0,0 +1,295 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <cstring>
+#include <sstream>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "../common/logging.h"
+
+namespace byteps {
+namespace server {
+
+#define BYTEPS_SERVER_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+ps::KVServer<char>* BytePSServer::_server = nullptr;
+int BytePSServer::_num_workers = 1;
+bool BytePSServer::_enable_hugepage = false;
+std::mutex BytePSServer::_response_mu;
+std::unordered_map<uint64_t, int> BytePSServer::_key_engine;
+std::vector<size_t> BytePSServer::_engine_bytes;
+std::vector<std::unique_ptr<BytePSServer::Engine>> BytePSServer::_engines;
+
+void BytePSServer::Run() {
+    // the launcher runs the scheduler with the same entry point
+    std::string role = getenv("DMLC_ROLE") ? getenv("DMLC_ROLE") : "server";
+    if (role == "scheduler") {
+        StartPS();
+        ps::Finalize(0, true);
+        return;
+    }
+    BPS_CHECK(role == "server") << "unexpected DMLC_ROLE " << role;
+
+    _num_workers = ps::NumWorkers();
+    _enable_hugepage = getenv("BYTEPS_SERVER_ENABLE_HUGEPAGE") ?
+                       atoi(getenv("BYTEPS_SERVER_ENABLE_HUGEPAGE")) : false;
+    auto num_engines = getenv("BYTEPS_SERVER_ENGINE_THREAD") ?
+                       atoi(getenv("BYTEPS_SERVER_ENGINE_THREAD")) : BYTEPS_SERVER_ENGINE_THREAD;
+    BPS_CHECK_GE(num_engines, 1);
+
+    // e.g. "0,2,4,6", by default engine i runs on core i
+    std::vector<int> cores;
+    if (getenv("BYTEPS_SERVER_ENGINE_CORES")) {
+        std::stringstream ss(getenv("BYTEPS_SERVER_ENGINE_CORES"));
+        std::string core;
+        while (std::getline(ss, core, ',')) {
+            cores.push_back(atoi(core.c_str()));
+        }
+    }
+    int num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // the engines are the parallelism, the reducers sum on the calling thread
+    setenv("BYTEPS_CPU_REDUCER_THREADS", "1", 0);
+
+    _engine_bytes.assign(num_engines, 0);
+    for (int i = 0; i < num_engines; ++i) {
+        _engines.emplace_back(new Engine());
+        _engines[i]->core = cores.empty() ? (i % num_cores) : cores[i % cores.size()];
+    }
+    for (int i = 0; i < num_engines; ++i) {
+        _engines[i]->thread = std::thread(&BytePSServer::EngineLoop, i);
+    }
+    BPS_LOG(INFO) << "BytePS server started with " << num_engines << " engine threads for "
+                  << _num_workers << " workers, hugepage=" << _enable_hugepage;
+
+    _server = new ps::KVServer<char>(0);
+    _server->set_request_handle(&BytePSServer::Handler);
+    StartPS();
+    // Waits for all nodes to finalize. The workers do not take part in this
+    // barrier today, so like the MXNet server this serves until it is killed.
+    ps::Finalize(0, true);
+
+    for (auto& engine : _engines) {
+        {
+            std::lock_guard<std::mutex> lock(engine->mu);
+            engine->stop = true;
+        }
+        engine->cv.notify_one();
+        engine->thread.join();
+    }
+    _engines.clear();
+    delete _server;
+    _server = nullptr;
+    BPS_LOG(INFO) << "BytePS server stopped";
+}
+
+void BytePSServer::StartPS() {
+    ps::StartAsync(0, "byteps_server\0");
+    if (!ps::Postoffice::Get()->is_recovery()) {
+        ps::Postoffice::Get()->Barrier(
+            0, ps::kWorkerGroup + ps::kServerGroup + ps::kScheduler);
+    }
+}
+
+void BytePSServer::Handler(const ps::KVMeta& req_meta, const ps::KVPairs<char>& req_data,
+                           ps::KVServer<char>* server) {
+    RequestType type;
+    int dtype;
+    DecodeCommandType(req_meta.cmd, &type, &dtype);
+    BPS_CHECK(type == RequestType::kDefaultPushPull) << "unsupported request type " << (int) type;
+    // EncodeDefaultKey() sends each partition as one key to one server
+    BPS_CHECK_EQ(req_data.keys.size(), (size_t) 1);
+    BPS_CHECK_EQ(req_data.lens.size(), (size_t) 1);
+
+    uint64_t key = req_data.keys[0];
+    size_t len = req_data.lens[0];
+    if (req_meta.push) {
+        BPS_CHECK_EQ(req_data.vals.size(), len) << "key " << key;
+    }
+    Enqueue(GetEngine(key, len), { key, req_meta, req_data, (DataType) dtype });
+}
+
+int BytePSServer::GetEngine(uint64_t key, size_t len) {
+    auto it = _key_engine.find(key);
+    if (it != _key_engine.end()) {
+        return it->second;
+    }
+    // balance the bytes rather than the keys, as partitions differ in size
+    int engine = 0;
+    for (size_t i = 1; i < _engine_bytes.size(); ++i) {
+        if (_engine_bytes[i] < _engine_bytes[engine]) engine = i;
+    }
+    _engine_bytes[engine] += len;
+    _key_engine[key] = engine;
+    return engine;
+}
+
+void BytePSServer::Enqueue(int engine, BytePSEngineMessage msg) {
+    auto& e = _engines[engine];
+    {
+        std::lock_guard<std::mutex> lock(e->mu);
+        e->queue.push_back(std::move(msg));
+    }
+    e->cv.notify_one();
+}
+
+void BytePSServer::EngineLoop(int engine) {
+    auto& e = _engines[engine];
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(e->core, &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0) {
+        BPS_LOG(WARNING) << "Failed to pin engine thread " << engine << " to core " << e->core;
+    }
+
+    // the buffers are allocated and first touched here, i.e. on the node of the core
+    std::unique_ptr<CpuReducer> reducer(new CpuReducer(nullptr));
+    std::unordered_map<uint64_t, BytePSKeyState> states;
+    while (true) {
+        BytePSEngineMessage msg;
+        {
+            std::unique_lock<std::mutex> lock(e->mu);
+            e->cv.wait(lock, [&e] { return e->stop || !e->queue.empty(); });
+            if (e->queue.empty()) {
+                return;
+            }
+            msg = std::move(e->queue.front());
+            e->queue.pop_front();
+        }
+        auto state = &states[msg.key];
+        if (msg.req_meta.push) {
+            Push(state, msg, reducer.get());
+        }
+        else {
+            Pull(state, msg);
+        }
+    }
+}
+
+void BytePSServer::Push(BytePSKeyState* state, const BytePSEngineMessage& msg,
+                        CpuReducer* reducer) {
+    auto key = msg.key;
+    auto len = msg.req_data.vals.size();
+    auto recved = msg.req_data.vals.data();
+    auto sender = msg.req_meta.sender;
+
+    if (!state->initialized) {
+        // The first push of every worker is the blocking init of InitTensor(),
+        // which is answered only after all workers arrived.
+        if (!state->stored) {
+            state->len = len;
+            state->dtype = msg.dtype;
+            state->stored = AllocBuffer(len);
+            state->merged = AllocBuffer(len);
+            memcpy(state->stored, recved, len);
+        }
+        BPS_CHECK(state->pushed.insert(sender).second) << "key " << key << " is initialized twice by " << sender;
+        state->pending.push_back(msg);
+        if (state->pushed.size() < (size_t) _num_workers) {
+            return;
+        }
+        state->initialized = true;
+        state->pushed.clear();
+        for (auto& init : state->pending) {
+            SendPushResponse(init);
+        }
+        state->pending.clear();
+        return;
+    }
+
+    BPS_CHECK_EQ(state->len, len) << "The value size cannot be changed " << len << ". Key is " << key;
+    BPS_CHECK_EQ(state->dtype, msg.dtype) << "The data type cannot be changed. Key is " << key;
+    BPS_CHECK(state->pushed.insert(sender).second) << "key " << key << " is pushed twice by "
+                                                   << sender << " in one round";
+    if (state->pushed.size() == 1) {
+        memcpy(state->merged, recved, len);
+    }
+    else {
+        reducer->sum(state->merged, (void*) recved, len, state->dtype);
+    }
+    SendPushResponse(msg);
+
+    if (state->pushed.size() < (size_t) _num_workers) {
+        return;
+    }
+    // The round is complete. The old sum becomes the next merge buffer, it is
+    // only written by the first push of the next round, which no worker sends
+    // before it has received its pull of this round.
+    std::swap(state->stored, state->merged);
+    state->pushed.clear();
+    for (auto& pull : state->pending) {
+        SendPullResponse(state, pull);
+    }
+    state->pending.clear();
+}
+
+void BytePSServer::Pull(BytePSKeyState* state, const BytePSEngineMessage& msg) {
+    BPS_CHECK(state->initialized) << "key " << msg.key << " is pulled before it is initialized";
+    // a worker that pushed in this round waits for its sum
+    if (state->pushed.count(msg.req_meta.sender)) {
+        state->pending.push_back(msg);
+        return;
+    }
+    SendPullResponse(state, msg);
+}
+
+void BytePSServer::SendPushResponse(const BytePSEngineMessage& msg) {
+    std::lock_guard<std::mutex> lock(_response_mu);
+    _server->Response(msg.req_meta);
+}
+
+void BytePSServer::SendPullResponse(BytePSKeyState* state, const BytePSEngineMessage& msg) {
+    ps::KVPairs<char> res;
+    res.keys = msg.req_data.keys;
+    res.lens.push_back(state->len);
+    // zero copy, see Push() for why the buffer is not overwritten while in flight
+    res.vals = ps::SArray<char>(state->stored, state->len, false);
+    std::lock_guard<std::mutex> lock(_response_mu);
+    _server->Response(msg.req_meta, res);
+}
+
+// The buffers of a key live as long as the server
+char* BytePSServer::AllocBuffer(size_t len) {
+    void* p = nullptr;
+    if (_enable_hugepage && len >= BYTEPS_SERVER_HUGEPAGE_SIZE) {
+        auto size = (len + BYTEPS_SERVER_HUGEPAGE_SIZE - 1) / BYTEPS_SERVER_HUGEPAGE_SIZE
+                    * BYTEPS_SERVER_HUGEPAGE_SIZE;
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            memset(p, 0, len);
+            return (char*) p;
+        }
+        // no pages reserved, ask for transparent huge pages instead
+        p = nullptr;
+        BPS_CHECK_EQ(posix_memalign(&p, BYTEPS_SERVER_HUGEPAGE_SIZE, size), 0);
+        madvise(p, size, MADV_HUGEPAGE);
+    }
+    else {
+        BPS_CHECK_EQ(posix_memalign(&p, sysconf(_SC_PAGESIZE), len), 0);
+    }
+    memset(p, 0, len);
+    return (char*) p;
+}
+
+} // namespace server
+} // namespace byteps
+
+void byteps_server() {
+    byteps::server::BytePSServer::Run();
+}
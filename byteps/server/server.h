@@ -0,0 +1,116 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_SERVER_H
+#define BYTEPS_SERVER_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "ps/ps.h"
+#include "../common/common.h"
+#include "../common/cpu_reducer.h"
+
+#define BYTEPS_SERVER_ENGINE_THREAD 4
+
+namespace byteps {
+namespace server {
+
+using namespace byteps::common;
+
+// A push or pull as received by the ps-lite request handler
+struct BytePSEngineMessage {
+    uint64_t key;
+    ps::KVMeta req_meta;
+    // keeps the received data alive until it is summed
+    ps::KVPairs<char> req_data;
+    DataType dtype;
+};
+
+// Everything about one key, only touched by the engine thread owning it
+struct BytePSKeyState {
+    bool initialized = false;
+    size_t len = 0;
+    DataType dtype = BYTEPS_FLOAT32;
+    // the sum of the last complete round, which the pulls read
+    char* stored = nullptr;
+    // the sum of the current round
+    char* merged = nullptr;
+    // the workers that pushed in the current round
+    std::unordered_set<int> pushed;
+    // pulls of those workers, answered once the round is complete
+    std::vector<BytePSEngineMessage> pending;
+};
+
+// Sums the pushes of all workers. Keys are sharded over the engine threads,
+// each pinned to its own core and summing with the CpuReducer kernels, so
+// that a key never waits for another key on the same server.
+class BytePSServer {
+
+public:
+    // Serves until the ps-lite job finalizes
+    static void Run();
+
+private:
+    static void StartPS();
+    static void Handler(const ps::KVMeta& req_meta, const ps::KVPairs<char>& req_data,
+                        ps::KVServer<char>* server);
+    static int GetEngine(uint64_t key, size_t len);
+    static void Enqueue(int engine, BytePSEngineMessage msg);
+    static void EngineLoop(int engine);
+
+    static void Push(BytePSKeyState* state, const BytePSEngineMessage& msg, CpuReducer* reducer);
+    static void Pull(BytePSKeyState* state, const BytePSEngineMessage& msg);
+    static void SendPushResponse(const BytePSEngineMessage& msg);
+    static void SendPullResponse(BytePSKeyState* state, const BytePSEngineMessage& msg);
+    static char* AllocBuffer(size_t len);
+
+    static ps::KVServer<char>* _server;
+    static int _num_workers;
+    static bool _enable_hugepage;
+
+    // ps-lite may not be able to send from several threads at once
+    static std::mutex _response_mu;
+
+    // owned by the request handler thread
+    static std::unordered_map<uint64_t, int> _key_engine;
+    static std::vector<size_t> _engine_bytes;
+
+    struct Engine {
+        std::mutex mu;
+        std::condition_variable cv;
+        std::deque<BytePSEngineMessage> queue;
+        bool stop = false;
+        int core = -1;
+        std::thread thread;
+    };
+    static std::vector<std::unique_ptr<Engine>> _engines;
+};
+
+} // namespace server
+} // namespace byteps
+
+extern "C" {
+
+void byteps_server();
+
+} // extern "C"
+
+#endif // BYTEPS_SERVER_H
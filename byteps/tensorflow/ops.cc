@@ -71,6 +71,8 @@ const common::DataType ConvertDType(int dtype) {
     return common::BYTEPS_INT64;
   case ::tensorflow::DT_HALF:
     return common::BYTEPS_FLOAT16;
+  case ::tensorflow::DT_BFLOAT16:
+    return common::BYTEPS_BFLOAT16;
   case ::tensorflow::DT_FLOAT:
     return common::BYTEPS_FLOAT32;
   case ::tensorflow::DT_DOUBLE:
@@ -125,9 +127,9 @@ common::ReadyEvent* RecordReadyEvent(::tensorflow::OpKernelContext* context) {
   return nullptr;
 }
 
-extern "C" void byteps_tensorflow_declare_tensor(char* name) {
+extern "C" void byteps_tensorflow_declare_tensor(char* name, long long size) {
     std::string tensor_name(name);
-    common::IsTensorDeclared(tensor_name);
+    common::IsTensorDeclared(tensor_name, size);
     return;
 }
 
@@ -145,10 +147,7 @@ void StartTask(::tensorflow::OpKernelContext* context,
       const_cast<void*>(byteps_input->data()) : nullptr;
   common::InitTensor(byteps_context, size, dtype, cpubuff);
 
-  auto queue_list = common::GetPushQueueList(device);
-  auto queue_list_pull = common::GetPullQueueList(device);
-  queue_list->insert(queue_list->end(),
-                      queue_list_pull->begin(), queue_list_pull->end());
+  auto queue_list = common::GetPushPullQueueList(byteps_context, device);
 
   // TODO: assign priority based on topological sort
   auto enqueue_result = EnqueueTensor(
@@ -193,11 +192,13 @@ public:
 
 REGISTER_KERNEL_BUILDER(Name("BytepsPushPull").Device(::tensorflow::DEVICE_CPU),
                         BytePSPushPullOp);
+#if HAVE_CUDA
 REGISTER_KERNEL_BUILDER(Name("BytepsPushPull").Device(::tensorflow::DEVICE_GPU),
                         BytePSPushPullOp);
+#endif
 
 REGISTER_OP("BytepsPushPull")
-    .Attr("T: {int32, int64, float16, float32, float64}")
+    .Attr("T: {int32, int64, float16, bfloat16, float32, float64}")
     .Input("tensor: T")
     .Output("sum: T")
     .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
@@ -51,7 +51,7 @@ protected:
   ::tensorflow::Tensor tensor_;
 };
 
-extern "C" void byteps_tensorflow_declare_tensor(char* name);
+extern "C" void byteps_tensorflow_declare_tensor(char* name, long long size);
 
 
 } // namespace tensorflow
@@ -68,6 +68,13 @@ def _normalize_name(name):
     return re.sub('[^a-zA-Z0-9_]', '_', name)
 
 
+def _declared_size(tensor):
+    """Bytes of the tensor if its shape is known when building the graph, else 0."""
+    if not tensor.shape.is_fully_defined():
+        return 0
+    return tensor.shape.num_elements() * tensor.dtype.base_dtype.size
+
+
 def _push_pull(tensor, scope='', name=None):
     """An op which sums an input tensor over all the BytePS processes.
     The reduction operation is keyed by the name of the op. The tensor type and
@@ -79,7 +86,8 @@ def _push_pull(tensor, scope='', name=None):
     """
     if name is None and not _executing_eagerly():
         name = 'BytePSPushPull_%s' % _normalize_name(tensor.name)
-    TF_LIB_CTYPES.byteps_tensorflow_declare_tensor(ctypes.c_char_p(scope+name))
+    TF_LIB_CTYPES.byteps_tensorflow_declare_tensor(ctypes.c_char_p(scope+name),
+                                                   ctypes.c_longlong(_declared_size(tensor)))
     return C_LIB.byteps_push_pull(tensor, name=name)
 
 
@@ -108,7 +116,8 @@ def broadcast(tensor, root_rank, name=None, is_variable=True):
     # Broadcast is implemented as push + pull after zero-ing non-root tensors
     if name is None and not _executing_eagerly():
         name = 'BytePSBroadcast_%s' % _normalize_name(tensor.name)
-    TF_LIB_CTYPES.byteps_tensorflow_declare_tensor(ctypes.c_char_p(name))
+    TF_LIB_CTYPES.byteps_tensorflow_declare_tensor(ctypes.c_char_p(name),
+                                                   ctypes.c_longlong(_declared_size(tensor)))
     if is_variable and (root_rank != rank()):
         return C_LIB.byteps_push_pull(tensor.assign(tf.zeros_like(tensor)), name=name)
     else:
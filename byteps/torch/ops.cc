@@ -65,7 +65,7 @@ int DoPushPull(::torch::Tensor tensor, ::torch::Tensor output, int average,
     auto dtype = byteps_input->dtype();
 
     // check if we need to init the tensor
-    if (!common::IsTensorDeclared(tensor_name)) {
+    if (!common::IsTensorDeclared(tensor_name, size)) {
         // we need to init this tensor with PS
         auto& context = common::GetContextFromName(tensor_name);
         // the following init is blocking, in order to guarantee the order
@@ -75,21 +75,23 @@ int DoPushPull(::torch::Tensor tensor, ::torch::Tensor output, int average,
 
     auto& context = common::GetContextFromName(tensor_name);
 
-    auto queue_list = common::GetPushQueueList(device);
-    auto queue_list_pull = common::GetPullQueueList(device);
-    queue_list->insert(queue_list->end(),
-                       queue_list_pull->begin(), queue_list_pull->end());
+    auto queue_list = common::GetPushPullQueueList(context, device);
+
+    // Average within the BytePS stages, which saves a pass over the output
+    // on the framework stream, unless this configuration cannot
+    bool scale_in_core = common::CanScaleInCore(dtype);
+    double scale = (average && scale_in_core) ? 1.0 / byteps_size() : 1.0;
 
     auto enqueue_result = common::EnqueueTensor(
         context, byteps_input, byteps_output, ready_event,
         device, priority, version,
-        [handle, average, tensor](const Status& status) mutable {
+        [handle, average, scale_in_core, output](const Status& status) mutable {
             // Will execute in the `device` context.
-            if (average) {
-                tensor.div_(byteps_size());
+            if (average && !scale_in_core) {
+                output.div_(byteps_size());
             }
             handle_manager.MarkDone(handle, status);
-        }, queue_list);
+        }, queue_list, scale);
 
     ThrowIfError(enqueue_result);
 
@@ -111,6 +113,7 @@ PYBIND11_MODULE(c_lib, m) {
   m.def("byteps_torch_push_pull_async_torch_IntTensor", &DoPushPull);
   m.def("byteps_torch_push_pull_async_torch_LongTensor", &DoPushPull);
   m.def("byteps_torch_push_pull_async_torch_HalfTensor", &DoPushPull);
+  m.def("byteps_torch_push_pull_async_torch_BFloat16Tensor", &DoPushPull);
   m.def("byteps_torch_push_pull_async_torch_FloatTensor", &DoPushPull);
   m.def("byteps_torch_push_pull_async_torch_DoubleTensor", &DoPushPull);
 
@@ -118,6 +121,7 @@ PYBIND11_MODULE(c_lib, m) {
   m.def("byteps_torch_push_pull_async_torch_cuda_IntTensor", &DoPushPull);
   m.def("byteps_torch_push_pull_async_torch_cuda_LongTensor", &DoPushPull);
   m.def("byteps_torch_push_pull_async_torch_cuda_HalfTensor", &DoPushPull);
+  m.def("byteps_torch_push_pull_async_torch_cuda_BFloat16Tensor", &DoPushPull);
   m.def("byteps_torch_push_pull_async_torch_cuda_FloatTensor", &DoPushPull);
   m.def("byteps_torch_push_pull_async_torch_cuda_DoubleTensor", &DoPushPull);
 #endif
@@ -36,13 +36,15 @@ if __name__ == "__main__":
         for i in range(local_size):
             t[i].join() 
 
-    else:
-        if "BYTEPS_SERVER_MXNET_PATH" not in os.environ:
-            print "BYTEPS_SERVER_MXNET_PATH env not set"
-            os._exit(0)
+    elif "BYTEPS_SERVER_MXNET_PATH" in os.environ:
+        # the MXNet KVStore server built for BytePS
         sys.path.insert(0, os.getenv("BYTEPS_SERVER_MXNET_PATH")+"/python")
         import mxnet
         print "BytePS Server MXNet version: " + mxnet.__version__
         # TODO: terminates when workers quit
         while True:
             time.sleep(3600)
+
+    else:
+        import byteps.server
+        byteps.server.run()
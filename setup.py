@@ -23,6 +23,7 @@ import traceback
 tensorflow_lib = Extension('byteps.tensorflow.c_lib', [])
 mxnet_lib = Extension('byteps.mxnet.c_lib', [])
 pytorch_lib = Extension('byteps.torch.c_lib', [])
+server_lib = Extension('byteps.server.c_lib', [])
 
 # Package meta-data.
 NAME = 'byteps'
@@ -227,6 +228,11 @@ def get_link_flags(build_ext):
     raise DistutilsPlatformError(last_err)
 
 
+def is_cpu_only():
+    # build for hosts without GPUs, see BYTEPS_CPU_ONLY in byteps/common
+    return int(os.environ.get('BYTEPS_CPU_ONLY', 0)) == 1
+
+
 def get_common_options(build_ext):
     cpp_flags = get_cpp_flags(build_ext)
     link_flags = get_link_flags(build_ext)
@@ -240,10 +246,20 @@ def get_common_options(build_ext):
                'byteps/common/logging.cc',
                'byteps/common/communicator.cc',
                'byteps/common/scheduled_queue.cc',
+               'byteps/common/task_notifier.cc',
+               'byteps/common/executor.cc',
                'byteps/common/ready_table.cc',
                'byteps/common/shared_memory.cc',
-               'byteps/common/nccl_manager.cc',
-               'byteps/common/cpu_reducer.cc']
+               'byteps/common/backend.cc',
+               'byteps/common/fusion.cc',
+               'byteps/common/partition.cc',
+               'byteps/common/cpu_reducer.cc',
+               'byteps/common/cpu_reducer_simd.cc',
+               'byteps/common/reducer_pool.cc']
+    if is_cpu_only():
+        MACROS += [('BYTEPS_CPU_ONLY', '1')]
+    else:
+        SOURCES += ['byteps/common/nccl_manager.cc']
     if "BYTEPS_USE_MPI" in os.environ and os.environ["BYTEPS_USE_MPI"] == "1":
         mpi_flags = get_mpi_flags()
         COMPILE_FLAGS = cpp_flags + \
@@ -255,10 +271,11 @@ def get_common_options(build_ext):
     LIBRARY_DIRS = []
     LIBRARIES = []
 
-    nccl_include_dirs, nccl_lib_dirs, nccl_libs = get_nccl_vals()
-    INCLUDES += nccl_include_dirs
-    LIBRARY_DIRS += nccl_lib_dirs
-    LIBRARIES += nccl_libs
+    if not is_cpu_only():
+        nccl_include_dirs, nccl_lib_dirs, nccl_libs = get_nccl_vals()
+        INCLUDES += nccl_include_dirs
+        LIBRARY_DIRS += nccl_lib_dirs
+        LIBRARIES += nccl_libs
 
     # RDMA and NUMA libs
     LIBRARIES += ['numa']
@@ -397,13 +414,14 @@ def build_tf_extension(build_ext, options):
     tf_compile_flags, tf_link_flags = get_tf_flags(
         build_ext, options['COMPILE_FLAGS'])
 
-    # We assume we have CUDA
-    cuda_include_dirs, cuda_lib_dirs = get_cuda_dirs(
-        build_ext, options['COMPILE_FLAGS'])
-    options['MACROS'] += [('HAVE_CUDA', '1')]
-    options['INCLUDES'] += cuda_include_dirs
-    options['LIBRARY_DIRS'] += cuda_lib_dirs
-    options['LIBRARIES'] += ['cudart']
+    # We assume we have CUDA, unless building for CPU only
+    if not is_cpu_only():
+        cuda_include_dirs, cuda_lib_dirs = get_cuda_dirs(
+            build_ext, options['COMPILE_FLAGS'])
+        options['MACROS'] += [('HAVE_CUDA', '1')]
+        options['INCLUDES'] += cuda_include_dirs
+        options['LIBRARY_DIRS'] += cuda_lib_dirs
+        options['LIBRARIES'] += ['cudart']
 
     tensorflow_lib.define_macros = options['MACROS']
     tensorflow_lib.include_dirs = options['INCLUDES']
@@ -605,7 +623,7 @@ def build_mx_extension(build_ext, options):
             'installation does not support CUDA.')
 
     # Update HAVE_CUDA to mean that MXNet supports CUDA.
-    if mx_have_cuda and not macro_have_cuda:
+    if mx_have_cuda and not macro_have_cuda and not is_cpu_only():
         cuda_include_dirs, cuda_lib_dirs = get_cuda_dirs(
             build_ext, options['COMPILE_FLAGS'])
         options['MACROS'] += [('HAVE_CUDA', '1')]
@@ -699,8 +717,9 @@ def is_torch_cuda(build_ext, include_dirs, extra_compile_args):
 
 
 def build_torch_extension(build_ext, options, torch_version):
-    have_cuda = is_torch_cuda(build_ext, include_dirs=options['INCLUDES'],
-                              extra_compile_args=options['COMPILE_FLAGS'])
+    have_cuda = not is_cpu_only() and \
+        is_torch_cuda(build_ext, include_dirs=options['INCLUDES'],
+                      extra_compile_args=options['COMPILE_FLAGS'])
     if not have_cuda and check_macro(options['MACROS'], 'HAVE_CUDA'):
         raise DistutilsPlatformError(
             'byteps build with GPU support was requested, but this PyTorch '
@@ -750,28 +769,59 @@ def build_torch_extension(build_ext, options, torch_version):
     build_ext.build_extension(pytorch_lib)
 
 
+def build_server(build_ext, options):
+    # the server only sums on CPUs, it needs neither CUDA nor a framework
+    server_lib.define_macros = [('BYTEPS_CPU_ONLY', '1'),
+                                ('BYTEPS_BUILDING_SERVER', '1')]
+    server_lib.include_dirs = ['3rdparty/ps-lite/include']
+    server_lib.sources = ['byteps/server/server.cc',
+                          'byteps/common/common.cc',
+                          'byteps/common/logging.cc',
+                          'byteps/common/cpu_reducer.cc',
+                          'byteps/common/cpu_reducer_simd.cc',
+                          'byteps/common/reducer_pool.cc']
+    server_lib.extra_compile_args = options['COMPILE_FLAGS']
+    server_lib.extra_link_args = options['LINK_FLAGS']
+    server_lib.extra_objects = options['EXTRA_OBJECTS']
+    server_lib.library_dirs = []
+    server_lib.libraries = ['numa']
+    if int(os.environ.get('BYTEPS_USE_RDMA', 0)):
+        server_lib.libraries += ['rdmacm', 'ibverbs']
+
+    build_ext.build_extension(server_lib)
+
+
+def build_ps_lite():
+    if not os.path.exists("3rdparty/ps-lite/build/libps.a") or \
+       not os.path.exists("3rdparty/ps-lite/deps/lib"):
+        str_rdma_option = ""
+        if int(os.environ.get('BYTEPS_USE_RDMA', 0)):
+            str_rdma_option += "USE_RDMA=1"
+        make_process = subprocess.Popen('make -j ' + str_rdma_option,
+                                        cwd='3rdparty/ps-lite',
+                                        stdout=sys.stdout,
+                                        stderr=sys.stderr,
+                                        shell=True)
+        make_process.communicate()
+        if make_process.returncode:
+            raise DistutilsSetupError('An ERROR occured while running the '
+                                      'Makefile for the ps-lite library. '
+                                      'Exit code: {0}'.format(make_process.returncode))
+
+
 # run the customize_compiler
 class custom_build_ext(build_ext):
     def build_extensions(self):
-        if not os.path.exists("3rdparty/ps-lite/build/libps.a") or \
-           not os.path.exists("3rdparty/ps-lite/deps/lib"):
-            str_rdma_option = ""
-            if int(os.environ.get('BYTEPS_USE_RDMA', 0)):
-                str_rdma_option += "USE_RDMA=1"
-            make_process = subprocess.Popen('make -j ' + str_rdma_option,
-                                            cwd='3rdparty/ps-lite',
-                                            stdout=sys.stdout,
-                                            stderr=sys.stderr,
-                                            shell=True)
-            make_process.communicate()
-            if make_process.returncode:
-                raise DistutilsSetupError('An ERROR occured while running the '
-                                          'Makefile for the ps-lite library. '
-                                          'Exit code: {0}'.format(make_process.returncode))
+        build_ps_lite()
 
         options = get_common_options(self)
         built_plugins = []
 
+        built_server = False
+        if not int(os.environ.get('BYTEPS_WITHOUT_SERVER', 0)):
+            build_server(self, options)
+            built_server = True
+
         # If PyTorch is installed, it must be imported before others, otherwise
         # we may get an error: dlopen: cannot load any more object with static TLS
         if not int(os.environ.get('BYTEPS_WITHOUT_PYTORCH', 0)):
@@ -814,7 +864,8 @@ class custom_build_ext(build_ext):
                 else:
                     raise
 
-        if not built_plugins:
+        # server hosts may install BytePS without any framework
+        if not built_plugins and not built_server:
             raise DistutilsError(
                 'TensorFlow, MXNet, PyTorch plugins were excluded from build. Aborting.')
         if not any(built_plugins):
@@ -822,6 +873,60 @@ class custom_build_ext(build_ext):
                 'None of TensorFlow, MXNet, PyTorch plugins were built. See errors above.')
 
 
+# python setup.py build_bench
+# Builds build/bench_core from tests/bench_core.cc, the CPU-only microbenchmark
+# of the core. It links like the plugins, but needs no framework or GPU to run.
+class build_bench(build_ext):
+    description = 'build the BytePS core microbenchmark'
+    source = 'tests/bench_core.cc'
+    target = 'bench_core'
+
+    def run(self):
+        from distutils.ccompiler import new_compiler
+        from distutils.sysconfig import customize_compiler
+
+        build_ps_lite()
+
+        self.compiler = new_compiler(compiler=self.compiler,
+                                     verbose=self.verbose,
+                                     dry_run=self.dry_run,
+                                     force=self.force)
+        customize_compiler(self.compiler)
+
+        options = get_common_options(self)
+        cuda_include_dirs, cuda_lib_dirs, cuda_libs = [], [], []
+        if not is_cpu_only():
+            cuda_include_dirs, cuda_lib_dirs = get_cuda_dirs(
+                self, options['COMPILE_FLAGS'])
+            cuda_libs = ['cudart']
+        # the version script only applies to the plugin libraries
+        link_flags = [flag for flag in options['LINK_FLAGS']
+                      if 'byteps.lds' not in flag and 'byteps.exp' not in flag]
+
+        objects = self.compiler.compile(
+            options['SOURCES'] + [self.source],
+            output_dir=self.build_temp,
+            macros=options['MACROS'],
+            include_dirs=options['INCLUDES'] + cuda_include_dirs,
+            extra_postargs=options['COMPILE_FLAGS'])
+        self.compiler.link_executable(
+            objects + options['EXTRA_OBJECTS'], self.target,
+            output_dir='build',
+            libraries=options['LIBRARIES'] + cuda_libs + ['pthread'],
+            library_dirs=options['LIBRARY_DIRS'] + cuda_lib_dirs,
+            extra_postargs=link_flags,
+            target_lang='c++')
+
+
+# python setup.py build_test
+# Builds build/test_core from tests/test_core.cc, the tests of the core,
+# the same way as build_bench.
+class build_test(build_bench):
+    description = 'build the BytePS core tests'
+    source = 'tests/test_core.cc'
+    target = 'test_core'
+
+
 # Where the magic happens:
 setup(
     name=NAME,
@@ -848,11 +953,13 @@ setup(
         'Programming Language :: Python :: Implementation :: CPython',
         'Programming Language :: Python :: Implementation :: PyPy'
     ],
-    ext_modules=[tensorflow_lib, mxnet_lib, pytorch_lib],
+    ext_modules=[server_lib, tensorflow_lib, mxnet_lib, pytorch_lib],
     # $ setup.py publish support.
     cmdclass={
         'upload': UploadCommand,
-        'build_ext': custom_build_ext
+        'build_ext': custom_build_ext,
+        'build_bench': build_bench,
+        'build_test': build_test
     },
     # cffi is required for PyTorch
     # If cffi is specified in setup_requires, it will need libffi to be installed on the machine,
@@ -0,0 +1,646 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+// CPU-only microbenchmark of the BytePS core, built by
+// `python setup.py build_bench`. It needs no GPU, PS or launcher, and prints
+// one JSON document so that results can be compared across releases:
+//
+//   ./build/bench_core [--filter reducer,queue] [--min-time 0.2]
+//                      [--max-bytes 268435456] [--output result.json]
+//
+// Suites:
+//   reducer      CpuReducer sum of every dtype over 4KB-256MB buffers, with
+//                1/4/16 reducer threads, and with/without streaming stores
+//   reducer_ops  all reduce ops over 2 (reduce) and 4 (reduce_n) sources
+//   queue        BytePSScheduledQueue add/get at a constant queue depth
+//   ready_table  ReadyTable::AddReadyCount from threads racing on the keys
+//   comm         BytePSComm socket/shm signal round trip and message rate
+//                between two forked processes. They use the same socket
+//                paths and shm names as a job, so do not run this suite on
+//                a host where BytePS is running.
+//   pipeline     push_pull of float32 tensors through all stages of
+//                byteps_init(), against the loopback PS backend simulating
+//                4 workers (or DMLC_NUM_WORKER), with one thread per stage
+//                and with executors of 1, 2 and 4 threads. Not run unless
+//                filtered for, as it needs a GPU unless built with
+//                BYTEPS_CPU_ONLY.
+//
+// gbps is the size of one buffer divided by the time to reduce it, like
+// the algorithm bandwidth of nccl-tests, not the memory traffic.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <signal.h>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../byteps/common/common.h"
+#include "../byteps/common/communicator.h"
+#include "../byteps/common/cpu_reducer.h"
+#include "../byteps/common/logging.h"
+#include "../byteps/common/operations.h"
+#include "../byteps/common/ready_table.h"
+#include "../byteps/common/scheduled_queue.h"
+
+namespace byteps {
+namespace common {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    std::vector<std::string> filter;
+    double min_time = 0.2;
+    size_t max_bytes = 256 << 20;
+    std::string output;
+    // internal, set in the child process of the pipeline suite
+    int pipeline_fd = -1;
+};
+
+// One result as a flat JSON object, keys are kept in insertion order
+class Record {
+
+public:
+    Record(const std::string &suite) { Set("suite", suite); }
+
+    Record& Set(const std::string &key, const std::string &value) {
+        return Add(key, "\"" + value + "\"");
+    }
+    Record& Set(const std::string &key, const char* value) { return Set(key, std::string(value)); }
+    Record& Set(const std::string &key, bool value) { return Add(key, value ? "true" : "false"); }
+    Record& Set(const std::string &key, int64_t value) { return Add(key, std::to_string(value)); }
+    Record& Set(const std::string &key, int value) { return Set(key, (int64_t) value); }
+    Record& Set(const std::string &key, size_t value) { return Set(key, (int64_t) value); }
+    Record& Set(const std::string &key, double value) {
+        std::ostringstream os;
+        os.precision(6);
+        os << value;
+        return Add(key, os.str());
+    }
+
+    std::string ToJson() const {
+        std::string json = "{";
+        for (size_t i = 0; i < _fields.size(); ++i) {
+            if (i) json += ", ";
+            json += "\"" + _fields[i].first + "\": " + _fields[i].second;
+        }
+        return json + "}";
+    }
+
+private:
+    Record& Add(const std::string &key, const std::string &json) {
+        _fields.emplace_back(key, json);
+        return *this;
+    }
+
+    std::vector<std::pair<std::string, std::string>> _fields;
+};
+
+// Runs fn once to warm up, then in batches until min_time elapsed and at
+// least 3 runs were timed. Returns the mean seconds per run.
+template <typename Function>
+double TimeIt(double min_time, Function fn, int64_t* runs = nullptr) {
+    fn();
+    int64_t n = 0;
+    int64_t batch = 1;
+    double elapsed = 0;
+    while (elapsed < min_time || n < 3) {
+        auto start = Clock::now();
+        for (int64_t i = 0; i < batch; ++i) fn();
+        elapsed += std::chrono::duration<double>(Clock::now() - start).count();
+        n += batch;
+        if (elapsed < min_time / 10) batch *= 2;
+    }
+    if (runs) *runs = n;
+    return elapsed / n;
+}
+
+const std::vector<std::pair<DataType, const char*>> kDataTypes = {
+    {BYTEPS_FLOAT32, "float32"}, {BYTEPS_FLOAT64, "float64"},
+    {BYTEPS_FLOAT16, "float16"}, {BYTEPS_BFLOAT16, "bfloat16"},
+    {BYTEPS_UINT8, "uint8"}, {BYTEPS_INT8, "int8"},
+    {BYTEPS_INT32, "int32"}, {BYTEPS_INT64, "int64"},
+};
+
+const std::vector<std::pair<ReduceOp, const char*>> kReduceOps = {
+    {BYTEPS_OP_SUM, "sum"}, {BYTEPS_OP_AVERAGE, "average"},
+    {BYTEPS_OP_MAX, "max"}, {BYTEPS_OP_MIN, "min"},
+    {BYTEPS_OP_PRODUCT, "product"},
+};
+
+const char* SimdLevelName(SimdLevel level) {
+    switch (level) {
+        case SIMD_AVX512: return "avx512";
+        case SIMD_AVX2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+// Buffers of len bytes, touched so that page faults are not timed. The
+// pattern is a normal number for every floating type (about 0.01 to 1), so
+// that sums and products neither overflow nor hit denormals quickly.
+std::vector<std::vector<char>> MakeBuffers(int n, size_t len) {
+    return std::vector<std::vector<char>>(n, std::vector<char>(len, 0x3c));
+}
+
+// CpuReducer reads its tuning variables once, at construction or first use
+std::unique_ptr<CpuReducer> MakeReducer(int threads, bool stream) {
+    setenv("BYTEPS_CPU_REDUCER_THREADS", std::to_string(threads).c_str(), 1);
+    setenv("BYTEPS_CPU_REDUCER_STREAM_BYTES", stream ? "0" : "1099511627776", 1);
+    return std::unique_ptr<CpuReducer>(new CpuReducer(nullptr));
+}
+
+void BenchReducer(const BenchOptions &opt, std::vector<Record>* results) {
+    for (size_t len = 4096; len <= opt.max_bytes; len *= 16) {
+        auto bufs = MakeBuffers(3, len);
+        for (int threads : {1, 4, 16}) {
+            // streaming only pays off once the output does not fit in the caches
+            for (bool stream : {false, true}) {
+                if (stream && len < (1 << 20)) continue;
+                auto reducer = MakeReducer(threads, stream);
+                for (auto &dtype : kDataTypes) {
+                    int64_t runs;
+                    double t = TimeIt(opt.min_time, [&] {
+                        reducer->sum(bufs[0].data(), bufs[1].data(), bufs[2].data(), len, dtype.first);
+                    }, &runs);
+                    results->push_back(Record("reducer")
+                        .Set("dtype", dtype.second).Set("op", "sum").Set("sources", 2)
+                        .Set("bytes", len).Set("threads", threads).Set("stream", stream)
+                        .Set("runs", runs).Set("ns", t * 1e9).Set("gbps", len / t / 1e9));
+                }
+            }
+        }
+    }
+}
+
+void BenchReducerOps(const BenchOptions &opt, std::vector<Record>* results) {
+    for (size_t len : {(size_t) 1 << 20, (size_t) 64 << 20}) {
+        if (len > opt.max_bytes) continue;
+        auto bufs = MakeBuffers(5, len);
+        void* srcs[4] = {bufs[1].data(), bufs[2].data(), bufs[3].data(), bufs[4].data()};
+        auto reducer = MakeReducer(BYTEPS_CPU_REDUCER_THREADS, len >= BYTEPS_CPU_REDUCER_STREAM_BYTES);
+        for (auto &dtype : kDataTypes) {
+            for (auto &op : kReduceOps) {
+                for (int n : {2, 4}) {
+                    // AVERAGE is a SUM scaled by the number of sources, as in PCIE_REDUCE
+                    double scale = (op.first == BYTEPS_OP_AVERAGE) ? 1.0 / n : 1.0;
+                    int64_t runs;
+                    double t = TimeIt(opt.min_time, [&] {
+                        if (n == 2 && scale == 1.0) {
+                            reducer->reduce(bufs[0].data(), srcs[0], srcs[1], len, dtype.first, op.first);
+                        } else {
+                            reducer->reduce_n(bufs[0].data(), srcs, n, len, dtype.first, op.first, scale);
+                        }
+                    }, &runs);
+                    results->push_back(Record("reducer_ops")
+                        .Set("dtype", dtype.second).Set("op", op.second).Set("sources", n)
+                        .Set("bytes", len).Set("threads", BYTEPS_CPU_REDUCER_THREADS)
+                        .Set("runs", runs).Set("ns", t * 1e9).Set("gbps", len / t / 1e9));
+                }
+            }
+        }
+    }
+}
+
+void BenchQueue(const BenchOptions &opt, std::vector<Record>* results) {
+    for (int depth : {1, 16, 256, 4096, 16384, 65536}) {
+        for (bool by_key : {false, true}) {
+            // a queue type without ReadyTable or credits, so BytePSGlobal is not needed
+            BytePSScheduledQueue queue(PULL);
+            std::vector<std::shared_ptr<TensorTableEntry>> queued;
+            for (int i = 0; i <= depth; ++i) {
+                auto task = std::make_shared<TensorTableEntry>();
+                task->tensor_name = "bench_queue";
+                task->key = ((uint64_t) i << BYTEPS_KEY_PARTITION_BITS) | (i & 0xff);
+                task->priority = -i;
+                task->len = 4096;
+                queued.push_back(task);
+            }
+            auto next = queued.back();
+            queued.pop_back();
+            for (auto &task : queued) queue.addTask(task);
+
+            // every run adds one task and takes one, so the depth stays the same
+            uint64_t lcg = 1;
+            int64_t runs;
+            double t = TimeIt(opt.min_time, [&] {
+                queue.addTask(next);
+                if (by_key) {
+                    // take a random queued task, as the non-root COPYH2D loop does
+                    queued.push_back(next);
+                    lcg = lcg * 6364136223846793005ULL + 1442695040888963407ULL;
+                    size_t i = (lcg >> 33) % queued.size();
+                    std::swap(queued[i], queued.back());
+                    next = queue.getTask(queued.back()->key);
+                    queued.pop_back();
+                } else {
+                    next = queue.getTask();
+                }
+                BPS_CHECK(next);
+            }, &runs);
+            results->push_back(Record("queue")
+                .Set("depth", depth).Set("get", by_key ? "key" : "front")
+                .Set("runs", runs).Set("ns", t * 1e9));
+        }
+    }
+}
+
+class SpinBarrier {
+
+public:
+    SpinBarrier(int count) : _count(count), _waiting(0), _generation(0) {}
+
+    void Wait() {
+        int generation = _generation.load();
+        if (_waiting.fetch_add(1) + 1 == _count) {
+            _waiting.store(0);
+            _generation.fetch_add(1);
+            return;
+        }
+        while (_generation.load() == generation) std::this_thread::yield();
+    }
+
+private:
+    int _count;
+    std::atomic<int> _waiting;
+    std::atomic<int> _generation;
+};
+
+void BenchReadyTable(const BenchOptions &opt, std::vector<Record>* results) {
+    // 4096 tensors of 16 partitions, all threads count every key in the same order
+    const int kKeys = 1 << 16;
+    int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int threads : {1, 2, 4, 8, 16}) {
+        if (threads > max_threads) break;
+        ReadyTable table(threads, "bench_ready_table");
+        std::atomic<int64_t> ready(0);
+        table.SetReadyCallback([&](uint64_t) { ready++; });
+
+        // one round counts every key to completion, rounds are separated by
+        // barriers so that the clears of the main thread do not race
+        SpinBarrier start(threads + 1), done(threads + 1);
+        std::atomic<bool> stop(false);
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; ++i) {
+            workers.emplace_back([&] {
+                while (true) {
+                    start.Wait();
+                    if (stop) return;
+                    for (int k = 0; k < kKeys; ++k) {
+                        table.AddReadyCount(((uint64_t) (k >> 4) << BYTEPS_KEY_PARTITION_BITS) | (k & 15));
+                    }
+                    done.Wait();
+                }
+            });
+        }
+        int64_t rounds;
+        double t = TimeIt(opt.min_time, [&] {
+            start.Wait();
+            done.Wait();
+            for (int k = 0; k < kKeys; ++k) {
+                table.ClearReadyCount(((uint64_t) (k >> 4) << BYTEPS_KEY_PARTITION_BITS) | (k & 15));
+            }
+        }, &rounds);
+        stop = true;
+        start.Wait();
+        for (auto &w : workers) w.join();
+
+        BPS_CHECK_EQ(ready.load(), rounds * kKeys + kKeys);
+        results->push_back(Record("ready_table")
+            .Set("threads", threads).Set("keys", kKeys).Set("rounds", rounds)
+            .Set("ns_per_add", t * 1e9 / ((double) kKeys * threads)));
+    }
+}
+
+struct CommResult {
+    double mean_us;
+    double p50_us;
+    double p99_us;
+    double msgs_per_sec;
+};
+
+// One of two non-root local ranks, they signal each other directly so that
+// the listen thread of the root (which would need BytePSGlobal) is not involved.
+// Rank 0 measures and writes a CommResult to fd. Exits the process without
+// running the destructors, the communicators do not shut down cleanly.
+void RunCommPeer(bool shm, int rank, int fd) {
+    const int kRoundTrips = 20000;
+    const int kMessages = 200000;
+    setenv("BYTEPS_USE_SHM_COMM", shm ? "1" : "0", 1);
+    setenv("BYTEPS_LOCAL_RANK", std::to_string(rank).c_str(), 1);
+    setenv("BYTEPS_LOCAL_SIZE", "3", 1);
+    setenv("DMLC_WORKER_ID", "0", 1);
+    setenv("DMLC_NUM_WORKER", "1", 1);
+
+    int my_rank, size, local_rank, local_size, worker_id;
+    BytePSRole role;
+    auto comm = CreateComm();
+    comm->init(&my_rank, &size, &local_rank, &local_size, &worker_id, &role);
+
+    int peer = 1 - rank;
+    BytePSCommMsg msg = {rank, REDUCE_READY, 0};
+    char buf[MAX_LINE];
+    int src;
+
+    if (rank == 1) {
+        for (int i = 0; i < kRoundTrips + 1; ++i) {
+            comm->recvSignal(&src, buf, sizeof(buf));
+            comm->sendSignal(peer, &msg, sizeof(msg));
+        }
+        for (int i = 0; i < kMessages; ++i) {
+            comm->recvSignal(&src, buf, sizeof(buf));
+        }
+        comm->sendSignal(peer, &msg, sizeof(msg));
+        _exit(0);
+    }
+
+    // the first round trip waits for the peer to come up
+    comm->sendSignal(peer, &msg, sizeof(msg));
+    comm->recvSignal(&src, buf, sizeof(buf));
+
+    std::vector<double> rtt(kRoundTrips);
+    for (int i = 0; i < kRoundTrips; ++i) {
+        auto start = Clock::now();
+        msg.key = i;
+        comm->sendSignal(peer, &msg, sizeof(msg));
+        comm->recvSignal(&src, buf, sizeof(buf));
+        rtt[i] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    }
+
+    auto start = Clock::now();
+    for (int i = 0; i < kMessages; ++i) {
+        msg.key = i;
+        comm->sendSignal(peer, &msg, sizeof(msg));
+    }
+    comm->recvSignal(&src, buf, sizeof(buf));
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    CommResult result;
+    double total = 0;
+    for (double r : rtt) total += r;
+    result.mean_us = total / kRoundTrips;
+    std::sort(rtt.begin(), rtt.end());
+    result.p50_us = rtt[kRoundTrips / 2];
+    result.p99_us = rtt[kRoundTrips * 99 / 100];
+    result.msgs_per_sec = kMessages / elapsed;
+    BPS_CHECK_EQ(write(fd, &result, sizeof(result)), (ssize_t) sizeof(result));
+    _exit(0);
+}
+
+void BenchComm(const BenchOptions &opt, std::vector<Record>* results) {
+    for (bool shm : {false, true}) {
+        Record record("comm");
+        record.Set("comm", shm ? "shm" : "socket");
+
+        int fds[2];
+        BPS_CHECK_EQ(pipe(fds), 0) << strerror(errno);
+        pid_t pids[2];
+        for (int rank = 0; rank < 2; ++rank) {
+            pids[rank] = fork();
+            BPS_CHECK_GE(pids[rank], 0) << strerror(errno);
+            if (pids[rank] == 0) {
+                close(fds[0]);
+                RunCommPeer(shm, rank, fds[1]);
+            }
+        }
+        close(fds[1]);
+
+        // if either peer dies the other one would wait forever
+        bool ok = true;
+        for (int i = 0; i < 2; ++i) {
+            int status;
+            pid_t pid = wait(&status);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                ok = false;
+                kill(pid == pids[0] ? pids[1] : pids[0], SIGKILL);
+            }
+        }
+        CommResult result;
+        if (ok && read(fds[0], &result, sizeof(result)) == (ssize_t) sizeof(result)) {
+            record.Set("rtt_mean_us", result.mean_us).Set("rtt_p50_us", result.p50_us)
+                  .Set("rtt_p99_us", result.p99_us).Set("msgs_per_sec", result.msgs_per_sec);
+        } else {
+            record.Set("error", "peer failed, see stderr");
+        }
+        close(fds[0]);
+        results->push_back(record);
+    }
+}
+
+class BenchTensor : public Tensor {
+
+public:
+    BenchTensor(size_t count, float value) : _data(count, value) {}
+
+    const DataType dtype() const { return BYTEPS_FLOAT32; }
+    const TensorShape shape() const {
+        TensorShape shape;
+        shape.AddDim(_data.size());
+        return shape;
+    }
+    const void* data() const { return _data.data(); }
+    int64_t size() const { return _data.size() * sizeof(float); }
+
+private:
+    std::vector<float> _data;
+};
+
+struct PipelineResult {
+    size_t bytes;
+    size_t partitions;
+    int workers;
+    int64_t runs;
+    double ns;
+};
+
+// Runs in a child process, as byteps_init() can only be called once.
+// Writes one PipelineResult per tensor size to fd.
+void RunPipeline(const BenchOptions &opt, int fd) {
+    byteps_init();
+
+    for (size_t len = 4096; len <= opt.max_bytes; len *= 16) {
+        auto input = std::make_shared<BenchTensor>(len / sizeof(float), 1.0f);
+        auto output = std::make_shared<BenchTensor>(len / sizeof(float), 0.0f);
+        auto name = "bench_core." + std::to_string(len);
+        IsTensorDeclared(name);
+        auto &context = GetContextFromName(name);
+        InitTensor(context, len, BYTEPS_FLOAT32, const_cast<void*>(input->data()));
+
+        auto queue_list = GetPushPullQueueList(context, CPU_DEVICE_ID);
+
+        int64_t runs;
+        double t = TimeIt(opt.min_time, [&] {
+            std::promise<void> done;
+            auto status = EnqueueTensor(context, input, output, nullptr, CPU_DEVICE_ID, 0, 0,
+                                        [&done](const Status &status) { done.set_value(); },
+                                        queue_list, 1.0);
+            BPS_CHECK(status.ok()) << status.reason();
+            done.get_future().wait();
+        }, &runs);
+
+        auto result = (const float*) output->data();
+        BPS_CHECK_EQ(result[0], byteps_size()) << name;
+        BPS_CHECK_EQ(result[len / sizeof(float) - 1], byteps_size()) << name;
+        PipelineResult r = {len, context.key_list.size(), byteps_size(), runs, t * 1e9};
+        BPS_CHECK_EQ(write(fd, &r, sizeof(r)), (ssize_t) sizeof(r));
+    }
+}
+
+void BenchPipeline(const BenchOptions &opt, std::vector<Record>* results) {
+    // a single local rank, the other workers are simulated by the backend
+    setenv("BYTEPS_LOCAL_RANK", "0", 1);
+    setenv("BYTEPS_LOCAL_SIZE", "1", 1);
+    setenv("DMLC_WORKER_ID", "0", 1);
+    setenv("DMLC_NUM_WORKER", "4", 0);
+    setenv("DMLC_NUM_SERVER", "0", 0);
+    setenv("BYTEPS_FORCE_DISTRIBUTED", "1", 1);
+    setenv("BYTEPS_PS_BACKEND", "loopback", 1);
+    // the reducer suites leave their settings behind
+    unsetenv("BYTEPS_CPU_REDUCER_THREADS");
+    unsetenv("BYTEPS_CPU_REDUCER_STREAM_BYTES");
+
+    // one thread per stage (0), then executors of 1 to 4 threads
+    for (int threads : {0, 1, 2, 4}) {
+        setenv("BYTEPS_USE_EXECUTOR", threads ? "1" : "0", 1);
+        setenv("BYTEPS_EXECUTOR_THREADS", std::to_string(std::max(threads, 1)).c_str(), 1);
+
+        int fds[2];
+        BPS_CHECK_EQ(pipe(fds), 0) << strerror(errno);
+        // re-run this binary rather than fork, as the other suites left threads behind
+        auto fd = std::to_string(fds[1]);
+        auto min_time = std::to_string(opt.min_time);
+        auto max_bytes = std::to_string(opt.max_bytes);
+        const char* args[] = {"bench_core", "--pipeline-fd", fd.c_str(), "--min-time",
+                              min_time.c_str(), "--max-bytes", max_bytes.c_str(), nullptr};
+        pid_t pid = fork();
+        BPS_CHECK_GE(pid, 0) << strerror(errno);
+        if (pid == 0) {
+            close(fds[0]);
+            execv("/proc/self/exe", const_cast<char* const*>(args));
+            _exit(127);
+        }
+        close(fds[1]);
+
+        PipelineResult r;
+        while (read(fds[0], &r, sizeof(r)) == (ssize_t) sizeof(r)) {
+            results->push_back(Record("pipeline")
+                .Set("executor_threads", threads)
+                .Set("bytes", r.bytes).Set("workers", r.workers)
+                .Set("partitions", r.partitions)
+                .Set("runs", r.runs).Set("ns", r.ns).Set("gbps", r.bytes / r.ns));
+        }
+        close(fds[0]);
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            results->push_back(Record("pipeline")
+                .Set("executor_threads", threads)
+                .Set("error", "child failed, see stderr"));
+        }
+    }
+}
+
+bool ShouldRun(const BenchOptions &opt, const std::string &suite) {
+    if (suite == "pipeline" && opt.filter.empty()) {
+        return false;
+    }
+    return opt.filter.empty() ||
+           std::find(opt.filter.begin(), opt.filter.end(), suite) != opt.filter.end();
+}
+
+int Main(int argc, char* argv[]) {
+    BenchOptions opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        BPS_CHECK(i + 1 < argc) << "missing value of " << arg;
+        std::string value = argv[++i];
+        if (arg == "--filter") {
+            std::stringstream ss(value);
+            std::string suite;
+            while (std::getline(ss, suite, ',')) opt.filter.push_back(suite);
+        } else if (arg == "--min-time") {
+            opt.min_time = atof(value.c_str());
+        } else if (arg == "--max-bytes") {
+            opt.max_bytes = strtoull(value.c_str(), nullptr, 0);
+        } else if (arg == "--output") {
+            opt.output = value;
+        } else if (arg == "--pipeline-fd") {
+            opt.pipeline_fd = atoi(value.c_str());
+        } else {
+            BPS_CHECK(0) << "unknown option " << arg;
+        }
+    }
+
+    if (opt.pipeline_fd >= 0) {
+        RunPipeline(opt, opt.pipeline_fd);
+        close(opt.pipeline_fd);
+        return 0;
+    }
+
+    typedef void (*Suite)(const BenchOptions&, std::vector<Record>*);
+    // comm first, forking is only safe before the other suites start threads
+    const std::vector<std::pair<std::string, Suite>> suites = {
+        {"comm", BenchComm}, {"reducer", BenchReducer}, {"reducer_ops", BenchReducerOps},
+        {"queue", BenchQueue}, {"ready_table", BenchReadyTable}, {"pipeline", BenchPipeline},
+    };
+    std::vector<Record> results;
+    for (auto &suite : suites) {
+        if (!ShouldRun(opt, suite.first)) continue;
+        std::cerr << "Running " << suite.first << std::endl;
+        suite.second(opt, &results);
+    }
+
+    std::ostringstream json;
+    json << "{\n  \"simd_level\": \"" << SimdLevelName(GetSimdLevel()) << "\",\n"
+         << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n"
+         << "  \"min_time\": " << opt.min_time << ",\n"
+         << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        json << "    " << results[i].ToJson() << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    json << "  ]\n}\n";
+
+    if (opt.output.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream out(opt.output);
+        BPS_CHECK(out) << "cannot open " << opt.output;
+        out << json.str();
+    }
+    return 0;
+}
+
+} // namespace
+} // namespace common
+} // namespace byteps
+
+int main(int argc, char* argv[]) {
+    auto rc = byteps::common::Main(argc, argv);
+    // The pipeline suite leaves the BytePS threads blocked on their sockets,
+    // so skip the static destructors that would wait for them
+    std::cout.flush();
+    _exit(rc);
+}
@@ -0,0 +1,363 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+// Tests of the BytePS core that need no GPU, PS or launcher, built by
+// `python setup.py build_test`. A failed check aborts with a non-zero exit:
+//
+//   ./build/test_core [--filter executor_event]
+//
+// Tests:
+//   ready_table     threads signal the same keys of a ReadyTable at once,
+//                   the callback of each key fires once per round
+//   fusion_plan     tensors pushed once before training, like the broadcast
+//                   parameters, are left out of the fusion buffers, so the
+//                   tensors pushed in every round do not wait for them
+//   executor_event  a task whose ReadyEvent fires late completes without
+//                   waiting for a parked executor
+//   integer_average an int32 average over simulated workers is scaled after
+//                   the sum, not truncated on each worker
+//
+// The last three run byteps_init() against the loopback PS backend, so they
+// need a GPU unless built with BYTEPS_CPU_ONLY, and run last.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "../byteps/common/common.h"
+#include "../byteps/common/logging.h"
+#include "../byteps/common/operations.h"
+#include "../byteps/common/ready_table.h"
+
+namespace byteps {
+namespace common {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+void TestReadyTable() {
+    const int kSignalers = 8;
+    const int kRounds = 50;
+    const size_t kKeys = 4096;
+    ReadyTable table(kSignalers, "TEST");
+
+    // keys all over the 48 bits, i.e., all over the radix tree
+    std::mt19937_64 rng(42);
+    std::vector<uint64_t> keys;
+    std::unordered_map<uint64_t, size_t> key_index;
+    while (keys.size() < kKeys) {
+        uint64_t declared = rng() & ((1ULL << BYTEPS_KEY_DECLARED_BITS) - 1);
+        uint64_t partition = rng() % 4;
+        uint64_t key = (declared << BYTEPS_KEY_PARTITION_BITS) | partition;
+        if (key_index.emplace(key, keys.size()).second) {
+            keys.push_back(key);
+        }
+    }
+    std::vector<std::atomic<int>> fired(kKeys);
+    for (auto &f : fired) f = 0;
+    table.SetReadyCallback([&](uint64_t key) {
+        auto it = key_index.find(key);
+        BPS_CHECK(it != key_index.end()) << "callback of unknown key " << key;
+        fired[it->second].fetch_add(1);
+    });
+
+    // reading keys that were never signaled must not see them ready
+    uint64_t untouched = (1ULL << (BYTEPS_KEY_PARTITION_BITS + BYTEPS_KEY_DECLARED_BITS)) - 1;
+    BPS_CHECK(!key_index.count(untouched));
+
+    for (int round = 0; round < kRounds; ++round) {
+        std::atomic<bool> signaling{true};
+        std::thread reader([&] {
+            while (signaling) {
+                BPS_CHECK(!table.IsKeyReady(untouched));
+                table.ClearReadyCount(untouched);
+            }
+        });
+        std::vector<std::thread> signalers;
+        for (int t = 0; t < kSignalers; ++t) {
+            signalers.emplace_back([&, t] {
+                // every signaler in its own order, so that any of them may complete a key
+                std::vector<uint64_t> order(keys);
+                std::shuffle(order.begin(), order.end(), std::mt19937_64(round * kSignalers + t));
+                for (auto key : order) {
+                    table.AddReadyCount(key);
+                }
+            });
+        }
+        for (auto &t : signalers) t.join();
+        signaling = false;
+        reader.join();
+
+        for (size_t i = 0; i < kKeys; ++i) {
+            BPS_CHECK_EQ(fired[i].load(), round + 1) << "key " << keys[i] << " round " << round;
+            BPS_CHECK(table.IsKeyReady(keys[i])) << "key " << keys[i];
+            table.ClearReadyCount(keys[i]);
+            BPS_CHECK(!table.IsKeyReady(keys[i])) << "key " << keys[i];
+        }
+    }
+}
+
+class TestTensor : public Tensor {
+
+public:
+    TestTensor(size_t count, float value) : _data(count, value) {}
+
+    const DataType dtype() const { return BYTEPS_FLOAT32; }
+    const TensorShape shape() const {
+        TensorShape shape;
+        shape.AddDim(_data.size());
+        return shape;
+    }
+    const void* data() const { return _data.data(); }
+    int64_t size() const { return _data.size() * sizeof(float); }
+
+private:
+    std::vector<float> _data;
+};
+
+class Int32TestTensor : public Tensor {
+
+public:
+    Int32TestTensor(size_t count, int32_t value) : _data(count, value) {}
+
+    const DataType dtype() const { return BYTEPS_INT32; }
+    const TensorShape shape() const {
+        TensorShape shape;
+        shape.AddDim(_data.size());
+        return shape;
+    }
+    const void* data() const { return _data.data(); }
+    int64_t size() const { return _data.size() * sizeof(int32_t); }
+
+private:
+    std::vector<int32_t> _data;
+};
+
+// Fires when the test says so, without notifying anyone, like a CUDA event
+class ManualReadyEvent : public ReadyEvent {
+
+public:
+    bool Ready() const { return _ready.load(); }
+    void Fire() { _ready = true; }
+
+private:
+    std::atomic<bool> _ready{false};
+};
+
+// park long enough that a missed event shows up as a timeout
+const int kParkUs = 2000000;
+
+// byteps_init() can only run once, so with the settings of all tests
+void InitBytePS() {
+    static bool initialized = false;
+    if (initialized) return;
+    initialized = true;
+    setenv("BYTEPS_LOCAL_RANK", "0", 1);
+    setenv("BYTEPS_LOCAL_SIZE", "1", 1);
+    setenv("DMLC_WORKER_ID", "0", 1);
+    // the loopback server sums each push as if from two workers
+    setenv("DMLC_NUM_WORKER", "2", 1);
+    setenv("DMLC_NUM_SERVER", "0", 0);
+    setenv("BYTEPS_FORCE_DISTRIBUTED", "1", 1);
+    setenv("BYTEPS_PS_BACKEND", "loopback", 1);
+    setenv("BYTEPS_USE_EXECUTOR", "1", 1);
+    setenv("BYTEPS_IDLE_PARK_US", std::to_string(kParkUs).c_str(), 1);
+    setenv("BYTEPS_FUSION_THRESHOLD", "65536", 1);
+    byteps_init();
+}
+
+void TestFusionPlan() {
+    InitBytePS();
+    struct Pushed {
+        std::string name;
+        size_t count;
+        BPSContext* context;
+    };
+    // in the order of a torch job: broadcast_parameters() declares and pushes
+    // the parameters once, then the optimizer the gradients in every round.
+    // The big gradient is not fusible, so the small tensors on either side
+    // of it are neighbours in the plan.
+    std::vector<Pushed> parameters = {{"Parameter.w", 256}, {"Parameter.b", 16}};
+    std::vector<Pushed> gradients = {{"Gradient.embedding", 65536}, {"Gradient.w", 256},
+                                     {"Gradient.b", 16}};
+    auto push = [](std::vector<Pushed> &tensors, int round) {
+        std::vector<std::shared_ptr<TestTensor>> outputs;
+        std::atomic<size_t> done{0};
+        for (size_t i = 0; i < tensors.size(); ++i) {
+            auto &t = tensors[i];
+            if (!t.context) {
+                IsTensorDeclared(t.name);
+                t.context = &GetContextFromName(t.name);
+                InitTensor(*t.context, t.count * sizeof(float), BYTEPS_FLOAT32, nullptr);
+            }
+            auto input = std::make_shared<TestTensor>(t.count, (float) (round + i));
+            outputs.push_back(std::make_shared<TestTensor>(t.count, -1.0f));
+            auto status = EnqueueTensor(*t.context, input, outputs.back(), nullptr,
+                                        CPU_DEVICE_ID, 0, round,
+                                        [&done](const Status &status) {
+                                            BPS_CHECK(status.ok()) << status.reason();
+                                            ++done;
+                                        },
+                                        GetPushPullQueueList(*t.context, CPU_DEVICE_ID), 1.0);
+            BPS_CHECK(status.ok()) << status.reason();
+        }
+        auto deadline = Clock::now() + std::chrono::seconds(10);
+        while (done < tensors.size()) {
+            BPS_CHECK(Clock::now() < deadline) << "round " << round << " hangs, "
+                                               << done << " of " << tensors.size() << " done";
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        for (size_t i = 0; i < tensors.size(); ++i) {
+            auto result = (const float*) outputs[i]->data();
+            for (size_t k = 0; k < tensors[i].count; ++k) {
+                BPS_CHECK_EQ(result[k], (round + i) * byteps_size())
+                    << tensors[i].name << "[" << k << "] round " << round;
+            }
+        }
+    };
+
+    push(parameters, 0);
+    // the plan happens in the third round of the gradients
+    for (int round = 1; round <= 5; ++round) {
+        push(gradients, round);
+    }
+    for (auto &t : parameters) {
+        BPS_CHECK(!t.context->fusion) << t.name << " is fused";
+    }
+    BPS_CHECK(!gradients[0].context->fusion);
+    BPS_CHECK(gradients[1].context->fusion);
+    BPS_CHECK_EQ(gradients[1].context->fusion, gradients[2].context->fusion);
+}
+
+void TestExecutorEvent() {
+    InitBytePS();
+
+    const size_t len = 4096;
+    auto input = std::make_shared<TestTensor>(len / sizeof(float), 1.0f);
+    auto output = std::make_shared<TestTensor>(len / sizeof(float), 0.0f);
+    std::string name = "test_core.executor_event";
+    IsTensorDeclared(name);
+    auto &context = GetContextFromName(name);
+    InitTensor(context, len, BYTEPS_FLOAT32, const_cast<void*>(input->data()));
+
+    auto queue_list = GetPushPullQueueList(context, CPU_DEVICE_ID);
+
+    for (int round = 0; round < 3; ++round) {
+        auto event = std::make_shared<ManualReadyEvent>();
+        std::promise<void> done;
+        auto status = EnqueueTensor(context, input, output, event, CPU_DEVICE_ID, 0, round,
+                                    [&done](const Status &status) { done.set_value(); },
+                                    queue_list, 1.0);
+        BPS_CHECK(status.ok()) << status.reason();
+        // let the executor run out of work and park
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        auto fired = Clock::now();
+        event->Fire();
+        auto future = done.get_future();
+        BPS_CHECK(future.wait_for(std::chrono::microseconds(kParkUs / 4)) ==
+                  std::future_status::ready)
+            << "round " << round << " waited for the executor to unpark";
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - fired).count();
+        std::cerr << "  round " << round << " done " << ms << "ms after the event" << std::endl;
+
+        auto result = (const float*) output->data();
+        BPS_CHECK_EQ(result[0], byteps_size());
+        BPS_CHECK_EQ(result[len / sizeof(float) - 1], byteps_size());
+    }
+}
+
+void TestIntegerAverage() {
+    InitBytePS();
+
+    const size_t count = 1024;
+    std::string name = "test_core.integer_average";
+    IsTensorDeclared(name);
+    auto &context = GetContextFromName(name);
+    InitTensor(context, count * sizeof(int32_t), BYTEPS_INT32, nullptr, BYTEPS_OP_AVERAGE);
+
+    for (int round = 0; round < 3; ++round) {
+        // scaled before the sum, each worker's 1 / byteps_size() truncates to 0
+        auto input = std::make_shared<Int32TestTensor>(count, 1);
+        auto output = std::make_shared<Int32TestTensor>(count, -1);
+        std::promise<void> done;
+        auto status = EnqueueTensor(context, input, output, nullptr, CPU_DEVICE_ID, 0, round,
+                                    [&done](const Status &status) { done.set_value(); },
+                                    GetPushPullQueueList(context, CPU_DEVICE_ID), 1.0);
+        BPS_CHECK(status.ok()) << status.reason();
+        done.get_future().wait();
+        auto result = (const int32_t*) output->data();
+        for (size_t k = 0; k < count; ++k) {
+            BPS_CHECK_EQ(result[k], 1) << "[" << k << "] round " << round;
+        }
+    }
+}
+
+bool ShouldRun(const std::vector<std::string> &filter, const std::string &test) {
+    return filter.empty() || std::find(filter.begin(), filter.end(), test) != filter.end();
+}
+
+int Main(int argc, char* argv[]) {
+    std::vector<std::string> filter;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        BPS_CHECK(i + 1 < argc) << "missing value of " << arg;
+        std::string value = argv[++i];
+        if (arg == "--filter") {
+            std::stringstream ss(value);
+            std::string test;
+            while (std::getline(ss, test, ',')) filter.push_back(test);
+        } else {
+            BPS_CHECK(0) << "unknown option " << arg;
+        }
+    }
+
+    // byteps_init() can only run once, so the tests calling it go last
+    const std::vector<std::pair<std::string, void (*)()>> tests = {
+        {"ready_table", TestReadyTable},
+        {"fusion_plan", TestFusionPlan},
+        {"executor_event", TestExecutorEvent},
+        {"integer_average", TestIntegerAverage},
+    };
+    for (auto &test : tests) {
+        if (!ShouldRun(filter, test.first)) continue;
+        std::cerr << "[ RUN  ] " << test.first << std::endl;
+        test.second();
+        std::cerr << "[ PASS ] " << test.first << std::endl;
+    }
+    return 0;
+}
+
+} // namespace
+} // namespace common
+} // namespace byteps
+
+int main(int argc, char* argv[]) {
+    auto rc = byteps::common::Main(argc, argv);
+    // byteps_init() leaves the BytePS threads blocked on their sockets,
+    // so skip the static destructors that would wait for them
+    std::cerr.flush();
+    _exit(rc);
+}
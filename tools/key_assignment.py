@@ -0,0 +1,118 @@
+#!/usr/bin/python
+"""Evaluates how evenly BytePS spreads a model's tensors over the servers.
+
+Mirrors the partitioning of InitTensor() and the server assignment of
+BytePSGlobal::EncodeDefaultKey(), whose greedy plan also takes the tensors
+in declaration order, and prints the bytes each server receives
+per iteration under each assignment, with the max/mean imbalance the
+summary log at shutdown reports too.
+
+The tensor sizes in bytes are read one per line, optionally after a name,
+in declaration order:
+
+    python tools/key_assignment.py --num-servers 8 sizes.txt
+
+or taken from a torchvision model, as float32:
+
+    python tools/key_assignment.py --num-servers 8 --torchvision resnet50
+"""
+
+from __future__ import print_function
+
+import argparse
+import sys
+
+# see BytePSGlobal::GetKeyPartitionBits(), by BYTEPS_KEY_LAYOUT
+KEY_PARTITION_BITS = {"native": 20, "mxnet": 16}
+
+
+def align_to(x, alignment):
+    return x // alignment * alignment
+
+
+def partition_bytes(size, args):
+    bound = align_to(args.partition_bytes, 8 * args.local_size)
+    if args.partition_policy == "fixed":
+        return bound
+    # see BytePSPartitionPolicyAdaptive
+    alignment = 8 * args.local_size
+    min_bytes = max(args.min_bytes * args.local_size, alignment)
+    needed = (size + bound - 1) // bound
+    parts = (needed + args.num_servers - 1) // args.num_servers * args.num_servers
+    parts = max(min(parts, size // min_bytes), needed)
+    if parts <= 1:
+        return bound
+    part = (size + parts - 1) // parts
+    return (part + alignment - 1) // alignment * alignment
+
+
+def partitions(sizes, args):
+    """(key, len) of every partition in the order of the tensors"""
+    for declared_key, size in enumerate(sizes):
+        bound = partition_bytes(size, args)
+        key = declared_key << KEY_PARTITION_BITS[args.key_layout]
+        accumulated = 0
+        while accumulated < size:
+            length = min(bound, size - accumulated)
+            yield key, length
+            key += 1
+            accumulated += length
+
+
+def assign(sizes, args, assignment):
+    load = [0] * args.num_servers
+    keys = [0] * args.num_servers
+    for key, length in partitions(sizes, args):
+        if assignment == "greedy":
+            server = load.index(min(load))
+        else:
+            bits = KEY_PARTITION_BITS[args.key_layout]
+            server = (((key >> bits) + key) * 9973) % args.num_servers
+        load[server] += length
+        keys[server] += 1
+    return load, keys
+
+
+def read_sizes(args):
+    if args.torchvision:
+        import torchvision.models
+        model = getattr(torchvision.models, args.torchvision)()
+        return [p.numel() * 4 for p in model.parameters()]
+    sizes = []
+    f = open(args.sizes) if args.sizes != "-" else sys.stdin
+    for line in f:
+        fields = line.split()
+        if fields:
+            sizes.append(int(fields[-1]))
+    return sizes
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("sizes", nargs="?", default="-",
+                        help="file of tensor sizes in bytes, - for stdin")
+    parser.add_argument("--torchvision", help="take the sizes from this torchvision model")
+    parser.add_argument("--num-servers", type=int, required=True)
+    parser.add_argument("--local-size", type=int, default=8,
+                        help="GPUs per worker, for the partition alignment")
+    parser.add_argument("--partition-bytes", type=int, default=4096000)
+    parser.add_argument("--partition-policy", choices=["fixed", "adaptive"], default="fixed")
+    parser.add_argument("--min-bytes", type=int, default=128 * 1024,
+                        help="BYTEPS_PARTITION_MIN_BYTES of the adaptive policy")
+    parser.add_argument("--key-layout", choices=["native", "mxnet"], default="native",
+                        help="BYTEPS_KEY_LAYOUT, the hash depends on it")
+    parser.add_argument("--assignment", choices=["hash", "greedy"], action="append",
+                        help="BYTEPS_KEY_ASSIGNMENT to evaluate, all by default")
+    args = parser.parse_args()
+
+    sizes = read_sizes(args)
+    if not sizes:
+        sys.exit("no tensor sizes given")
+    print("%d tensors, %d bytes, %d partitions" % (
+        len(sizes), sum(sizes), len(list(partitions(sizes, args)))))
+    for assignment in args.assignment or ["hash", "greedy"]:
+        load, keys = assign(sizes, args, assignment)
+        mean = float(sum(load)) / len(load)
+        print("%s: max/mean=%.3f" % (assignment, max(load) / mean if mean else 1.0))
+        for server, (l, k) in enumerate(zip(load, keys)):
+            print("  server %d: %d bytes in %d keys" % (server, l, k))